@@ -0,0 +1,553 @@
+#include "json.hpp"
+#include "objectLoader.h"
+#include "optifuser.h"
+#include "renderer.h"
+#include "scene.h"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+
+using json = nlohmann::json;
+namespace fs = std::filesystem;
+using Clock = std::chrono::steady_clock;
+
+struct BenchOptions {
+  std::string root = "..";
+  std::string output = "bench.json";
+  std::string baseline;
+  std::vector<std::string> scenarios;
+  int width = 1280;
+  int height = 720;
+  int frames = 100;
+  int warmupFrames = 10;
+  float tolerance = 0.1f; // relative slowdown reported as a regression
+  bool writeTextureCache = false; // store texture encodings next to the assets
+};
+
+struct FrameOptions {
+  bool shadow = false;
+  bool ao = false;
+  // RENDER_OUTPUT flags, passes contributing to none of them are culled
+  uint32_t outputs = Optifuser::OUTPUT_LIGHTING | Optifuser::OUTPUT_DISPLAY;
+  // called after every renderScene, e.g. to read back buffers
+  std::function<void(Optifuser::Renderer &)> readback;
+};
+
+static float elapsedMs(Clock::time_point start) {
+  return std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+}
+
+static json summarize(std::vector<float> values) {
+  if (values.empty()) {
+    return {};
+  }
+  std::sort(values.begin(), values.end());
+  float sum = 0.f;
+  for (float v : values) {
+    sum += v;
+  }
+  return {{"avg", sum / values.size()},
+          {"p50", values[values.size() / 2]},
+          {"p95", values[std::min(values.size() - 1, values.size() * 95 / 100)]},
+          {"max", values.back()}};
+}
+
+static void configure(Optifuser::Renderer &renderer, const BenchOptions &options,
+                      const FrameOptions &frame) {
+  // disabled passes are released, so shaders are set again after every switch
+  renderer.enableShadowPass(frame.shadow);
+  renderer.enableAOPass(frame.ao, 2, 8);
+  renderer.setRequiredOutputs(frame.outputs);
+  std::string dir = options.root + "/glsl_shader/";
+  renderer.setShadowShader(dir + "shadow.vsh", dir + "shadow.fsh");
+  renderer.setGBufferShader(dir + "gbuffer.vsh", dir + "gbuffer_segmentation.fsh");
+  renderer.setAOShader(dir + "ssao.vsh", dir + "ssao_interleaved.fsh");
+  renderer.setAOReconstructionShaders(dir + "ssao.vsh", dir + "ao_downsample.fsh",
+                                      dir + "ao_blur.fsh", dir + "ao_upsample.fsh");
+  renderer.setDeferredShader(dir + "deferred.vsh", dir + "deferred.fsh");
+  renderer.setTransparencyShader(dir + "transparency.vsh", dir + "transparency.fsh");
+  renderer.setCompositeShader(dir + "composite.vsh", dir + "composite.fsh");
+  // reset the rolling GPU timings
+  renderer.enableGpuTimers(false);
+  renderer.enableGpuTimers(true);
+}
+
+static json renderFrames(Optifuser::Renderer &renderer, Optifuser::Scene &scene,
+                         const Optifuser::CameraSpec &camera, const BenchOptions &options,
+                         const FrameOptions &frame) {
+  configure(renderer, options, frame);
+
+  std::vector<float> frameMs, submitMs, readbackMs;
+  std::map<std::string, std::vector<float>> passCpuMs;
+  Optifuser::GLCounters counters;
+  for (int f = 0; f < options.warmupFrames + options.frames; ++f) {
+    auto start = Clock::now();
+    renderer.renderScene(scene, camera);
+    float submit = elapsedMs(start);
+    auto readbackStart = Clock::now();
+    if (frame.readback) {
+      frame.readback(renderer);
+    }
+    float readback = elapsedMs(readbackStart);
+    glFinish();
+    float total = elapsedMs(start);
+
+    if (f < options.warmupFrames) {
+      continue;
+    }
+    frameMs.push_back(total);
+    submitMs.push_back(submit);
+    readbackMs.push_back(readback);
+    // stats of the previous frame, which ran the same workload
+    auto &stats = renderer.getFrameStats();
+    counters += stats.total;
+    for (auto &pass : stats.passes) {
+      passCpuMs[pass.name].push_back(pass.cpuMs);
+    }
+  }
+
+  json passes = json::object();
+  for (auto &timing : renderer.getPassTimings().passes) {
+    if (!timing.samples) {
+      continue;
+    }
+    passes[timing.name] = {{"gpu_ms", timing.averageMs},
+                           {"cpu_ms", summarize(passCpuMs[timing.name])["avg"]}};
+  }
+  for (auto &pass : renderer.getFrameStats().passes) {
+    if (passes.contains(pass.name)) {
+      passes[pass.name]["draw_calls"] = pass.counters.drawCalls;
+      passes[pass.name]["triangles"] = pass.counters.triangles;
+    }
+  }
+
+  float n = options.frames;
+  return {{"frame_ms", summarize(frameMs)},
+          {"submit_ms", summarize(submitMs)},
+          {"readback_ms", summarize(readbackMs)},
+          {"gpu_ms", renderer.getPassTimings().totalAverageMs},
+          {"draw_calls", counters.drawCalls / n},
+          {"triangles", counters.triangles / n},
+          {"program_switches", counters.programSwitches / n},
+          {"texture_binds", counters.textureBinds / n},
+          {"uniform_uploads", counters.uniformUploads / n},
+          {"readback_mb", counters.readbackBytes / n / (1 << 20)},
+          {"passes", passes}};
+}
+
+static Optifuser::PerspectiveCameraSpec makeCamera(const BenchOptions &options,
+                                                   glm::vec3 position) {
+  Optifuser::PerspectiveCameraSpec cam;
+  cam.position = position;
+  cam.fovy = glm::radians(45.f);
+  cam.aspect = options.width / (float)options.height;
+  return cam;
+}
+
+static void addLights(Optifuser::Scene &scene) {
+  scene.addDirectionalLight({glm::vec3(-0.3, -1, -0.5), glm::vec3(0.8, 0.8, 0.8)});
+  scene.setAmbientLight(glm::vec3(0.1, 0.1, 0.1));
+}
+
+// a cube grid sharing one mesh
+static std::vector<Optifuser::ObjectHandle> buildCubes(Optifuser::Scene &scene, int count) {
+  std::vector<Optifuser::ObjectHandle> handles;
+  int side = std::ceil(std::sqrt(count));
+  for (int i = 0; i < count; ++i) {
+    auto cube = Optifuser::NewCube();
+    cube->position = {(i % side - side / 2) * 0.5f, -1.f, -(i / side) * 0.5f};
+    cube->scale = glm::vec3(0.15f);
+    cube->setSegmentId(i % 255 + 1);
+    handles.push_back(scene.addObject(std::move(cube)));
+  }
+  addLights(scene);
+  return handles;
+}
+
+// poses written every frame as by a physics engine, timed without rendering
+static json updatePoses(Optifuser::Scene &scene,
+                        const std::vector<Optifuser::ObjectHandle> &handles,
+                        const BenchOptions &options) {
+  std::vector<float> poses(handles.size() * 7);
+  std::vector<float> setMs, perObjectMs, prepareMs;
+  scene.prepareObjects();
+  for (int f = 0; f < options.warmupFrames + options.frames; ++f) {
+    for (size_t i = 0; i < handles.size(); ++i) {
+      float *pose = &poses[i * 7];
+      float angle = 0.01f * (f + i);
+      pose[0] = (i % 100) * 0.5f;
+      pose[1] = -1.f;
+      pose[2] = -(i / 100) * 0.5f;
+      pose[3] = 2.f * std::cos(angle); // not normalized, as from a sloppy integrator
+      pose[4] = 0.f;
+      pose[5] = 2.f * std::sin(angle);
+      pose[6] = 0.f;
+    }
+    auto start = Clock::now();
+    scene.setPoses(handles, poses.data());
+    float set = elapsedMs(start);
+
+    // the same update through the objects, for comparison
+    start = Clock::now();
+    for (size_t i = 0; i < handles.size(); ++i) {
+      const float *pose = &poses[i * 7];
+      auto obj = scene.getObject(handles[i]);
+      obj->setPosition({pose[0], pose[1], pose[2]});
+      obj->setRotation({pose[3], pose[4], pose[5], pose[6]});
+    }
+    float perObject = elapsedMs(start);
+
+    start = Clock::now();
+    scene.prepareObjects();
+    float prepare = elapsedMs(start);
+    if (f >= options.warmupFrames) {
+      setMs.push_back(set);
+      perObjectMs.push_back(perObject);
+      prepareMs.push_back(prepare);
+    }
+  }
+  return {{"set_poses_ms", summarize(setMs)},
+          {"per_object_ms", summarize(perObjectMs)},
+          {"prepare_ms", summarize(prepareMs)}};
+}
+
+// small spheres, each with its own mesh
+static void buildUniqueMeshes(Optifuser::Scene &scene, int count) {
+  int side = std::ceil(std::sqrt(count));
+  for (int i = 0; i < count; ++i) {
+    auto sphere = Optifuser::NewSphere();
+    sphere->position = {(i % side - side / 2) * 0.4f, -1.f, -(i / side) * 0.4f};
+    sphere->scale = glm::vec3(0.1f);
+    sphere->setSegmentId(i % 255 + 1);
+    scene.addObject(std::move(sphere));
+  }
+  addLights(scene);
+}
+
+static std::string sponzaPath(const BenchOptions &options) {
+  return options.root + "/scenes/sponza/sponza.obj";
+}
+
+static bool loadSponza(Optifuser::Scene &scene, const BenchOptions &options) {
+  auto objects = Optifuser::LoadObj(sponzaPath(options), true, {0, 0, 1}, {0, 1, 0});
+  if (objects.empty()) {
+    return false;
+  }
+  for (auto &obj : objects) {
+    obj->scale = glm::vec3(0.003f);
+    obj->position *= 0.003f;
+    scene.addObject(std::move(obj));
+  }
+  addLights(scene);
+  return true;
+}
+
+static std::map<std::string, std::function<json(Optifuser::Renderer &, const BenchOptions &)>>
+makeScenarios() {
+  std::map<std::string, std::function<json(Optifuser::Renderer &, const BenchOptions &)>>
+      scenarios;
+
+  scenarios["cubes_4k"] = [](Optifuser::Renderer &renderer, const BenchOptions &options) {
+    Optifuser::Scene scene;
+    buildCubes(scene, 4000);
+    return renderFrames(renderer, scene, makeCamera(options, {0, 2, 4}), options, {});
+  };
+
+  scenarios["unique_meshes_1k"] = [](Optifuser::Renderer &renderer, const BenchOptions &options) {
+    Optifuser::Scene scene;
+    buildUniqueMeshes(scene, 1000);
+    return renderFrames(renderer, scene, makeCamera(options, {0, 2, 4}), options, {});
+  };
+
+  for (bool effects : {false, true}) {
+    scenarios[effects ? "sponza_shadow_ao" : "sponza"] =
+        [effects](Optifuser::Renderer &renderer, const BenchOptions &options) -> json {
+      Optifuser::Scene scene;
+      if (!loadSponza(scene, options)) {
+        return {{"skipped", "missing " + sponzaPath(options)}};
+      }
+      FrameOptions frame;
+      frame.shadow = frame.ao = effects;
+      return renderFrames(renderer, scene, makeCamera(options, {0, 1, 0}), options, frame);
+    };
+  }
+
+  for (int count : {10000, 100000}) {
+    scenarios["set_poses_" + std::to_string(count / 1000) + "k"] =
+        [count](Optifuser::Renderer &, const BenchOptions &options) {
+          Optifuser::Scene scene;
+          auto handles = buildCubes(scene, count);
+          return updatePoses(scene, handles, options);
+        };
+  }
+
+  // per frame scene bookkeeping without rendering: static, 1% moved, LOD selection
+  scenarios["prepare_100k"] = [](Optifuser::Renderer &, const BenchOptions &options) {
+    Optifuser::Scene scene;
+    auto handles = buildCubes(scene, 100000);
+    auto camera = makeCamera(options, {0, 2, 4});
+    std::vector<Optifuser::ObjectHandle> moved(handles.begin(), handles.begin() + 1000);
+    std::vector<float> poses(moved.size() * 7);
+    scene.prepareObjects();
+    std::vector<float> staticMs, movedMs, lodMs;
+    for (int f = 0; f < options.warmupFrames + options.frames; ++f) {
+      auto start = Clock::now();
+      scene.prepareObjects();
+      float prepare = elapsedMs(start);
+
+      for (size_t i = 0; i < moved.size(); ++i) {
+        float *pose = &poses[i * 7];
+        pose[0] = (i % 100) * 0.5f;
+        pose[1] = -1.f + 0.01f * (f % 10);
+        pose[2] = -(i / 100) * 0.5f;
+        pose[3] = 1.f;
+        pose[4] = pose[5] = pose[6] = 0.f;
+      }
+      scene.setPoses(moved, poses.data());
+      start = Clock::now();
+      scene.prepareObjects();
+      float prepareMoved = elapsedMs(start);
+
+      start = Clock::now();
+      scene.updateLods(camera, options.height, {}, {});
+      float lods = elapsedMs(start);
+      if (f >= options.warmupFrames) {
+        staticMs.push_back(prepare);
+        movedMs.push_back(prepareMoved);
+        lodMs.push_back(lods);
+      }
+    }
+    return json{{"prepare_ms", summarize(staticMs)},
+                {"prepare_moved_ms", summarize(movedMs)},
+                {"update_lods_ms", summarize(lodMs)}};
+  };
+
+  // a simulation despawning and spawning objects every step
+  scenarios["churn_100k"] = [](Optifuser::Renderer &, const BenchOptions &options) {
+    Optifuser::Scene scene;
+    auto handles = buildCubes(scene, 100000);
+    scene.prepareObjects();
+    std::vector<float> churnMs, prepareMs;
+    size_t next = 0;
+    for (int f = 0; f < options.warmupFrames + options.frames; ++f) {
+      auto start = Clock::now();
+      for (int i = 0; i < 500; ++i, next = (next + 7919) % handles.size()) {
+        scene.removeObject(scene.getObject(handles[next]));
+        auto cube = Optifuser::NewCube();
+        cube->name = "spawned";
+        handles[next] = scene.addObject(std::move(cube));
+      }
+      scene.removeObjectsByName("nothing");
+      float churn = elapsedMs(start);
+      start = Clock::now();
+      scene.prepareObjects();
+      if (f >= options.warmupFrames) {
+        churnMs.push_back(churn);
+        prepareMs.push_back(elapsedMs(start));
+      }
+    }
+    return json{{"churn_ms", summarize(churnMs)}, {"prepare_ms", summarize(prepareMs)}};
+  };
+
+  // segmentation labels only, as used for dataset generation: the G-buffer alone is rendered
+  scenarios["labels"] = [](Optifuser::Renderer &renderer, const BenchOptions &options) {
+    Optifuser::Scene scene;
+    buildCubes(scene, 1000);
+    FrameOptions frame;
+    frame.outputs = 0;
+    frame.readback = [](Optifuser::Renderer &r) {
+      r.getSegmentation();
+      r.getSegmentation2();
+    };
+    return renderFrames(renderer, scene, makeCamera(options, {0, 2, 4}), options, frame);
+  };
+
+  scenarios["readback"] = [](Optifuser::Renderer &renderer, const BenchOptions &options) {
+    Optifuser::Scene scene;
+    buildCubes(scene, 100);
+    FrameOptions frame;
+    frame.readback = [](Optifuser::Renderer &r) {
+      r.getLighting();
+      r.getAlbedo();
+      r.getNormal();
+      r.getDepth();
+      r.getSegmentation();
+    };
+    json result =
+        renderFrames(renderer, scene, makeCamera(options, {0, 2, 4}), options, frame);
+    float ms = result["readback_ms"]["avg"];
+    float mb = result["readback_mb"];
+    result["readback_mb_per_s"] = ms > 0.f ? mb / ms * 1000.f : 0.f;
+    return result;
+  };
+
+  // loads uncompressed, then block compressed without the texture cache, then from the
+  // cached encodings if they exist; the first load also pays for reading the files
+  scenarios["load_sponza"] = [](Optifuser::Renderer &, const BenchOptions &options) -> json {
+    if (!fs::exists(sponzaPath(options))) {
+      return {{"skipped", "missing " + sponzaPath(options)}};
+    }
+    auto settings = Optifuser::textureLoading;
+    auto load = [&](bool compress, bool readCache) {
+      Optifuser::textureLoading.compress = compress;
+      Optifuser::textureLoading.readCache = readCache;
+      auto start = Clock::now();
+      auto objects = Optifuser::LoadObj(sponzaPath(options), true, {0, 0, 1}, {0, 1, 0});
+      glFinish();
+      return elapsedMs(start);
+    };
+    json result;
+    result["load_ms_uncompressed"] = load(false, false);
+    Optifuser::textureLoading.writeCache = false;
+    result["load_ms_encode"] = load(true, false);
+    if (options.writeTextureCache) {
+      Optifuser::textureLoading.writeCache = true;
+      load(true, false);
+      Optifuser::textureLoading.writeCache = false;
+    }
+    bool cached = false;
+    fs::path directory = fs::path(sponzaPath(options)).parent_path();
+    for (auto &entry : fs::recursive_directory_iterator(directory)) {
+      cached |= entry.path().extension() == ".bctex";
+    }
+    if (cached) {
+      result["load_ms_cached"] = load(true, true);
+    } else {
+      result["cached_skipped"] = "no texture cache, run once with --write-texture-cache";
+    }
+    Optifuser::textureLoading = settings;
+    return result;
+  };
+
+  return scenarios;
+}
+
+// metrics compared against the baseline, smaller is better
+static const char *COMPARED_METRICS[] = {"/frame_ms/p50",    "/submit_ms/p50",
+                                         "/gpu_ms",           "/readback_ms/p50",
+                                         "/load_ms_encode",   "/load_ms_cached",
+                                         "/set_poses_ms/p50", "/prepare_ms/p50",
+                                         "/churn_ms/p50",     "/prepare_moved_ms/p50",
+                                         "/update_lods_ms/p50"};
+
+static bool compareWithBaseline(const json &results, const json &baseline, float tolerance) {
+  bool regressed = false;
+  printf("\n%-20s %-18s %10s %10s %8s\n", "scenario", "metric", "baseline", "current", "change");
+  for (auto &[name, scenario] : results["scenarios"].items()) {
+    if (!baseline["scenarios"].contains(name)) {
+      continue;
+    }
+    for (const char *metric : COMPARED_METRICS) {
+      json::json_pointer ptr(metric);
+      // missing metrics read as -1 (contains() on pointers is unreliable in this json version)
+      float before = baseline["scenarios"][name].value(ptr, -1.f);
+      float after = scenario.value(ptr, -1.f);
+      if (before < 0.f || after < 0.f) {
+        continue;
+      }
+      float change = before > 0.f ? after / before - 1.f : 0.f;
+      // ignore sub-0.05 ms differences, they are timer noise
+      bool slower = change > tolerance && after - before > 0.05f;
+      regressed |= slower;
+      printf("%-20s %-18s %10.3f %10.3f %+7.1f%%%s\n", name.c_str(), metric + 1, before, after,
+             change * 100.f, slower ? "  REGRESSION" : "");
+    }
+  }
+  return regressed;
+}
+
+static void printUsage() {
+  printf("Usage: optifuser_bench [options] [scenario...]\n"
+         "  --root DIR        directory containing glsl_shader/ and scenes/ (default ..)\n"
+         "  --output FILE     write results as JSON (default bench.json)\n"
+         "  --baseline FILE   compare against a previous output, exit 1 on regressions\n"
+         "  --tolerance X     relative slowdown counted as a regression (default 0.1)\n"
+         "  --frames N        measured frames per scenario (default 100)\n"
+         "  --warmup N        frames rendered before measuring (default 10)\n"
+         "  --size W H        framebuffer size (default 1280 720)\n"
+         "  --write-texture-cache  store texture encodings next to the assets\n"
+         "  --list            list scenarios\n");
+}
+
+int main(int argc, char **argv) {
+  BenchOptions options;
+  auto scenarios = makeScenarios();
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (arg == "--root" && hasValue) {
+      options.root = argv[++i];
+    } else if (arg == "--output" && hasValue) {
+      options.output = argv[++i];
+    } else if (arg == "--baseline" && hasValue) {
+      options.baseline = argv[++i];
+    } else if (arg == "--tolerance" && hasValue) {
+      options.tolerance = std::stof(argv[++i]);
+    } else if (arg == "--frames" && hasValue) {
+      options.frames = std::max(1, std::stoi(argv[++i]));
+    } else if (arg == "--warmup" && hasValue) {
+      options.warmupFrames = std::max(0, std::stoi(argv[++i]));
+    } else if (arg == "--size" && i + 2 < argc) {
+      options.width = std::stoi(argv[++i]);
+      options.height = std::stoi(argv[++i]);
+    } else if (arg == "--write-texture-cache") {
+      options.writeTextureCache = true;
+    } else if (arg == "--list") {
+      for (auto &[name, fn] : scenarios) {
+        printf("%s\n", name.c_str());
+      }
+      return 0;
+    } else if (scenarios.count(arg)) {
+      options.scenarios.push_back(arg);
+    } else {
+      printUsage();
+      return arg == "--help" ? 0 : 1;
+    }
+  }
+  if (options.scenarios.empty()) {
+    for (auto &[name, fn] : scenarios) {
+      options.scenarios.push_back(name);
+    }
+  }
+
+  // measure the block compressed textures the viewer uses
+  Optifuser::textureLoading.compress = true;
+  Optifuser::textureLoading.writeCache = options.writeTextureCache;
+
+  auto context = Optifuser::OffscreenRenderContext::Create(options.width, options.height);
+  json results = {{"renderer", (const char *)glGetString(GL_RENDERER)},
+                  {"version", (const char *)glGetString(GL_VERSION)},
+                  {"width", options.width},
+                  {"height", options.height},
+                  {"frames", options.frames},
+                  {"scenarios", json::object()}};
+  for (auto &name : options.scenarios) {
+    printf("Running %s...\n", name.c_str());
+    auto start = Clock::now();
+    results["scenarios"][name] = scenarios[name](context->renderer, options);
+    printf("  done in %.1f s\n", elapsedMs(start) / 1000.f);
+  }
+
+  std::ofstream(options.output) << results.dump(2) << std::endl;
+  printf("Results written to %s\n", options.output.c_str());
+
+  if (!options.baseline.empty()) {
+    std::ifstream file(options.baseline);
+    if (!file) {
+      fprintf(stderr, "Cannot open baseline %s\n", options.baseline.c_str());
+      return 1;
+    }
+    json baseline = json::parse(file);
+    if (baseline["renderer"] != results["renderer"]) {
+      printf("Warning: baseline was recorded on %s\n",
+             baseline["renderer"].get<std::string>().c_str());
+    }
+    if (compareWithBaseline(results, baseline, options.tolerance)) {
+      printf("Performance regressions detected\n");
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -4,6 +4,8 @@
 #include "partnet_loader.hpp"
 #include "renderer.h"
 #include "scene.h"
+#include "texture_streamer.h"
+#include "upload_queue.h"
 #include <experimental/filesystem>
 
 #include "imgui.h"
@@ -38,8 +40,16 @@ int main() {
   Optifuser::GLFWRenderContext &context = Optifuser::GLFWRenderContext::Get(w, h);
   context.initGui();
 
+  // streaming needs block compressed textures, encoded once and cached next to the assets
+  Optifuser::textureLoading.compress = true;
+  Optifuser::textureLoading.writeCache = true;
+  Optifuser::TextureStreamer textureStreamer;
+  Optifuser::textureLoading.streamer = &textureStreamer;
+  Optifuser::UploadQueue uploadQueue;
+  Optifuser::asyncUploads = &uploadQueue;
   Optifuser::Scene scene;
   int renderMode = RenderMode::LIGHTING;
+  bool dynamicResolution = false;
 
   std::vector<std::shared_ptr<Optifuser::Object>> objects;
 
@@ -67,19 +77,25 @@ int main() {
   //                          "../assets/ame_desert/desertsky_rt.tga");
 
   context.renderer.enableDisplayPass();
-  // context.renderer.enableAOPass();
+  context.renderer.enableGpuTimers();
+  context.renderer.enableTAA();
+  // context.renderer.enableAOPass(true, 2, 8);
   // context.renderer.enableShadowPass();
 
   context.renderer.setShadowShader("../glsl_shader/shadow.vsh", "../glsl_shader/shadow.fsh");
   context.renderer.setGBufferShader("../glsl_shader/gbuffer.vsh",
                                     "../glsl_shader/gbuffer_segmentation.fsh");
   context.renderer.setAOShader("../glsl_shader/ssao.vsh",
-                                    "../glsl_shader/ssao.fsh");
+                                    "../glsl_shader/ssao_interleaved.fsh");
+  context.renderer.setAOReconstructionShaders(
+      "../glsl_shader/ssao.vsh", "../glsl_shader/ao_downsample.fsh",
+      "../glsl_shader/ao_blur.fsh", "../glsl_shader/ao_upsample.fsh");
   context.renderer.setDeferredShader("../glsl_shader/deferred.vsh", "../glsl_shader/deferred.fsh");
   context.renderer.setAxisShader("../glsl_shader/axes.vsh", "../glsl_shader/axes.fsh");
   context.renderer.setTransparencyShader("../glsl_shader/transparency.vsh",
                                          "../glsl_shader/transparency.fsh");
   context.renderer.setDisplayShader("../glsl_shader/display.vsh", "../glsl_shader/display_normal.fsh");
+  context.renderer.setTAAShader("../glsl_shader/taa.vsh", "../glsl_shader/taa.fsh");
   context.renderer.setCompositeShader("../glsl_shader/composite.vsh", "../glsl_shader/composite.fsh");
 
   context.showWindow();
@@ -106,7 +122,9 @@ int main() {
       Optifuser::getInput().getCursorDelta(dx, dy);
       cam.rotateYawPitch(-dx / 1000.f, -dy / 1000.f);
     }
+    uploadQueue.update();
     context.renderer.renderScene(scene, cam);
+    textureStreamer.update();
     if (renderMode == LIGHTING) {
       context.renderer.displayLighting();
     } else if (renderMode == SEGMENTATION) {
@@ -134,6 +152,12 @@ int main() {
           context.renderer.setDisplayShader("../glsl_shader/display.vsh", "../glsl_shader/display_depth.fsh");
         }
         ImGui::RadioButton("Segmentation", &renderMode, RenderMode::SEGMENTATION);
+        if (ImGui::Button("Reload Shaders")) {
+          context.renderer.reloadShaders();
+        }
+        if (ImGui::Checkbox("Dynamic Resolution", &dynamicResolution)) {
+          context.renderer.enableDynamicResolution(dynamicResolution);
+        }
       }
 
       if (ImGui::CollapsingHeader("Camera", ImGuiTreeNodeFlags_DefaultOpen)) {
@@ -147,6 +171,48 @@ int main() {
       if (ImGui::CollapsingHeader("Stats", ImGuiTreeNodeFlags_DefaultOpen)) {
         ImGui::Text("Frame Time: %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate,
                     ImGui::GetIO().Framerate);
+        auto timings = context.renderer.getPassTimings();
+        ImGui::Text("GPU Time: %.3f ms", timings.totalAverageMs);
+        ImGui::Text("Render Size: %u x %u", context.renderer.getRenderWidth(),
+                    context.renderer.getRenderHeight());
+        auto &frame = context.renderer.getFrameStats().total;
+        ImGui::Text("Draw Calls: %u, Triangles: %lu, Programs: %u, Textures: %u",
+                    frame.drawCalls, (unsigned long)frame.triangles, frame.programSwitches,
+                    frame.textureBinds);
+        auto textureMemory = scene.getTextureMemory();
+        ImGui::Text("Texture Memory: %.1f MB in %u textures (%.1f MB saved over RGBA8)",
+                    textureMemory.bytes / 1048576.f, textureMemory.textures,
+                    (textureMemory.rgba8Bytes - textureMemory.bytes) / 1048576.f);
+        auto &streaming = textureStreamer.getStats();
+        ImGui::Text("Streaming: %.1f / %.1f MB resident, %u levels pending",
+                    streaming.residentBytes / 1048576.f, streaming.totalBytes / 1048576.f,
+                    streaming.pendingLevels);
+        auto &uploads = uploadQueue.getStats();
+        ImGui::Text("Uploads: %u queued (%.1f MB), %.1f MB last frame", uploads.queuedUploads,
+                    uploads.queuedBytes / 1048576.f, uploads.uploadedBytes / 1048576.f);
+        ImGui::Columns(4);
+        ImGui::Text("Pass");
+        ImGui::NextColumn();
+        ImGui::Text("avg ms");
+        ImGui::NextColumn();
+        ImGui::Text("p50 ms");
+        ImGui::NextColumn();
+        ImGui::Text("p95 ms");
+        ImGui::NextColumn();
+        for (auto &pass : timings.passes) {
+          if (!pass.samples) {
+            continue;
+          }
+          ImGui::Text("%s", pass.name.c_str());
+          ImGui::NextColumn();
+          ImGui::Text("%.3f", pass.averageMs);
+          ImGui::NextColumn();
+          ImGui::Text("%.3f", pass.p50Ms);
+          ImGui::NextColumn();
+          ImGui::Text("%.3f", pass.p95Ms);
+          ImGui::NextColumn();
+        }
+        ImGui::Columns(1);
       }
     }
 
@@ -39,6 +39,25 @@ public:
 
   virtual glm::mat4 getProjectionMat() const = 0;
   virtual float getFovy() const = 0;
+
+  /* radius of a world-space sphere projected to normalized device coordinates
+   * (1 = half the viewport height); very large when the camera is inside it */
+  inline float getProjectedRadius(const glm::vec3 &center, float radius) const {
+    return getProjectedRadius(getViewMat(), getProjectionMat(), center, radius);
+  }
+  /* the same with the matrices computed once for many spheres */
+  static inline float getProjectedRadius(const glm::mat4 &viewMat, const glm::mat4 &proj,
+                                         const glm::vec3 &center, float radius) {
+    glm::vec4 viewPos = viewMat * glm::vec4(center, 1.f);
+    if (glm::dot(glm::vec3(viewPos), glm::vec3(viewPos)) <= radius * radius) {
+      return 1e10f;
+    }
+    float w = (proj * viewPos).w;
+    if (w <= 1e-6f) {
+      return 1e10f;
+    }
+    return radius * proj[1][1] / w;
+  }
 };
 
 class OrthographicCameraSpec : public CameraSpec {
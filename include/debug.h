@@ -1,5 +1,7 @@
 #pragma once
+#include <GL/glew.h>
 #include <cstdio>
+#include <string>
 
 #define printMat(mat)                                                 \
   for (int i = 0; i < 4; i++) {                                       \
@@ -8,19 +10,33 @@
   }                                                                   \
   printf("\n");
 
-/*
- #define LABEL_TEXTURE(id, label)                                               \
-   {                                                                            \
-     std::string _l = label;                                                    \
-     glObjectLabel(GL_TEXTURE, id, _l.length(), _l.c_str());                    \
-   }
+// KHR_debug object labels and pass groups for external tools (RenderDoc, apitrace, Nsight)
+#define LABEL_TEXTURE(id, label)                                                                   \
+  do {                                                                                             \
+    if (GLEW_KHR_debug) {                                                                          \
+      std::string _l = label;                                                                      \
+      glObjectLabel(GL_TEXTURE, id, _l.length(), _l.c_str());                                      \
+    }                                                                                              \
+  } while (0)
 
- #define LABEL_FRAMEBUFFER(id, label)                                           \
-   {                                                                            \
-     std::string _l = label;                                                    \
-     glObjectLabel(GL_FRAMEBUFFER, id, _l.length(), _l.c_str());                \
-   }
-*/
+#define LABEL_FRAMEBUFFER(id, label)                                                               \
+  do {                                                                                             \
+    if (GLEW_KHR_debug) {                                                                          \
+      std::string _l = label;                                                                      \
+      glObjectLabel(GL_FRAMEBUFFER, id, _l.length(), _l.c_str());                                  \
+    }                                                                                              \
+  } while (0)
 
-#define LABEL_TEXTURE(id, label) {}
-#define LABEL_FRAMEBUFFER(id, label) {}
+#define PUSH_DEBUG_GROUP(label)                                                                    \
+  do {                                                                                             \
+    if (GLEW_KHR_debug) {                                                                          \
+      glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 0, -1, label);                                 \
+    }                                                                                              \
+  } while (0)
+
+#define POP_DEBUG_GROUP()                                                                          \
+  do {                                                                                             \
+    if (GLEW_KHR_debug) {                                                                          \
+      glPopDebugGroup();                                                                           \
+    }                                                                                              \
+  } while (0)
@@ -0,0 +1,34 @@
+#pragma once
+#include <cstdint>
+
+namespace Optifuser {
+
+struct DynamicResolutionSettings {
+  float targetMs = 16.f; // GPU time budget of a frame
+  float minScale = 0.5f; // internal resolution relative to the output, per axis
+  float maxScale = 1.f;
+  uint32_t interval = 8; // frames averaged before the scale is changed
+  float threshold = 0.03f; // smaller changes are ignored, so the resolution does not jitter
+};
+
+/* Picks the internal render scale from measured GPU frame times. The cost of a frame is assumed
+ * to grow with its pixel count, i.e. with the square of the scale; each change moves half way
+ * to the scale that would hit the target. */
+class DynamicResolution {
+public:
+  DynamicResolutionSettings settings;
+
+private:
+  float scale = 1.f;
+  float accumulatedMs = 0.f;
+  uint32_t frames = 0;
+
+public:
+  explicit DynamicResolution(const DynamicResolutionSettings &settings = {});
+
+  /* add the GPU time of a frame, returns true when the scale changed */
+  bool update(float gpuMs);
+  inline float getScale() const { return scale; }
+};
+
+} // namespace Optifuser
@@ -0,0 +1,34 @@
+#pragma once
+#include "gl_context.h"
+#include <memory>
+
+namespace Optifuser {
+
+/* Headless OpenGL context on EGL, needs no window system. The display is taken from
+ * EGL_EXT_platform_device (set OPTIFUSER_EGL_DEVICE to pick a GPU), then
+ * EGL_MESA_platform_surfaceless (software Mesa), then the default display.
+ * Contexts are current on one thread at a time, so create one per worker thread. */
+class EGLHeadlessContext {
+  void *display = nullptr;
+  void *context = nullptr;
+  GLContextId id;
+
+public:
+  /* nullptr when EGL is unavailable; share is an existing context whose objects are shared */
+  static std::unique_ptr<EGLHeadlessContext> Create(const EGLHeadlessContext *share = nullptr);
+  static bool IsAvailable();
+
+  EGLHeadlessContext(const EGLHeadlessContext &) = delete;
+  EGLHeadlessContext &operator=(const EGLHeadlessContext &) = delete;
+  ~EGLHeadlessContext();
+
+  bool makeCurrent() const;
+  inline GLContextId getId() const { return id; }
+  /* detach whatever EGL context is current on the calling thread */
+  static void releaseCurrent();
+
+private:
+  EGLHeadlessContext() = default;
+};
+
+} // namespace Optifuser
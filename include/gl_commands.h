@@ -0,0 +1,56 @@
+#pragma once
+#include "gl_context.h"
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Optifuser {
+
+/* Returned for a deferred command, so the object it writes to can cancel it
+ * when destroyed first. Only touched while commands cannot run. */
+struct GLCommandToken {
+  bool cancelled = false;
+  bool done = false;
+};
+
+/* GL work recorded on threads without a GL context and run later on the render
+ * thread. Mesh and texture constructors prepare their CPU data on the calling
+ * thread and defer only their GL calls, so scenes can be built on workers. */
+class GLCommandQueue {
+  std::mutex mutex;        // guards commands
+  std::mutex executeMutex; // held while commands run
+  std::vector<std::function<void()>> commands;
+  std::atomic<std::thread::id> renderThread;
+  std::atomic<uint32_t> renderShareGroup = 0;
+
+public:
+  /* the thread that runs the commands, set by the global context creation on the
+   * calling thread, whose current share group the commands create objects in */
+  void setRenderThread(std::thread::id id = std::this_thread::get_id());
+  /* on the render thread with its share group current, or no render thread was set */
+  bool isRenderThread() const;
+  /* GL may be called here: an Optifuser context is current, this is the render
+   * thread, or no render thread was set (single threaded use) */
+  bool isGLThread() const;
+
+  void push(std::function<void()> command);
+  /* run command now on a GL thread and return null, otherwise queue it */
+  std::shared_ptr<GLCommandToken> submit(std::function<void()> command);
+  /* Scene::prepareObjects calls it before reading the scene, it does nothing unless
+   * isRenderThread(), so scenes prepared on worker contexts leave the commands queued */
+  void execute();
+  size_t pending();
+
+  /* f does not overlap with running commands, e.g. to read what they wrote */
+  template <typename F> void synchronize(F &&f) {
+    std::lock_guard<std::mutex> lock(executeMutex);
+    f();
+  }
+};
+
+inline GLCommandQueue glCommands;
+
+} // namespace Optifuser
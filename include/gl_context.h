@@ -0,0 +1,18 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+namespace Optifuser {
+
+/* The GL context current on the calling thread. Buffers, textures and programs are only
+ * visible within a share group and vertex arrays only within one context, so GL objects
+ * cached across contexts are keyed by these ids. 0 is a context Optifuser did not create. */
+struct GLContextId {
+  uint32_t context = 0;
+  uint32_t shareGroup = 0;
+};
+
+inline thread_local GLContextId currentGLContext;
+inline std::atomic<uint32_t> nextGLContextId = 1;
+
+} // namespace Optifuser
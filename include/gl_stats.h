@@ -0,0 +1,38 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Optifuser {
+
+/* Running totals of the GL work issued through Shader, the meshes and the
+ * texture helpers. Counters are per thread, i.e. per current GL context. */
+struct GLCounters {
+  uint32_t drawCalls = 0;
+  uint64_t triangles = 0;
+  uint32_t programSwitches = 0;
+  uint32_t textureBinds = 0;
+  uint32_t uniformUploads = 0;
+  uint32_t bufferUploads = 0; // buffer and texture data uploads
+  uint64_t uploadBytes = 0;
+  uint32_t readbacks = 0;
+  uint64_t readbackBytes = 0;
+
+  GLCounters &operator+=(const GLCounters &other);
+  GLCounters operator-(const GLCounters &other) const;
+};
+
+inline thread_local GLCounters glCounters;
+
+struct PassStats {
+  std::string name;
+  GLCounters counters;
+  float cpuMs = 0.f; // time spent submitting the pass
+};
+
+struct FrameStats {
+  std::vector<PassStats> passes;
+  GLCounters total; // everything issued between two renderScene calls, readbacks included
+};
+
+} // namespace Optifuser
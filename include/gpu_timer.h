@@ -0,0 +1,76 @@
+#pragma once
+#include <GL/glew.h>
+#include <string>
+#include <vector>
+
+namespace Optifuser {
+
+struct PassTiming {
+  std::string name;
+  float lastMs = 0.f;
+  float averageMs = 0.f;
+  float p50Ms = 0.f;
+  float p95Ms = 0.f;
+  float maxMs = 0.f;
+  uint32_t samples = 0; // number of frames in the rolling window
+};
+
+struct PassTimings {
+  std::vector<PassTiming> passes;
+  float totalAverageMs = 0.f;
+};
+
+/* GL_TIME_ELAPSED queries for a fixed set of passes. Each pass has one query per
+ * buffered frame and results are only read once available, so timing never
+ * stalls the pipeline; a pass whose previous result is still pending skips a frame. */
+class GpuTimer {
+public:
+  static constexpr uint32_t BUFFERED_FRAMES = 2;
+  static constexpr uint32_t HISTORY_SIZE = 120;
+
+private:
+  struct Pass {
+    std::string name;
+    GLuint queries[BUFFERED_FRAMES] = {};
+    bool pending[BUFFERED_FRAMES] = {};
+    std::vector<float> history; // ring buffer of the last HISTORY_SIZE results
+    uint32_t next = 0;
+    float last = 0.f;
+    bool warmedUp = false;
+  };
+  std::vector<Pass> passes;
+  uint32_t frame = 0;
+  int activePass = -1;
+
+public:
+  GpuTimer(const std::vector<std::string> &names);
+  GpuTimer(const GpuTimer &) = delete;
+  GpuTimer &operator=(const GpuTimer &) = delete;
+  ~GpuTimer();
+
+  /* collect finished results and switch to the next query set */
+  void beginFrame();
+  void begin(uint32_t pass);
+  void end();
+
+  PassTimings getTimings() const;
+  inline float getLastMs(uint32_t pass) const { return passes[pass].last; }
+};
+
+class GpuTimerScope {
+  GpuTimer *timer;
+
+public:
+  inline GpuTimerScope(GpuTimer *t, uint32_t pass) : timer(t) {
+    if (timer) {
+      timer->begin(pass);
+    }
+  }
+  inline ~GpuTimerScope() {
+    if (timer) {
+      timer->end();
+    }
+  }
+};
+
+} // namespace Optifuser
@@ -3,6 +3,8 @@
 #include <GL/glew.h>
 #include <glm/glm.hpp>
 #include <memory>
+#include <mutex>
+#include <span>
 #include <vector>
 namespace Optifuser {
 struct Vertex {
@@ -18,15 +20,48 @@ struct Vertex {
       : position(p), normal(n), texCoord(t), tangent(tan), bitangent(bitan) {}
 };
 
+struct MeshLod {
+  std::vector<GLuint> indices;
+  float error = 0.f; // simplification error relative to the bounding radius
+};
+
 class AbstractMeshBase {
+protected:
+  bool hasBounds = false;
+  glm::vec3 aabbMin = glm::vec3(0);
+  glm::vec3 aabbMax = glm::vec3(0);
+  std::shared_ptr<UploadTicket> pendingUpload; // buffers queued on asyncUploads
+  std::shared_ptr<GLCommandToken> glCreation;  // GL calls deferred to the render thread
+
 public:
   virtual void draw() const = 0;
-  virtual ~AbstractMeshBase() = default;
+  virtual ~AbstractMeshBase() {
+    // off the GL thread the subclasses hand the ticket to their release command
+    if (pendingUpload && glCommands.isGLThread()) {
+      pendingUpload->cancelled = true;
+    }
+  }
+
+  /* the scene skips meshes until their buffers are created and uploaded */
+  inline bool isResident() const {
+    return (!glCreation || glCreation->done) && (!pendingUpload || pendingUpload->pending == 0);
+  }
+
+  // meshes without a LOD chain draw their full geometry at every level
+  virtual void drawLod(uint32_t level) const { draw(); }
+  virtual uint32_t getLodCount() const { return 1; }
+  virtual float getLodError(uint32_t level) const { return 0.f; }
+
+  inline bool hasBoundingBox() const { return hasBounds; }
+  inline glm::vec3 getAABBMin() const { return aabbMin; }
+  inline glm::vec3 getAABBMax() const { return aabbMax; }
+  inline glm::vec3 getBoundingSphereCenter() const { return (aabbMin + aabbMax) * 0.5f; }
+  inline float getBoundingSphereRadius() const { return glm::length(aabbMax - aabbMin) * 0.5f; }
 };
 
 class DynamicMesh : public AbstractMeshBase {
-  GLuint vao;
-  GLuint vbo;
+  GLuint vao = 0;
+  GLuint vbo = 0;
   int vertexCount;
   int maxVertexCount;
 
@@ -45,11 +80,18 @@ public:
   virtual void draw() const override;
 };
 
+/* Constructors keep the CPU data on the calling thread and create the GL
+ * buffers through glCommands, see gl_commands.h. */
 class MeshBase : public AbstractMeshBase {
 protected:
-  GLuint vao;
-  GLuint vbo;
-  GLuint ebo;
+  GLuint vao = 0;
+  GLuint vbo = 0;
+  GLuint ebo = 0;
+  uint32_t vaoContext = 0; // GLContextId::context the vao was created on
+
+  // vertex arrays for the other contexts of the share group
+  mutable std::mutex contextVaoMutex;
+  mutable std::vector<std::pair<uint32_t, GLuint>> contextVaos;
 
   std::vector<Vertex> vertices;
   std::vector<GLuint> indices;
@@ -64,25 +106,56 @@ public:
 
   virtual ~MeshBase();
 
+  /* vertex array of the current context, created on first use in a shared context */
   GLuint getVAO() const;
   GLuint getVBO() const;
   GLuint getEBO() const;
   const std::vector<Vertex> &getVertices() const;
   const std::vector<GLuint> &getIndices() const;
+
+protected:
+  void computeBounds();
+  /* binds the buffers and the vertex layout to the bound vertex array */
+  void setupVertexArray() const;
+  /* glBufferData of the bound buffer, queued on asyncUploads when its context is current */
+  void uploadBuffer(GLenum target, GLuint buffer, const void *data, size_t size);
 };
 
 class TriangleMesh : public MeshBase {
+  struct LodRange {
+    uint32_t indexOffset;
+    uint32_t indexCount;
+    float error;
+  };
+
+  // indices of LOD 1..n, stored after LOD 0 in the same element buffer
+  std::vector<GLuint> lodIndices;
+  std::vector<LodRange> lodRanges;
+
+  // the element buffer holds 16-bit indices whenever the vertex count allows
+  GLenum indexType = GL_UNSIGNED_INT;
+
 public:
   using MeshBase::MeshBase;
   TriangleMesh(const std::vector<Vertex> &inVertices,
                const std::vector<GLuint> &inIndices, bool recalcNormal = false);
+  TriangleMesh(const std::vector<Vertex> &inVertices, const std::vector<GLuint> &inIndices,
+               const std::vector<MeshLod> &lods, bool recalcNormal = false);
 
   uint64_t size() const { return indices.size() / 3; }
 
   virtual void draw() const override;
+  virtual void drawLod(uint32_t level) const override;
+  virtual uint32_t getLodCount() const override;
+  virtual float getLodError(uint32_t level) const override;
+
+  std::span<const GLuint> getLodIndices(uint32_t level) const;
+  inline GLenum getIndexType() const { return indexType; }
+  size_t getGpuMemorySize() const;
 
 private:
   void recalculateNormals();
+  void upload();
 };
 
 class LineMesh : public MeshBase {
@@ -0,0 +1,25 @@
+#pragma once
+#include "mesh.h"
+#include <vector>
+
+namespace Optifuser {
+
+/* Merge bitwise identical vertices and rewrite the indices accordingly.
+ * Returns the number of vertices removed. */
+size_t WeldVertices(std::vector<Vertex> &vertices, std::vector<GLuint> &indices);
+
+/* Reorder triangles for post-transform vertex cache locality (Forsyth's
+ * linear-speed algorithm). Any triangle list indexing vertexCount vertices
+ * works, e.g. a single LOD. */
+void OptimizeVertexCache(std::vector<GLuint> &indices, size_t vertexCount);
+
+/* Reorder vertices by first use in indices, then in the LODs, dropping
+ * unreferenced vertices. All index lists are remapped. */
+void OptimizeVertexFetch(std::vector<Vertex> &vertices, std::vector<GLuint> &indices,
+                         std::vector<MeshLod> &lods);
+
+/* Average cache miss ratio (transformed vertices per triangle) of a FIFO cache. */
+float ComputeACMR(const std::vector<GLuint> &indices, size_t vertexCount,
+                  uint32_t cacheSize = 16);
+
+} // namespace Optifuser
@@ -0,0 +1,22 @@
+#pragma once
+#include "mesh.h"
+#include <vector>
+
+namespace Optifuser {
+
+/* Quadric edge-collapse simplification. Vertices are only ever collapsed onto
+ * other existing vertices, so the result indexes the input vertex buffer and
+ * can share it with the original mesh.
+ * targetError is relative to the bounding radius of the mesh; resultError
+ * receives the error actually introduced, in the same unit. */
+std::vector<GLuint> SimplifyMesh(const std::vector<Vertex> &vertices,
+                                 const std::vector<GLuint> &indices, size_t targetIndexCount,
+                                 float targetError, float *resultError = nullptr);
+
+/* Build a chain of progressively coarser LODs (each about half the triangles
+ * of the previous), stopping early when simplification stalls. LOD 0 (the
+ * input itself) is not included in the result. */
+std::vector<MeshLod> BuildLodChain(const std::vector<Vertex> &vertices,
+                                   const std::vector<GLuint> &indices, uint32_t maxLevels = 4);
+
+} // namespace Optifuser
@@ -0,0 +1,20 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+namespace Optifuser {
+
+enum class MipFilter { Box, Kaiser };
+
+/* Number of levels in a full mip chain, down to 1x1. */
+int MipLevelCount(int width, int height);
+
+/* Filter an 8 bit image with channels per texel down to 1x1, level 0 is the
+ * input. Each level halves the previous one (rounding down) with a separable
+ * filter, rows are split across threadCount threads (0 picks from the hardware
+ * concurrency). Color channels of sRGB images are filtered in linear space. */
+std::vector<std::vector<uint8_t>> GenerateMipChain(const uint8_t *pixels, int width, int height,
+                                                   int channels, bool srgb, MipFilter filter,
+                                                   uint32_t threadCount = 0);
+
+} // namespace Optifuser
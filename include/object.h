@@ -14,6 +14,18 @@
 namespace Optifuser {
 class Scene;
 
+/* Refers to a top level object of a scene, stays invalid after the object is
+ * removed even when its slot is reused. */
+struct ObjectHandle {
+  uint32_t index = UINT32_MAX;
+  uint32_t generation = 0;
+
+  inline bool isValid() const { return index != UINT32_MAX; }
+  inline bool operator==(const ObjectHandle &other) const {
+    return index == other.index && generation == other.generation;
+  }
+};
+
 class Object {
 protected:
   std::shared_ptr<AbstractMeshBase> mesh;
@@ -27,6 +39,8 @@ protected:
 
 public:
   std::shared_ptr<Shader> shader = nullptr;
+  // the scene checks these fields of top level objects and their materials every prepare;
+  // children are read when set through the setters below or after markDirty()
   std::shared_ptr<PBRMaterial> pbrMaterial = std::make_shared<PBRMaterial>();
   std::string name;
   glm::vec3 position = {0.f, 0.f, 0.f};
@@ -35,37 +49,78 @@ public:
   uint32_t showAxis = 0; // used for showing axis
 
   glm::mat4 globalModelMatrix; // cached at render time
+  int lodLevel = 0;            // cached at render time, -1 when culled
+  int shadowLodLevel = 0;      // cached at render time, -1 when culled
 
 protected:
   glm::quat rotation = glm::quat(1, 0, 0, 0);
   Scene *scene = nullptr;
+  ObjectHandle handle;
+  uint32_t dataIndex = UINT32_MAX; // in the scene's ObjectData
+  uint32_t snapshotRecord = 0;     // in the snapshot the simulation writes, see Scene::writeRecord
   bool toRemove = false;
 
+  friend class Scene;
+  bool dirty = false; // a child queued on the scene to be read by the next prepare
+  // local transform as of the last prepare, rebuilt when the fields changed or forced
+  bool transformDirty = true;
+  glm::vec3 preparedPosition;
+  glm::quat preparedRotation;
+  glm::vec3 preparedScale;
+
 public:
   Object(std::shared_ptr<AbstractMeshBase> m = nullptr) : mesh(m) {}
 
   virtual ~Object() {}
 
-  inline void setRotation(glm::quat const &rot) { rotation = glm::normalize(rot); }
+  inline void setRotation(glm::quat const &rot) {
+    rotation = glm::normalize(rot);
+    markDirty();
+  }
+  inline void setPosition(const glm::vec3 &p) {
+    position = p;
+    markDirty();
+  }
+  inline void setScale(const glm::vec3 &s) {
+    scale = s;
+    markDirty();
+  }
+  inline void setVisibility(float v) {
+    visibility = v;
+    markDirty();
+  }
+  void setMaterial(std::shared_ptr<PBRMaterial> material);
 
   inline glm::quat const &getRotation() const { return rotation; }
 
   glm::mat4 getModelMat() const;
   void setScene(Scene *inScene);
   Scene *getScene() const;
+  inline ObjectHandle getHandle() const { return handle; }
+  /* read the transform, visibility, material and ids of a child into the scene on the next
+   * prepare; top level objects are checked by every prepare anyway */
+  void markDirty();
+  /* also rebuild the local transform even if the fields look unchanged */
+  inline void markTransformDirty() {
+    transformDirty = true;
+    markDirty();
+  }
+  /* called by the scene while preparing, writes the local transform if it changed */
+  bool updateLocalTransform(glm::mat4 &localMatrix);
 
   std::shared_ptr<AbstractMeshBase> getMesh() const;
 
   void addChild(std::unique_ptr<Object> child);
   inline const std::vector<std::unique_ptr<Object>> &getChildren() const { return children; }
 
-  inline void setObjId(uint32_t id) { objId = id; }
+  void setObjId(uint32_t id);
   inline uint32_t getObjId() const { return objId; }
-  inline void setSegmentId(uint32_t id) { segmentId = id; }
+  void setSegmentId(uint32_t id);
   inline uint32_t getSegmentId() const { return segmentId; }
   inline void setUserData(std::vector<float> const &data) { userData = data; }
   inline std::vector<float> const &getUserData() const { return userData; }
-  inline void markRemoved() { toRemove = true; }
+  /* same as scene->removeObject(this) */
+  void markRemoved();
   inline bool isMarkedRemoved() { return toRemove; }
   std::unique_ptr<Object> clone() const;
 };
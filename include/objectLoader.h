@@ -3,5 +3,6 @@
 namespace Optifuser {
 std::vector<std::unique_ptr<Object>>
 LoadObj(const std::string file, bool ignoreSpecification = true,
-        glm::vec3 upAxis = {0, 1, 0}, glm::vec3 forwardAxis = {0, 0, -1});
+        glm::vec3 upAxis = {0, 1, 0}, glm::vec3 forwardAxis = {0, 0, -1},
+        uint32_t lodLevels = 4, bool optimizeMeshes = true);
 }
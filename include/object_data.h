@@ -0,0 +1,51 @@
+#pragma once
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+
+namespace Optifuser {
+class Object;
+class AbstractMeshBase;
+struct PBRMaterial;
+
+/* Per frame state of every object in a scene, children included, in flat
+ * arrays indexed alike. Parents come before their children in the order the
+ * objects are drawn, so the descendants of an entry follow it. Scene::prepareObjects
+ * checks top level objects and materials for changes and reads children when marked
+ * dirty, the objects stay the interface for everything else; the LOD selection, the
+ * occlusion culler and the shadow pass walk it linearly. */
+struct ObjectData {
+  std::vector<Object *> objects;            // null for removed objects until compacted
+  std::vector<int32_t> parents;             // -1 for top level objects
+  std::vector<glm::mat4> localMatrices;
+  std::vector<glm::mat4> worldMatrices;
+  std::vector<glm::vec4> bounds;            // world bounding sphere, w < 0 without mesh bounds
+  std::vector<float> visibility;
+  std::vector<uint32_t> segmentIds;
+  std::vector<uint32_t> objIds;
+  std::vector<uint32_t> materials;          // into materialTable
+  std::vector<uint32_t> meshes;             // into meshTable, NO_MESH for empty objects
+  std::vector<int32_t> lodLevels;           // -1 when culled, set by Scene::updateLods
+  std::vector<int32_t> shadowLodLevels;
+  std::vector<uint8_t> moved;               // world matrix changed in the last prepare
+  std::vector<uint8_t> drawClasses;         // DRAW_* list of the entry, maybe with DRAW_WAITING
+
+  std::vector<PBRMaterial *> materialTable;
+  std::vector<AbstractMeshBase *> meshTable;
+
+  // drawn objects, opaque in draw order and transparent ones
+  std::vector<uint32_t> opaque;
+  std::vector<uint32_t> transparent;
+
+  static constexpr uint32_t NO_MESH = UINT32_MAX;
+  // the class may change once a mesh or texture is resident, the scene checks it every prepare
+  enum DrawClass : uint8_t { DRAW_NONE = 0, DRAW_OPAQUE = 1, DRAW_TRANSPARENT = 2, DRAW_WAITING = 4 };
+
+  inline size_t size() const { return objects.size(); }
+  inline AbstractMeshBase *mesh(uint32_t i) const {
+    return meshes[i] == NO_MESH ? nullptr : meshTable[meshes[i]];
+  }
+  inline PBRMaterial *material(uint32_t i) const { return materialTable[materials[i]]; }
+};
+
+} // namespace Optifuser
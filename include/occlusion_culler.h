@@ -0,0 +1,78 @@
+#pragma once
+#include "camera_spec.h"
+#include "scene.h"
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Optifuser {
+
+struct OcclusionSettings {
+  uint32_t width = 256; // resolution of the CPU depth buffer
+  uint32_t height = 128;
+  uint32_t maxOccluders = 32;  // only the largest objects on screen are rasterized
+  float minOccluderSize = 0.1f; // minimum projected diameter of an occluder, fraction of height
+  float occluderLodError = 0.02f; // coarsest LOD error (relative) allowed for occluder geometry
+  // camera occlusion says nothing about the light's view, so casters are kept by default
+  bool cullShadowCasters = false;
+};
+
+struct OcclusionStats {
+  uint32_t occluders = 0;
+  uint32_t occluderTriangles = 0;
+  uint32_t tested = 0;
+  uint32_t culled = 0;
+  float cpuMs = 0.f;
+};
+
+/* Renders the largest opaque objects into a small depth buffer on the CPU and
+ * marks objects whose bounding box is hidden behind them as culled
+ * (lodLevel = -1). Bands of the depth buffer are rasterized by worker threads. */
+class OcclusionCuller {
+public:
+  OcclusionSettings settings;
+
+private:
+  std::vector<float> depth; // NDC depth, row major, bottom row first
+  OcclusionStats stats;
+
+  struct ScreenTriangle;
+  std::vector<ScreenTriangle> triangles;
+
+  // minimal fork-join pool, the calling thread takes part in every job
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable done;
+  std::function<void(uint32_t)> job;
+  std::atomic<uint32_t> nextJob = 0;
+  uint32_t jobCount = 0;
+  uint32_t jobGeneration = 0;
+  uint32_t busyWorkers = 0;
+  bool quit = false;
+
+public:
+  OcclusionCuller(uint32_t threadCount = 0);
+  OcclusionCuller(const OcclusionCuller &) = delete;
+  OcclusionCuller &operator=(const OcclusionCuller &) = delete;
+  ~OcclusionCuller();
+
+  /* call after Scene::updateLods */
+  void cull(Scene &scene, const CameraSpec &camera);
+
+  inline const OcclusionStats &getStats() const { return stats; }
+  inline const std::vector<float> &getDepthBuffer() const { return depth; }
+
+private:
+  void collectOccluders(const ObjectData &data, const glm::mat4 &viewProj,
+                        const CameraSpec &camera);
+  void rasterizeBand(uint32_t y0, uint32_t y1);
+  bool isOccluded(const glm::mat4 &mvp, const glm::vec3 &bmin, const glm::vec3 &bmax) const;
+  void parallelFor(uint32_t count, const std::function<void(uint32_t)> &fn);
+  void workerLoop();
+};
+
+} // namespace Optifuser
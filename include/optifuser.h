@@ -5,6 +5,7 @@
 #include "optix_renderer.h"
 #endif
 
+#include "egl_context.h"
 #include "renderer.h"
 #include "scene.h"
 #include <GL/glew.h>
@@ -14,8 +15,16 @@
 
 namespace Optifuser {
 
+enum class ContextBackend { Auto, GLFW, EGL };
+
+/* Backend of the global GL context, must be chosen before the first context is created.
+ * Auto uses EGL when the first context is headless and a hidden GLFW window otherwise;
+ * the OPTIFUSER_CONTEXT_BACKEND environment variable (glfw or egl) overrides Auto. */
+void setContextBackend(ContextBackend backend);
+ContextBackend getContextBackend();
+
 void keyCallback(GLFWwindow *window, int key, int scancode, int action, int mods);
-void ensureGlobalContext();
+void ensureGlobalContext(bool headless = false);
 Input &getInput();
 
 class RenderContext {
@@ -62,14 +71,30 @@ public:
 };
 
 class OffscreenRenderContext : public RenderContext {
+  std::unique_ptr<EGLHeadlessContext> glContext; // null when rendering on the global context
+
 public:
   Optifuser::Renderer renderer;
+  /* renders on the global GL context */
   inline static std::unique_ptr<OffscreenRenderContext> Create(int w, int h) {
     return std::make_unique<OffscreenRenderContext>(w, h);
   }
+  /* Owns an EGL context, usable from one thread at a time after makeCurrent() and current
+   * on the calling thread on return. With shareObjects, meshes, textures and programs are
+   * shared with the global context and all other shared contexts; call glFinish after
+   * creating objects before another thread uses them. */
+  static std::unique_ptr<OffscreenRenderContext> CreateIndependent(int w, int h,
+                                                                   bool shareObjects = true);
 
   ~OffscreenRenderContext();
   OffscreenRenderContext(int w, int h);
+
+  /* make the context current on the calling thread, no-op for the global context */
+  void makeCurrent() const;
+  inline bool ownsContext() const { return glContext != nullptr; }
+
+private:
+  OffscreenRenderContext(int w, int h, std::unique_ptr<EGLHeadlessContext> context);
 };
 
 #ifdef _USE_OPTIX
@@ -21,6 +21,7 @@ class AOPass {
   GLuint m_depthTexture;
 
   int m_width, m_height;
+  glm::vec2 m_viewScale = {1, 1};
 
   GLuint m_randomtex = 0;
   int m_randomtexWidth;
@@ -28,17 +29,50 @@ class AOPass {
 
   std::string m_vertFile;
   std::string m_fragFile;
-  std::shared_ptr<Shader> m_shader;
+  ShaderSlot m_shader;
+
+  // reduced resolution ao, used when the reconstruction shaders are set
+  GLuint m_outputTexture = 0;
+  GLuint m_packedTexture = 0; // camera space normal and z
+  GLuint m_rawTexture = 0;
+  GLuint m_blurTexture = 0;
+  int m_lowWidth, m_lowHeight;
+  glm::vec2 m_lowViewScale = {1, 1};
+  int m_downsample = 1;
+  int m_sampleCount = 16;
+
+  std::string m_reconstructionFiles[4]; // vs, downsample, blur and upsample fs
+  ShaderSlot m_downsampleShader;
+  ShaderSlot m_blurShader;
+  ShaderSlot m_upsampleShader;
 
  public:
   void init();
   void setShader(const std::string &vs, const std::string &fs);
+  /* set the shader files again, current programs stay in use until the new ones compiled */
+  void reloadShaders();
+  void updateShaders();
+  void setReconstructionShaders(const std::string &vs, const std::string &downsampleFs,
+                                const std::string &blurFs, const std::string &upsampleFs);
   void setAttachment(GLuint texture, int width, int height);
+  /* intermediate textures at 1/downsample resolution: packed normal/depth, raw and blurred ao */
+  void setReducedTextures(GLuint packedtex, GLuint rawtex, GLuint blurtex, int downsample,
+                          int width, int height);
+  inline void setSampleCount(int count) { m_sampleCount = count; }
+  /* part of the full and reduced resolution textures covered by the rendered view */
+  inline void setViewScale(const glm::vec2 &scale, const glm::vec2 &reducedScale) {
+    m_viewScale = scale;
+    m_lowViewScale = reducedScale;
+  }
 
   void setFbo(GLuint fbo);
   void setInputTextures(int count, GLuint *colortex, GLuint depthtex);
   void setRandomTexture(GLuint randomtex, int width, int height);
   void render(const CameraSpec &camera) const;
+
+private:
+  void renderReduced(const CameraSpec &camera) const;
+  void drawQuad(GLuint target, int width, int height) const;
 };
 
 } // namespace Optifuser
@@ -21,6 +21,8 @@ private:
   GLuint m_depthTexture;
 
   int m_width, m_height;
+  glm::vec2 m_viewScale = {1, 1};
+  glm::vec2 m_outputScale = {1, 1};
 
   GLuint m_randomtex = 0;
   int m_randomtexWidth;
@@ -28,15 +30,27 @@ private:
 
   std::string m_vertFile;
   std::string m_fragFile;
-  std::shared_ptr<Shader> m_shader;
+  ShaderSlot m_shader;
 
 public:
   void init();
   void setShader(const std::string &vs, const std::string &fs);
+  /* set the shader files again, the current program stays in use until the new one compiled */
+  inline void reloadShaders() {
+    if (!m_vertFile.empty()) {
+      setShader(m_vertFile, m_fragFile);
+    }
+  }
+  inline void updateShaders() { m_shader.update(); }
   void setAttachment(GLuint texture, int width, int height);
+  /* part of the input textures covered by the rendered view */
+  inline void setViewScale(const glm::vec2 &scale) { m_viewScale = scale; }
+  /* part of the input textures of the output size covered by the output */
+  inline void setOutputScale(const glm::vec2 &scale) { m_outputScale = scale; }
 
   void setFbo(GLuint fbo);
   void setInputTextures(int count, GLuint *colortex, GLuint depthtex);
+  inline void setInputTexture(int index, GLuint colortex) { m_colorTextures[index] = colortex; }
   void setRandomTexture(GLuint randomtex, int width, int height);
   void render() const;
 };
@@ -2,6 +2,7 @@
 #include "camera_spec.h"
 #include "scene.h"
 #include <GL/glew.h>
+#include <unordered_map>
 
 namespace Optifuser {
 
@@ -17,7 +18,7 @@ protected:
 
   std::string m_vertFile;
   std::string m_fragFile;
-  std::shared_ptr<Shader> m_shader;
+  ShaderSlot m_shader;
 
   int m_width, m_height;
 
@@ -25,15 +26,34 @@ protected:
 
   bool m_clearDepth = true;
 
+  glm::vec2 m_jitter = {0, 0};
+
+  // model matrices and view projection of the previous render, for motion vectors
+  bool m_motionVectors = false;
+  std::unordered_map<const Object *, glm::mat4> m_previousModelMatrices;
+  std::unordered_map<const Object *, glm::mat4> m_modelMatrices;
+  glm::mat4 m_previousViewProjection;
+  bool m_hasPrevious = false;
+
 public:
   void init();
   void setFbo(GLuint fbo);
   void setShader(const std::string &vs, const std::string &fs);
+  /* set the shader files again, the current program stays in use until the new one compiled */
+  inline void reloadShaders() {
+    if (!m_vertFile.empty()) {
+      setShader(m_vertFile, m_fragFile);
+    }
+  }
+  inline void updateShaders() { m_shader.update(); }
   void setColorAttachments(int num, GLuint *tex, int width, int height);
   void setDepthAttachment(GLuint depthtex, bool clear = true);
   void bindAttachments() const;
-  void render(const Scene &scene, const CameraSpec &camera,
-              bool renderSegmentation = false) const;
+  void render(const Scene &scene, const CameraSpec &camera, bool renderSegmentation = false);
+  /* subpixel offset of the projection in NDC, for temporal anti-aliasing */
+  inline void setJitter(const glm::vec2 &jitter) { m_jitter = jitter; }
+  /* remember object transforms between renders; without it objects appear static */
+  void enableMotionVectors(bool enable);
 
   int numColorAttachments() const;
 
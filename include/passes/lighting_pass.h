@@ -30,17 +30,27 @@ private:
   GLuint m_aotex = 0;
 
   int m_width, m_height;
+  glm::vec2 m_viewScale = {1, 1};
   int m_shadow_frustum_size = 10.f;
 
   std::string m_vertFile;
   std::string m_fragFile;
-  std::shared_ptr<Shader> m_shader;
+  ShaderSlot m_shader;
 
 public:
   void init();
   void setShadowFrustumSize(int size);
   void setShader(const std::string &vs, const std::string &fs);
+  /* set the shader files again, the current program stays in use until the new one compiled */
+  inline void reloadShaders() {
+    if (!m_vertFile.empty()) {
+      setShader(m_vertFile, m_fragFile);
+    }
+  }
+  inline void updateShaders() { m_shader.update(); }
   void setAttachment(GLuint texture, int width, int height);
+  /* part of the input textures covered by the rendered view */
+  inline void setViewScale(const glm::vec2 &scale) { m_viewScale = scale; }
 
   void setFbo(GLuint fbo);
   void setInputTextures(int count, GLuint *colortex, GLuint depthtex);
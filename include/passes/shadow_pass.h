@@ -13,7 +13,7 @@ private:
 
   std::string m_vertFile;
   std::string m_fragFile;
-  std::shared_ptr<Shader> m_shader;
+  ShaderSlot m_shader;
 
   int m_width, m_height;
 
@@ -26,6 +26,13 @@ public:
   void setFrustumSize(int size);
   void setFbo(GLuint fbo);
   void setShader(const std::string &vs, const std::string &fs);
+  /* set the shader files again, the current program stays in use until the new one compiled */
+  inline void reloadShaders() {
+    if (!m_vertFile.empty()) {
+      setShader(m_vertFile, m_fragFile);
+    }
+  }
+  inline void updateShaders() { m_shader.update(); }
   void setDepthAttachment(GLuint depthtex, int with, int height);
   void bindAttachments() const;
   void render(const Scene &scene, const CameraSpec &camera) const;
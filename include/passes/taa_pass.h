@@ -0,0 +1,64 @@
+#pragma once
+#include "camera_spec.h"
+#include "scene.h"
+#include <GL/glew.h>
+
+namespace Optifuser {
+
+/* Temporal anti-aliasing resolve: the lighting of the jittered frame is blended into the
+ * previous result, reprojected with the motion vectors and clamped to the colours around the
+ * pixel. Results alternate between two history textures. */
+class TAAPass {
+
+public:
+  TAAPass();
+  ~TAAPass();
+
+private:
+  bool m_initialized = false;
+
+  GLuint m_fbo = 0;
+  GLuint m_quadVao = 0;
+  GLuint m_quadVbo = 0;
+
+  GLuint m_lightingTexture = 0;
+  GLuint m_motionTexture = 0;
+  GLuint m_depthTexture = 0;
+  GLuint m_historyTextures[2] = {0, 0};
+  int m_current = 0;
+  bool m_historyValid = false;
+
+  int m_width, m_height;
+  glm::vec2 m_viewScale = {1, 1};
+  float m_blendFactor = 0.1f;
+
+  std::string m_vertFile;
+  std::string m_fragFile;
+  ShaderSlot m_shader;
+
+public:
+  void init();
+  void setShader(const std::string &vs, const std::string &fs);
+  /* set the shader files again, the current program stays in use until the new one compiled */
+  inline void reloadShaders() {
+    if (!m_vertFile.empty()) {
+      setShader(m_vertFile, m_fragFile);
+    }
+  }
+  inline void updateShaders() { m_shader.update(); }
+
+  void setFbo(GLuint fbo);
+  void setInputTextures(GLuint lighting, GLuint motion, GLuint depth);
+  /* the history starts over, e.g. after a resize */
+  void setHistoryTextures(GLuint history0, GLuint history1, int width, int height);
+  /* part of the textures covered by the rendered view */
+  inline void setViewScale(const glm::vec2 &scale) { m_viewScale = scale; }
+  /* weight of the current frame, lower is smoother but slower to react */
+  inline void setBlendFactor(float factor) { m_blendFactor = factor; }
+  inline void resetHistory() { m_historyValid = false; }
+  /* the history texture written by the last render */
+  inline GLuint getOutputTexture() const { return m_historyTextures[m_current]; }
+  void render();
+};
+
+} // namespace Optifuser
@@ -23,9 +23,10 @@ protected:
 
   std::string m_vertFile;
   std::string m_fragFile;
-  std::shared_ptr<Shader> m_shader;
+  ShaderSlot m_shader;
 
   int m_width, m_height;
+  glm::vec2 m_jitter = {0, 0};
   int m_shadow_frustum_size = 10.f;
 
   bool m_initialized;
@@ -37,8 +38,17 @@ public:
   void setShadowTexture(GLuint shadowtex, int size);
   void setRandomTexture(GLuint randomtex, GLuint width, GLuint height);
   void setShader(const std::string &vs, const std::string &fs);
+  /* set the shader files again, the current program stays in use until the new one compiled */
+  inline void reloadShaders() {
+    if (!m_vertFile.empty()) {
+      setShader(m_vertFile, m_fragFile);
+    }
+  }
+  inline void updateShaders() { m_shader.update(); }
   void setColorAttachments(int num, GLuint *tex, int width, int height);
   void setDepthAttachment(GLuint depthtex);
+  /* subpixel offset of the projection in NDC, must match the G-buffer */
+  inline void setJitter(const glm::vec2 &jitter) { m_jitter = jitter; }
   void bindAttachments() const;
   void render(const Scene &scene, const CameraSpec &camera, bool renderSegmentation = false) const;
 
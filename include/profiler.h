@@ -0,0 +1,52 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+namespace Optifuser {
+
+/* Scoped CPU zones recorded into per-thread ring buffers and exported in the
+ * Chrome trace_event format (chrome://tracing, Perfetto).
+ * Instrumentation goes through the OPTIFUSER_PROFILE_* macros, which compile to
+ * nothing unless OPTIFUSER_PROFILER is defined (cmake -DOPTIFUSER_PROFILER=ON).
+ * Zone and counter names must be string literals or otherwise outlive the trace. */
+class Profiler {
+public:
+  static constexpr uint32_t EVENTS_PER_THREAD = 1 << 15;
+
+  static uint64_t now(); // nanoseconds since the profiler epoch
+  static void setEnabled(bool enable);
+  static bool isEnabled();
+  /* name shown for the calling thread in the trace */
+  static void setThreadName(const std::string &name);
+
+  static void zone(const char *name, uint64_t begin, uint64_t end);
+  static void counter(const char *name, double value);
+
+  /* events are dumped from all threads, best taken while they are idle */
+  static bool writeChromeTrace(const std::string &filename);
+  static void clear();
+};
+
+class ProfileZone {
+  const char *name;
+  uint64_t begin;
+
+public:
+  inline ProfileZone(const char *n) : name(n), begin(Profiler::now()) {}
+  inline ~ProfileZone() { Profiler::zone(name, begin, Profiler::now()); }
+};
+
+} // namespace Optifuser
+
+#ifdef OPTIFUSER_PROFILER
+#define OPTIFUSER_PROFILE_CONCAT_(a, b) a##b
+#define OPTIFUSER_PROFILE_CONCAT(a, b) OPTIFUSER_PROFILE_CONCAT_(a, b)
+#define OPTIFUSER_PROFILE_SCOPE(name)                                                              \
+  ::Optifuser::ProfileZone OPTIFUSER_PROFILE_CONCAT(profileZone_, __LINE__)(name)
+#define OPTIFUSER_PROFILE_COUNTER(name, value) ::Optifuser::Profiler::counter(name, value)
+#define OPTIFUSER_PROFILE_THREAD(name) ::Optifuser::Profiler::setThreadName(name)
+#else
+#define OPTIFUSER_PROFILE_SCOPE(name)
+#define OPTIFUSER_PROFILE_COUNTER(name, value)
+#define OPTIFUSER_PROFILE_THREAD(name)
+#endif
@@ -0,0 +1,85 @@
+#pragma once
+#include <GL/glew.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Optifuser {
+
+struct TextureDesc {
+  GLenum internalFormat = GL_RGBA32F;
+  GLenum format = GL_RGBA;
+  GLenum type = GL_FLOAT;
+  GLuint width = 0;
+  GLuint height = 0;
+
+  bool operator==(const TextureDesc &other) const;
+  size_t bytes() const;
+};
+
+/* Passes declare the textures they read and write, in execution order. compile() culls
+ * passes that contribute to no output and places the transient textures of the remaining
+ * passes: textures with equal descriptions whose lifetimes do not overlap share one GL texture.
+ * Imported textures are owned by the caller and always count as outputs.
+ * A transient texture is assumed to be fully overwritten by the first pass writing it. */
+class RenderGraph {
+public:
+  using Resource = uint32_t;
+
+private:
+  struct ResourceInfo {
+    std::string name;
+    TextureDesc desc;
+    bool imported = false;
+    bool output = false;
+    GLuint texture = 0;
+  };
+  struct PassInfo {
+    std::string name;
+    uint32_t tag; // caller's pass index
+    std::vector<Resource> reads;
+    std::vector<Resource> writes;
+    bool live = false;
+  };
+  struct PhysicalTexture {
+    GLuint id;
+    TextureDesc desc;
+    uint32_t busyUntil; // last pass using it in the compiled frame
+    bool used;
+  };
+
+  std::vector<ResourceInfo> resources;
+  std::vector<PassInfo> passes;
+  std::vector<PhysicalTexture> pool; // kept across compiles, so rebuilding allocates nothing new
+
+public:
+  RenderGraph() = default;
+  RenderGraph(const RenderGraph &) = delete;
+  RenderGraph &operator=(const RenderGraph &) = delete;
+  ~RenderGraph();
+
+  /* drop all declarations, pooled textures are kept for the next compile */
+  void reset();
+
+  Resource importTexture(const std::string &name, GLuint texture);
+  Resource createTexture(const std::string &name, const TextureDesc &desc);
+  /* keep a transient texture alive after the frame, e.g. for readbacks */
+  void markOutput(Resource resource);
+  void addPass(const std::string &name, uint32_t tag, std::vector<Resource> reads,
+               std::vector<Resource> writes);
+
+  void compile();
+
+  /* 0 for transient textures of culled passes */
+  GLuint getTexture(Resource resource) const;
+  bool isLive(uint32_t tag) const;
+
+  /* delete the pooled textures */
+  void releaseTextures();
+
+  /* bytes of the declared transient textures of live passes and of the GL textures backing them */
+  size_t getTransientBytes() const;
+  size_t getAllocatedBytes() const;
+};
+
+} // namespace Optifuser
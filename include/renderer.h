@@ -1,12 +1,18 @@
 #pragma once
 #include "camera_spec.h"
+#include "dynamic_resolution.h"
+#include "gl_stats.h"
+#include "gpu_timer.h"
+#include "occlusion_culler.h"
 #include "passes/ao_pass.h"
 #include "passes/axis_pass.h"
 #include "passes/composite_pass.h"
 #include "passes/gbuffer_pass.h"
 #include "passes/lighting_pass.h"
 #include "passes/shadow_pass.h"
+#include "passes/taa_pass.h"
 #include "passes/transparency_pass.h"
+#include "render_graph.h"
 #include "scene.h"
 #include "shader.h"
 #include <GL/glew.h>
@@ -23,6 +29,7 @@ enum FBO_TYPE {
   LIGHTING,
   TRANSPARENCY,
   AXIS,
+  TAA,
   COMPOSITE,
   DISPLAY,
   COPY,
@@ -30,6 +37,10 @@ enum FBO_TYPE {
   COUNT
 };
 
+/* Results a frame has to produce; passes contributing to none of them are culled.
+ * The G-buffer textures (albedo, normal, depth, segmentation, user) are always produced. */
+enum RENDER_OUTPUT { OUTPUT_LIGHTING = 1, OUTPUT_DISPLAY = 2 };
+
 class Renderer {
 
 private:
@@ -39,20 +50,34 @@ private:
   std::unique_ptr<LightingPass> lighting_pass = nullptr;
   std::unique_ptr<AxisPass> axis_pass = nullptr;
   std::unique_ptr<TransparencyPass> transparency_pass = nullptr;
+  std::unique_ptr<TAAPass> taa_pass = nullptr;
   std::unique_ptr<CompositePass> composite_pass = nullptr;
   std::unique_ptr<CompositePass> display_pass = nullptr;
+  std::unique_ptr<OcclusionCuller> occlusion_culler = nullptr;
+  std::unique_ptr<GpuTimer> gpu_timer = nullptr; // indexed by FBO_TYPE
+  std::unique_ptr<DynamicResolution> dynamic_resolution = nullptr;
+  PassStats passStats[FBO_TYPE::COPY];             // passes of the frame being rendered
+  GLCounters frameStart;
+  FrameStats frameStats;
+  RenderGraph render_graph;
+  uint32_t requiredOutputs = OUTPUT_LIGHTING | OUTPUT_DISPLAY;
 
   bool shadowPassEnabled = false;
   bool aoPassEnabled = false;
   bool axisPassEnabled = false;
   bool displayPassEnabled = false;
+  bool motionVectorsEnabled = false;
+  bool taaEnabled = false;
 
   // Screen-specific factor, depending on DPI setting
   uint8_t scaling = 1;
 
 public:
   GLuint colortex[N_COLORTEX];
+  // aotex, aoReducedtex, outputtex, lightingtex and lightingtex2 are placed by the render graph:
+  // they may share memory with each other, and are 0 when their passes are culled
   GLuint aotex = 0;
+  GLuint aoReducedtex[3]; // packed normal/depth, raw ao, blurred ao at reduced resolution
   GLuint depthtex = 0;
   GLuint outputtex = 0;
   GLuint lightingtex = 0;
@@ -62,6 +87,8 @@ public:
   GLuint segtex[3];
   GLuint usertex[1];
   GLuint shadowtex = 0;
+  GLuint motiontex = 0;     // when motion vectors or TAA are enabled
+  GLuint historytex[2] = {0, 0}; // resolved frames of TAA
 
   GLuint m_fbo[FBO_TYPE::COUNT];
 
@@ -73,6 +100,19 @@ public:
   void initTextures();
   void rebindTextures();
 
+private:
+  void buildRenderGraph();
+  void initShadowTexture();
+  void deleteShadowTexture();
+  void bindShadowPass();
+  void bindAOPass();
+  void bindAxisPass();
+  void bindDisplayPass();
+  void initMotionTextures();
+  void deleteMotionTextures();
+  void bindTAAPass();
+  void updateRenderSize();
+
 public:
   Renderer();
   void init(float scaling = 1);
@@ -87,7 +127,30 @@ public:
   void enableGlobalAxes(bool enable = true);
 
   void enableShadowPass(bool enable = true, int shadowmapSize = 2048, float shadowFrustumSize = 10.f);
-  void enableAOPass(bool enable = true);
+  /* downsample: compute ao at 1/1, 1/2 or 1/4 resolution (needs the reconstruction shaders) */
+  void enableAOPass(bool enable = true, int downsample = 1, int sampleCount = 16);
+  void enableOcclusionCulling(bool enable = true);
+  /* write per pixel motion since the previous frame, read back with getMotion() */
+  void enableMotionVectors(bool enable = true);
+  /* temporal anti-aliasing: the projection is jittered by a subpixel offset every frame and the
+   * lighting is accumulated over frames before composite; needs the TAA shader */
+  void enableTAA(bool enable = true, float blendFactor = 0.1f);
+  void enableGpuTimers(bool enable = true);
+  /* render at an internal resolution chosen from the GPU pass times to meet settings.targetMs,
+   * composite and display upscale to the output size; enables the GPU timers */
+  void enableDynamicResolution(bool enable = true,
+                               const DynamicResolutionSettings &settings = {});
+  /* internal resolution relative to the output size, per axis; set each frame by dynamic
+   * resolution. Textures are not reallocated, the passes render into a part of them. */
+  void setRenderScale(float scale);
+  inline float getRenderScale() const { return m_renderScale; }
+  /* nullptr when dynamic resolution is disabled */
+  inline DynamicResolution *getDynamicResolution() const { return dynamic_resolution.get(); }
+  /* RENDER_OUTPUT flags */
+  void setRequiredOutputs(uint32_t outputs);
+  inline const RenderGraph &getRenderGraph() const { return render_graph; }
+  /* nullptr when occlusion culling is disabled */
+  inline OcclusionCuller *getOcclusionCuller() const { return occlusion_culler.get(); }
 
 public:
   bool initialized;
@@ -97,30 +160,59 @@ public:
   void setAxisShader(const std::string &vs, const std::string &fs);
   void setGBufferShader(const std::string &vs, const std::string &fs);
   void setAOShader(const std::string &vs, const std::string &fs);
+  void setAOReconstructionShaders(const std::string &vs, const std::string &downsampleFs,
+                                  const std::string &blurFs, const std::string &upsampleFs);
   void setDeferredShader(const std::string &vs, const std::string &fs);
   void setShadowShader(const std::string &vs, const std::string &fs);
   void setTransparencyShader(const std::string &vs, const std::string &fs);
+  void setTAAShader(const std::string &vs, const std::string &fs);
   void setCompositeShader(const std::string &vs, const std::string &fs);
   void setDisplayShader(const std::string &vs, const std::string &fs);
 
   void setObjectIdForAxis(int id);
 
 protected:
-  GLuint m_width, m_height;
+  GLuint m_width, m_height;               // output size
+  GLuint m_renderWidth, m_renderHeight;   // internal size of the G-buffer and the lighting
+  GLuint m_textureWidth = 0, m_textureHeight = 0; // allocated size, at least the output size
+  float m_renderScale = 1.f;
+  float m_taaBlendFactor = 0.1f;
+  uint32_t m_frameIndex = 0;
   GLuint m_shadowSize = 0;
   float m_shadowFrustumSize = 10.f;
+  int m_aoDownsample = 1;
+  int m_aoSampleCount = 16;
+  // applied when the AO pass is created, the setters may come before enableAOPass
+  std::vector<std::string> m_aoShaders;
+  std::vector<std::string> m_aoReconstructionShaders;
+  LodSettings m_lodSettings;
+  LodSettings m_shadowLodSettings = {4.f, 0.f};
 
 public:
   inline GLuint getWidth() const { return m_width; }
   inline GLuint getHeight() const { return m_height; }
+  inline GLuint getRenderWidth() const { return m_renderWidth; }
+  inline GLuint getRenderHeight() const { return m_renderHeight; }
+  inline int getAODownsample() const { return m_aoDownsample; }
+  inline int getAOSampleCount() const { return m_aoSampleCount; }
+
+  inline void setLodSettings(const LodSettings &settings) { m_lodSettings = settings; }
+  inline const LodSettings &getLodSettings() const { return m_lodSettings; }
+  inline void setShadowLodSettings(const LodSettings &settings) { m_shadowLodSettings = settings; }
+  inline const LodSettings &getShadowLodSettings() const { return m_shadowLodSettings; }
 
 public:
   void renderScene(Scene &scene, const CameraSpec &camera);
+  /* GPU time of each pass over the last frames, empty when timers are disabled */
+  PassTimings getPassTimings() const;
+  /* GL work of the last complete frame, i.e. between the previous two renderScene calls */
+  inline const FrameStats &getFrameStats() const { return frameStats; }
   void displayLighting(GLuint fbo = 0) const;
   void displaySegmentation(GLuint fbo = 0) const;
   void displayUserTexture(GLuint fbo = 0) const;
   void display(GLuint fbo = 0) const;
 
+  /* the lighting has the output size, the G-buffer textures the internal size */
   std::vector<float> getLighting();
   std::vector<float> getAlbedo();
   std::vector<float> getNormal();
@@ -128,8 +220,15 @@ public:
   std::vector<int> getSegmentation();
   std::vector<int> getSegmentation2();
   std::vector<float> getUserTexture();
+  /* motion of each pixel since the previous frame in pixels, x right and y up, 2 floats per
+   * pixel; transparent objects do not write motion */
+  std::vector<float> getMotion();
 
+  /* recompile all pass shaders from their files without stalling, e.g. after editing them */
   void reloadShaders();
+
+private:
+  void updateShaders();
 };
 
 } // namespace Optifuser
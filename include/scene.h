@@ -1,18 +1,136 @@
 #pragma once
 #include "lights.h"
 #include "object.h"
+#include "object_data.h"
+#include <atomic>
+#include <span>
+#include <unordered_map>
 #include <vector>
 namespace Optifuser {
+class CameraSpec;
+
+struct LodSettings {
+  float errorThreshold = 1.f; // largest simplification error allowed on screen, in pixels
+  float minScreenSize = 1.f;  // objects with a smaller projected diameter (pixels) are culled
+};
+
+struct TextureMemory {
+  uint32_t textures = 0;
+  size_t bytes = 0;      // GPU storage of all levels
+  size_t rgba8Bytes = 0; // the same textures stored as RGBA8
+};
+
+/* Objects are added and removed directly on the GL thread. Other threads push
+ * the changes on a lock-free list instead, prepareObjects applies them in
+ * order. A simulation thread updates objects through snapshots (writeTransform
+ * and publishSnapshot). Everything else is for the render thread only. */
 class Scene {
 public:
   Scene(){};
-  ~Scene(){};
+  ~Scene();
 
 private:
+  struct Change {
+    std::unique_ptr<Object> add;
+    Object *remove = nullptr;
+    std::string removeName;
+    Change *next = nullptr;
+  };
+  std::atomic<Change *> pendingChanges = nullptr; // newest first
+  void pushChange(Change *change);
+
+  enum StateFields : uint32_t { TransformField = 1, VisibilityField = 2, MaterialField = 4 };
+  struct StateRecord {
+    ObjectHandle handle; // of the object or its top level ancestor, stale once removed
+    Object *object;
+    uint32_t fields;
+    glm::vec3 position;
+    glm::quat rotation;
+    glm::vec3 scale;
+    float visibility;
+    glm::vec4 kd;
+    float ks;
+    float roughness;
+    float metallic;
+  };
+  struct Snapshot {
+    std::vector<StateRecord> records;
+    Snapshot *next = nullptr;
+  };
+  // one record per object; the simulation writes on the published snapshot again until
+  // prepareObjects takes it, so at most one is pending and it holds the latest values
+  Snapshot *backSnapshot = nullptr;                    // owned by the simulation thread
+  std::atomic<Snapshot *> publishedSnapshot = nullptr;
+  std::atomic<Snapshot *> freeSnapshots = nullptr;     // applied, reused by the simulation
+  StateRecord &writeRecord(Object *obj, uint32_t fields);
+
+  struct ObjectSlot {
+    Object *object = nullptr; // null while the add is queued
+    uint32_t generation = 0;
+    uint32_t position = 0; // in objects
+    uint32_t namePosition = 0, segmentIdPosition = 0, objIdPosition = 0; // in the index buckets
+    std::string name; // as indexed, objects may be renamed later
+  };
+  std::vector<ObjectSlot> slots;
+  std::vector<uint32_t> freeSlots;       // reused on the GL thread only
+  std::atomic<uint32_t> nextSlot = 0;    // never used slots, taken by any thread
+  ObjectHandle allocateHandle();
+  void insertObject(std::unique_ptr<Object> obj);
+
+  std::vector<ObjectHandle> removals; // applied by forceRemove
+  // removed by the last forceRemove, destroyed by the next so that passes keeping
+  // last frame's objects (e.g. motion vectors) never see a reused address
+  std::vector<std::unique_ptr<Object>> retiredObjects;
+
+  // buckets are unordered, objects know their position in them for O(1) removal
+  template <typename K> using HandleIndex = std::unordered_map<K, std::vector<ObjectHandle>>;
+  HandleIndex<std::string> nameIndex;
+  HandleIndex<uint32_t> segmentIdIndex;
+  HandleIndex<uint32_t> objIdIndex;
+  template <typename K>
+  void indexHandle(HandleIndex<K> &index, const K &key, ObjectHandle handle,
+                   uint32_t ObjectSlot::*position);
+  template <typename K>
+  void unindexHandle(HandleIndex<K> &index, const K &key, ObjectHandle handle,
+                     uint32_t ObjectSlot::*position);
+  void indexIds(const Object &obj);
+  void unindexIds(const Object &obj, uint32_t segmentId, uint32_t objId);
+
   std::vector<std::unique_ptr<Object>> objects;
   std::vector<Object *> opaque_objects;
   std::vector<Object *> transparent_objects;
 
+  // Added objects are appended and removed ones leave null entries, the whole
+  // hierarchy is flattened again when children were added or entries pile up.
+  // Top level objects and materials are checked for changes, children are read again
+  // when marked dirty.
+  ObjectData data;
+  ObjectData previousData;           // the last flatten, kept for its capacity
+  std::vector<Object *> unflattened; // added since the last prepare
+  bool retiredUnflattened = false;   // unflattened holds retired objects
+  uint32_t removedEntries = 0;
+  std::atomic<bool> hierarchyChanged = true;
+  std::unordered_map<const PBRMaterial *, uint32_t> materialIndices; // into data.materialTable
+  std::unordered_map<const AbstractMeshBase *, uint32_t> meshIndices; // into data.meshTable
+  std::vector<Object *> dirtyObjects;
+  std::vector<uint32_t> movedEntries;   // data.moved is set for these
+  std::vector<uint32_t> waitingEntries; // classes with DRAW_WAITING
+  // entries using each material of data.materialTable, and the position of each entry there
+  std::vector<std::vector<uint32_t>> materialEntries;
+  std::vector<uint32_t> materialPositions; // UINT32_MAX while the entry has no material
+  // materialTable stays valid until it is rebuilt, also for materials objects dropped
+  std::vector<std::shared_ptr<PBRMaterial>> materialOwners;
+  std::vector<uint8_t> materialStates; // what the draw class depends on, as of the last prepare
+  bool drawListsChanged = true;
+  void flattenHierarchy();
+  void appendObjectTree(Object *obj, int32_t parent, const ObjectData *previous);
+  uint32_t materialIndex(const std::shared_ptr<PBRMaterial> &material);
+  bool readObject(uint32_t i);
+  void linkMaterial(uint32_t i, uint32_t material);
+  void unlinkMaterial(uint32_t i);
+  void updateWorldMatrices();
+  void classify(uint32_t i);
+
   std::vector<PointLight> pointLights;
   std::vector<DirectionalLight> directionalLights;
   std::vector<ParallelogramLight> parallelogramLights;
@@ -31,17 +149,67 @@ public:
   }
 
 public:
-  void addObject(std::unique_ptr<Object> obj);
+  /* the handle is valid right away, also when the add is queued from another thread */
+  ObjectHandle addObject(std::unique_ptr<Object> obj);
+  /* null for removed objects and adds that are still queued */
+  Object *getObject(ObjectHandle handle) const;
   /*  mark an object for removal */
   void removeObject(Object *obj);
   /*  mark objects for removal */
   void removeObjectsByName(std::string name);
-  /* remove objects that are marked to be removed now */
+  /* remove objects that are marked to be removed now, in any order; their GL
+   * resources are released by the next call */
   void forceRemove();
 
+  /* Top level objects by the name they had when added, and by their current ids.
+   * Queued adds are found once prepareObjects applied them. */
+  std::vector<ObjectHandle> findObjectsByName(const std::string &name) const;
+  std::vector<ObjectHandle> findObjectsBySegmentId(uint32_t id) const;
+  std::vector<ObjectHandle> findObjectsByObjId(uint32_t id) const;
+  /* called by Object when its ids change */
+  void reindexIds(const Object &obj, uint32_t oldSegmentId, uint32_t oldObjId);
+  /* apply the changes other threads pushed, called by prepareObjects */
+  void applyChanges();
+
+  /* Simulation thread, one at a time: the values go to a back buffer and reach
+   * the objects when prepareObjects applies the published snapshot, so the next
+   * step can be simulated while the last one renders. Steps published before the
+   * renderer took the last one are merged into it, the latest value of each field
+   * wins. Values written to objects removed before they are applied are dropped. */
+  void writeTransform(Object *obj, const glm::vec3 &position, const glm::quat &rotation,
+                      const glm::vec3 &scale);
+  void writeVisibility(Object *obj, float visibility);
+  /* values of obj->pbrMaterial, seen by every object sharing it */
+  void writeMaterial(Object *obj, const glm::vec4 &kd, float ks, float roughness, float metallic);
+  void publishSnapshot();
+  /* apply the published snapshot, called by prepareObjects */
+  void applySnapshots();
+
+  /* Poses of many objects at once, e.g. straight from a physics engine. Pose i
+   * is read from posQuat + i * stride as x, y, z, qw, qx, qy, qz; quaternions
+   * are normalized here. Stale handles are skipped. Only the written objects
+   * and their children get new world transforms in the next prepare. */
+  void setPoses(std::span<const ObjectHandle> handles, const float *posQuat, size_t stride = 7);
+
   void prepareObjects();
+  /* choose the LOD of every prepared object for the given view, call after prepareObjects */
+  void updateLods(const CameraSpec &camera, int viewHeight, const LodSettings &view,
+                  const LodSettings &shadow);
 
   inline const std::vector<std::unique_ptr<Object>> &getObjects() const { return objects; }
+  /* every object as of the last prepareObjects */
+  inline const ObjectData &getObjectData() const { return data; }
+  /* for the culler, which lowers LOD levels */
+  inline ObjectData &getObjectData() { return data; }
+  /* children were added to an object of the scene, called by Object */
+  inline void markHierarchyChanged() { hierarchyChanged = true; }
+  /* read obj again in the next prepare, called by Object::markDirty */
+  inline void queueDirty(Object *obj) {
+    obj->dirty = true;
+    dirtyObjects.push_back(obj);
+  }
+  /* memory of the distinct material textures used by the objects */
+  TextureMemory getTextureMemory() const;
   inline const std::vector<Object *> &getOpaqueObjects() const { return opaque_objects; }
   inline const std::vector<Object *> &getTransparentObjects() const { return transparent_objects; }
 
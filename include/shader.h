@@ -6,12 +6,21 @@
 namespace Optifuser {
 class Shader {
 public:
-  GLuint Id;
+  GLuint Id = 0;
 
   Shader(const GLchar *vertexPath, const GLchar *fragmenetPath);
+  Shader(const Shader &) = delete;
+  Shader &operator=(const Shader &) = delete;
   ~Shader();
 
+  /* Compiles and links are only issued when the shader is created; status is queried
+   * lazily, so several programs compile in parallel on drivers that support it.
+   * use() waits for the program if it is still compiling. */
   void use() const;
+  /* true once the program can be used without waiting, never blocks */
+  bool isReady() const;
+  /* wait for the compile and report errors, returns whether the program linked */
+  bool finish() const;
 
   void setBool(const std::string &name, bool value) const;
   void setInt(const std::string &name, int value) const;
@@ -24,6 +33,53 @@ public:
   void setUserData(const std::string &name, uint32_t size, float const * data) const;
   void setTexture(const std::string &name, GLuint textureId, GLint n) const;
   void setCubemap(const std::string &name, GLuint textureId, GLint n) const;
+
+private:
+  // compile state, resolved by finish()
+  mutable GLuint pendingVertex = 0;
+  mutable GLuint pendingFragment = 0;
+  mutable bool pending = false;
+  mutable bool linked = false;
+  std::string label;
+  std::string binaryFile;
+
+  Shader() {}
+  void build(const std::string &vertexCode, const std::string &fragmentCode,
+             const char *vertexPath, const char *fragmentPath);
+
+  friend std::shared_ptr<Shader> LoadShader(const std::string &vertexPath,
+                                            const std::string &fragmentPath);
 };
 
+/* The program of a pass. Assigning a new shader keeps the previous one in use until the
+ * replacement has compiled, so shaders can be reloaded without stalling a frame. */
+class ShaderSlot {
+  mutable std::shared_ptr<Shader> current;
+  mutable std::shared_ptr<Shader> next;
+
+public:
+  ShaderSlot &operator=(std::shared_ptr<Shader> shader);
+  /* swap in the replacement if it is ready, call between frames */
+  void update();
+
+  Shader *get() const;
+  inline Shader *operator->() const { return get(); }
+  inline explicit operator bool() const { return current || next; }
+};
+
+/* Linked programs are cached in memory per GL context, keyed on the shader sources, so
+ * passes setting the same shader again (e.g. switching display modes) reuse the program.
+ * The last few programs no pass holds any more are kept, older ones are deleted.
+ * Program binaries are also kept on disk, keyed on the sources and the driver, and
+ * loaded with glProgramBinary on later launches instead of compiling. */
+std::shared_ptr<Shader> LoadShader(const std::string &vertexPath, const std::string &fragmentPath);
+
+/* Directory of the program binary cache, empty disables it. Defaults to
+ * $OPTIFUSER_SHADER_CACHE, or optifuser/shaders under $XDG_CACHE_HOME or ~/.cache. */
+void setShaderCacheDirectory(const std::string &directory);
+std::string getShaderCacheDirectory();
+
+/* drop the cached programs of a context, which must be current */
+void releaseShaderCache(uint32_t context);
+
 } // namespace Optifuser
@@ -1,26 +1,69 @@
 #pragma once
+#include "gl_commands.h"
+#include "texture_compression.h"
+#include "upload_queue.h"
 #include <GL/glew.h>
+#include <algorithm>
 #include <fstream>
 #include <memory>
 #include <vector>
 
 namespace Optifuser {
+class TextureStreamer;
 
 std::tuple<std::vector<unsigned char>, int, int, int> load_image(std::string const &filename);
 std::tuple<std::vector<float>, int, int, int> load_hdr(std::string const &filename);
 
+struct TextureLoadSettings {
+  // block compress through loadCompressed, see texture_compression.h; the OptiX renderer
+  // cannot sample compressed textures
+  bool compress = false;
+  bool preferBC7 = false; // better color quality than BC1, twice the size for opaque textures
+  bool writeCache = false; // store encodings next to the source files
+  bool readCache = true;   // load encodings stored next to the source files
+  // store color maps as sRGB; off since the renderer does not gamma encode its output
+  bool srgbColor = false;
+  bool cpuMipmaps = false; // filter uncompressed mips on the CPU instead of glGenerateMipmap
+  MipFilter mipFilter = MipFilter::Kaiser;
+  uint32_t threadCount = 0; // encoder and filter threads, 0 picks from the hardware concurrency
+  TextureStreamer *streamer = nullptr; // streams the levels of compressed textures if set
+};
+
+// read by the texture loaders, set it before loading a scene
+inline TextureLoadSettings textureLoading;
+
 class Texture {
 private:
   GLuint id = 0;
   int mWidth = 0;
   int mHeight = 0;
+  size_t mByteSize = 0;      // all levels as stored on the GPU
+  size_t mRGBA8ByteSize = 0; // the same levels as RGBA8
+  bool mCompressed = false;
+
+  friend class TextureStreamer;
+  TextureStreamer *mStreamer = nullptr;
+  float mRequestedSize = 0.f; // largest screen size in pixels since the last streamer update
+  std::shared_ptr<UploadTicket> mUpload; // levels queued on asyncUploads
+  std::shared_ptr<GLCommandToken> mCreation; // GL calls deferred to the render thread
 
 public:
   Texture() {}
   virtual ~Texture() { destroy(); }
 
+  /* The loaders may run on any thread: files are decoded and filtered on the
+   * caller and the GL texture is created through glCommands, so getId() stays 0
+   * until the render thread ran it. */
+
+  /* Full mip chain in a format picked by usage: R8 height maps, RG8 normal maps
+   * and RGBA8 (SRGB8_ALPHA8 with textureLoading.srgbColor) color maps. */
   void load(const std::string &filename, int mipmap = 0, int wrapping = GL_REPEAT,
-            int minFilter = GL_NEAREST_MIPMAP_LINEAR, int magFilter = GL_LINEAR);
+            int minFilter = GL_NEAREST_MIPMAP_LINEAR, int magFilter = GL_LINEAR,
+            TextureUsage usage = TextureUsage::Color);
+  /* Block compressed upload, transcoded on first load and cached next to the
+   * file. Falls back to load when textureLoading.compress is off. */
+  void loadCompressed(const std::string &filename, TextureUsage usage, int wrapping = GL_REPEAT,
+                      int minFilter = GL_NEAREST_MIPMAP_LINEAR, int magFilter = GL_LINEAR);
   void loadFloat(std::vector<float> const &data, int width, int height, int wrapping = GL_REPEAT,
                  int minFilter = GL_NEAREST_MIPMAP_LINEAR, int magFilter = GL_LINEAR);
   void destroy();
@@ -28,6 +71,21 @@ public:
 
   inline int getWidth() const { return mWidth; }
   inline int getHeight() const { return mHeight; }
+  inline size_t getByteSize() const { return mByteSize; }
+  inline size_t getRGBA8ByteSize() const { return mRGBA8ByteSize; }
+  inline bool isCompressed() const { return mCompressed; }
+
+  /* false while levels queued on asyncUploads are missing, samplers fall back
+   * to the constant material values meanwhile */
+  inline bool isResident() const { return id && (!mUpload || mUpload->pending == 0); }
+  /* the GL texture is still to be created by the render thread */
+  inline bool isLoading() const { return mCreation && !mCreation->done && !mCreation->cancelled; }
+
+  inline bool isStreamed() const { return mStreamer != nullptr; }
+  /* diameter in pixels of an object using this texture, read by the streamer */
+  inline void requestScreenSize(float pixels) {
+    mRequestedSize = std::max(mRequestedSize, pixels);
+  }
 
 public:
   static const Texture Empty;
@@ -38,7 +96,13 @@ std::shared_ptr<Texture> CreateRandomTexture(int width, int height, int seed);
 std::shared_ptr<Texture> LoadTexture(const std::string &filename, int mipmap = 0,
                                      int wrapping = GL_REPEAT,
                                      int minFilter = GL_NEAREST_MIPMAP_LINEAR,
-                                     int magFilter = GL_LINEAR);
+                                     int magFilter = GL_LINEAR,
+                                     TextureUsage usage = TextureUsage::Color);
+
+std::shared_ptr<Texture> LoadCompressedTexture(const std::string &filename, TextureUsage usage,
+                                               int wrapping = GL_REPEAT,
+                                               int minFilter = GL_NEAREST_MIPMAP_LINEAR,
+                                               int magFilter = GL_LINEAR);
 
 void writeToFile(GLuint textureId, GLuint width, GLuint height, std::string filename);
 
@@ -47,15 +111,13 @@ private:
   GLuint id;
   int width = 0;
   int height = 0;
+  std::shared_ptr<GLCommandToken> creation;
 
 public:
   CubeMapTexture() : id(0) {}
   virtual ~CubeMapTexture() { destroy(); }
 
-  void destroy() {
-    glDeleteTextures(1, &id);
-    id = 0;
-  }
+  void destroy();
 
   void load(const std::string &front, const std::string &back, const std::string &top,
             const std::string &bottom, const std::string &left, const std::string &right,
@@ -65,9 +127,6 @@ public:
   inline int getWidth() const { return width; }
   inline int getHeight() const { return height; }
 
-private:
-  void loadCubeMapSide(GLuint texture, GLenum side, const std::string &filename,
-                       bool texStorage = false);
 };
 
 std::shared_ptr<CubeMapTexture>
@@ -82,6 +141,7 @@ void writeTextureDepthFloat32Raw(GLuint textureId, GLuint width, GLuint height,
 
 std::vector<float> getDepthFloat32Texture(GLuint textureId, GLuint width, GLuint height);
 std::vector<float> getRGBAFloat32Texture(GLuint textureId, GLuint width, GLuint height);
+std::vector<float> getRGFloat32Texture(GLuint textureId, GLuint width, GLuint height);
 std::vector<int> getInt32Texture(GLuint textureId, GLuint width, GLuint height);
 
 } // namespace Optifuser
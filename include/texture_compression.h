@@ -0,0 +1,40 @@
+#pragma once
+#include "mipmap.h"
+#include <GL/glew.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Optifuser {
+
+enum class TextureUsage { Color, Normal, Height };
+
+/* Block compressed image with its full mip chain, level 0 first. */
+struct CompressedImage {
+  GLenum format = 0;
+  int width = 0;
+  int height = 0;
+  std::vector<std::vector<uint8_t>> levels;
+};
+
+/* BC5 for normal maps, BC4 for height maps, BC1, BC3 or BC7 for colors (their
+ * sRGB variants if srgb is set). Falls back to BC7 for colors when the driver
+ * does not expose S3TC. */
+GLenum ChooseCompressedFormat(TextureUsage usage, bool hasAlpha, bool preferBC7, bool srgb);
+
+/* Filter an RGBA8 image (row major, 4 bytes per texel) down to 1x1 and encode
+ * every level. Bands of blocks are encoded on worker threads. */
+CompressedImage CompressImage(const uint8_t *rgba, int width, int height, GLenum format,
+                              MipFilter filter, uint32_t threadCount = 0);
+
+size_t CompressedLevelSize(GLenum format, int width, int height);
+
+/* Cached encodings live next to the source image and are dropped when the
+ * source size or write time no longer matches. Levels larger than maxSize
+ * (0 reads all) are left empty, they can be read later from their offset. */
+std::string CompressedCachePath(const std::string &filename);
+bool ReadCompressedCache(const std::string &filename, CompressedImage &image, int maxSize = 0);
+uint64_t CompressedCacheLevelOffset(const CompressedImage &image, uint32_t level);
+bool WriteCompressedCache(const std::string &filename, const CompressedImage &image);
+
+} // namespace Optifuser
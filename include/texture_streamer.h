@@ -0,0 +1,99 @@
+#pragma once
+#include "texture_compression.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+namespace Optifuser {
+class Texture;
+
+struct TextureStreamingSettings {
+  size_t budgetBytes = size_t(256) << 20; // resident memory of all streamed textures
+  int residentSize = 128; // levels up to this size are uploaded at load and never evicted
+  // texels wanted across one pixel of an object's diameter, covers uv tiling
+  float texelsPerPixel = 2.f;
+  size_t uploadBytesPerFrame = size_t(8) << 20;
+  float uploadMsPerFrame = 2.f;
+};
+
+struct TextureStreamingStats {
+  uint32_t textures = 0;
+  size_t residentBytes = 0;
+  size_t totalBytes = 0; // all levels of the streamed textures
+  uint32_t pendingLevels = 0;
+  uint32_t uploads = 0;   // during the last update
+  uint32_t evictions = 0; // during the last update
+};
+
+/* Keeps the fine levels of block compressed textures resident only while
+ * objects on screen need them. Texture::loadCompressed hands its textures over
+ * when textureLoading.streamer is set, and only levels up to residentSize are
+ * uploaded at load. Scene::updateLods requests a screen size per texture.
+ * update() reads the missing levels from the texture cache on a worker thread,
+ * uploads them under the per frame budget, and drops levels finer than needed
+ * when the memory budget is exceeded. GL_TEXTURE_BASE_LEVEL clamps sampling to
+ * the resident levels. */
+class TextureStreamer {
+public:
+  TextureStreamingSettings settings;
+
+private:
+  struct Entry {
+    std::string cacheFile; // empty if the levels are kept in image
+    CompressedImage image;
+    uint32_t generation = 0;
+    int floorLevel = 0;    // finest level that is never evicted
+    int residentLevel = 0; // finest resident level
+    int wantedLevel = 0;
+    int pendingLevel = -1; // being read, -1 if none; eviction may move residentLevel meanwhile
+    bool failed = false;
+    size_t residentBytes = 0;
+  };
+
+  struct Read {
+    Texture *texture;
+    uint32_t generation;
+    int level;
+    std::string cacheFile;
+    uint64_t offset;
+    std::vector<uint8_t> data;
+  };
+
+  std::unordered_map<Texture *, Entry> entries;
+  uint32_t nextGeneration = 0;
+  size_t residentBytes = 0;
+  size_t inflightBytes = 0; // levels being read
+  TextureStreamingStats stats;
+
+  std::thread worker;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::deque<Read> reads; // waiting for the worker
+  std::deque<Read> done;  // waiting for upload
+  bool quit = false;
+
+public:
+  TextureStreamer();
+  ~TextureStreamer();
+  TextureStreamer(const TextureStreamer &) = delete;
+  TextureStreamer &operator=(const TextureStreamer &) = delete;
+
+  /* upload the levels of image up to residentSize into texture, which is bound */
+  void add(Texture *texture, const std::string &filename, CompressedImage image);
+  /* only drops the entry, texture may already be destroyed */
+  void remove(Texture *texture);
+
+  /* once per frame on the GL thread, after the scenes requested their levels */
+  void update();
+  inline const TextureStreamingStats &getStats() const { return stats; }
+
+private:
+  void workerLoop();
+  size_t levelSize(const Entry &entry, int level) const;
+  void uploadLevel(Texture *texture, Entry &entry, int level, const std::vector<uint8_t> &data);
+  bool evictSurplus();
+};
+
+} // namespace Optifuser
@@ -0,0 +1,118 @@
+#pragma once
+#include "gl_context.h"
+#include <GL/glew.h>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace Optifuser {
+
+struct UploadSettings {
+  size_t stagingBytes = size_t(32) << 20; // persistently mapped staging ring
+  size_t bytesPerFrame = size_t(16) << 20;
+  float msPerFrame = 2.f;
+};
+
+struct UploadStats {
+  uint32_t queuedUploads = 0;
+  size_t queuedBytes = 0;
+  uint32_t uploads = 0;     // during the last update
+  size_t uploadedBytes = 0; // during the last update
+};
+
+/* Shared by a resource and its queued uploads. The resource is resident once
+ * nothing is pending, destroying it cancels what is still queued. */
+struct UploadTicket {
+  uint32_t pending = 0;
+  bool cancelled = false;
+  std::function<void()> onResident; // runs on the GL thread after the last upload
+};
+
+/* Copies CPU data into GL textures and buffers a few megabytes per frame, so
+ * creating resources mid-session does not stall a frame. Data is staged in a
+ * persistently mapped ring buffer and copied with pixel unpack and buffer
+ * copies; a fence per update tells when its part of the ring is free again.
+ * Without ARB_buffer_storage, and for data larger than the ring, uploads read
+ * client memory directly. A queue belongs to the context current when it is
+ * created, the names it uploads into must be of that context. */
+class UploadQueue {
+public:
+  UploadSettings settings;
+
+private:
+  enum class Kind { Texture, CompressedTexture, Buffer };
+  struct Upload {
+    std::shared_ptr<UploadTicket> ticket;
+    Kind kind;
+    GLuint target; // texture or buffer name
+    int level;
+    int width;
+    int height;
+    GLenum format;
+    GLenum type;
+    size_t offset; // destination offset of buffer uploads
+    std::vector<uint8_t> data;
+  };
+  GLContextId context;
+  std::mutex mutex; // guards uploads, queuedBytes and stats
+  std::deque<Upload> uploads;
+  size_t queuedBytes = 0;
+  UploadStats stats;
+
+  GLuint staging = 0;
+  uint8_t *mapped = nullptr;
+  size_t capacity = 0;
+  size_t head = 0;       // next free byte
+  size_t used = 0;       // bytes the GPU may still read
+  size_t unfenced = 0;   // bytes used since the last fence
+  struct Fence {
+    GLsync sync;
+    size_t bytes;
+  };
+  std::deque<Fence> fences;
+
+public:
+  UploadQueue() : context(currentGLContext) {}
+  ~UploadQueue();
+  UploadQueue(const UploadQueue &) = delete;
+  UploadQueue &operator=(const UploadQueue &) = delete;
+
+  /* glTexSubImage2D of a whole level of a texture with allocated storage */
+  void queueTexture(std::shared_ptr<UploadTicket> ticket, GLuint texture, int level, int width,
+                    int height, GLenum format, GLenum type, std::vector<uint8_t> data);
+  void queueCompressedTexture(std::shared_ptr<UploadTicket> ticket, GLuint texture, int level,
+                              int width, int height, GLenum format, std::vector<uint8_t> data);
+  /* glBufferSubData into an allocated buffer */
+  void queueBuffer(std::shared_ptr<UploadTicket> ticket, GLuint buffer, size_t offset,
+                   std::vector<uint8_t> data);
+
+  /* once per frame on the GL thread, uploads within the per frame budget */
+  void update();
+  /* upload everything queued, waiting for ring space if needed */
+  void finish();
+  inline const UploadStats &getStats() const { return stats; }
+  inline bool ownsCurrentContext() const { return currentGLContext.context == context.context; }
+
+private:
+  void queue(Upload upload);
+  void process(bool budgeted);
+  void createStaging();
+  void retire(bool wait);
+  size_t allocate(size_t size);
+  void submit(Upload &upload, size_t stagingOffset);
+  void fence();
+};
+
+// texture and mesh constructors queue their data here when set, on the GL thread
+inline UploadQueue *asyncUploads = nullptr;
+
+/* asyncUploads if its context is current, null on other contexts (e.g. a worker
+ * thread's own), which upload synchronously */
+inline UploadQueue *currentUploadQueue() {
+  return asyncUploads && asyncUploads->ownsCurrentContext() ? asyncUploads : nullptr;
+}
+
+} // namespace Optifuser
@@ -0,0 +1,36 @@
+#include "dynamic_resolution.h"
+#include <algorithm>
+#include <cmath>
+
+namespace Optifuser {
+
+DynamicResolution::DynamicResolution(const DynamicResolutionSettings &s)
+    : settings(s), scale(s.maxScale) {}
+
+bool DynamicResolution::update(float gpuMs) {
+  // timer results arrive a few frames late, frames without one are skipped
+  if (gpuMs <= 0.f) {
+    return false;
+  }
+  accumulatedMs += gpuMs;
+  if (++frames < std::max(settings.interval, 1u)) {
+    return false;
+  }
+  float averageMs = accumulatedMs / frames;
+  accumulatedMs = 0.f;
+  frames = 0;
+
+  float ideal = scale * std::sqrt(settings.targetMs / averageMs);
+  float next = std::clamp(scale + 0.5f * (ideal - scale), settings.minScale, settings.maxScale);
+  if (std::abs(next - scale) < settings.threshold &&
+      next != settings.minScale && next != settings.maxScale) {
+    return false;
+  }
+  if (next == scale) {
+    return false;
+  }
+  scale = next;
+  return true;
+}
+
+} // namespace Optifuser
@@ -0,0 +1,154 @@
+#include "egl_context.h"
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+
+#ifdef _USE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <vector>
+#endif
+
+namespace Optifuser {
+
+#ifdef _USE_EGL
+
+static EGLDisplay openDisplay() {
+  auto getPlatformDisplay =
+      (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+  auto queryDevices = (PFNEGLQUERYDEVICESEXTPROC)eglGetProcAddress("eglQueryDevicesEXT");
+
+  if (getPlatformDisplay && queryDevices) {
+    EGLint count = 0;
+    if (queryDevices(0, nullptr, &count) && count > 0) {
+      std::vector<EGLDeviceEXT> devices(count);
+      queryDevices(count, devices.data(), &count);
+      const char *env = std::getenv("OPTIFUSER_EGL_DEVICE");
+      int first = env ? std::atoi(env) : 0;
+      for (int i = first; i < count; ++i) {
+        EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_DEVICE_EXT, devices[i], nullptr);
+        if (display != EGL_NO_DISPLAY && eglInitialize(display, nullptr, nullptr)) {
+          return display;
+        }
+      }
+    }
+  }
+  if (getPlatformDisplay) {
+    EGLDisplay display =
+        getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+    if (display != EGL_NO_DISPLAY && eglInitialize(display, nullptr, nullptr)) {
+      return display;
+    }
+  }
+  EGLDisplay display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+  if (display != EGL_NO_DISPLAY && eglInitialize(display, nullptr, nullptr)) {
+    return display;
+  }
+  return EGL_NO_DISPLAY;
+}
+
+// one display for all contexts, opened on first use
+static EGLDisplay getDisplay() {
+  static EGLDisplay display = EGL_NO_DISPLAY;
+  static std::once_flag once;
+  std::call_once(once, [] {
+    display = openDisplay();
+    if (display == EGL_NO_DISPLAY) {
+      fprintf(stderr, "EGL: no usable display\n");
+    } else if (!eglBindAPI(EGL_OPENGL_API)) {
+      fprintf(stderr, "EGL: desktop OpenGL is not supported\n");
+      display = EGL_NO_DISPLAY;
+    }
+  });
+  return display;
+}
+
+std::unique_ptr<EGLHeadlessContext> EGLHeadlessContext::Create(const EGLHeadlessContext *share) {
+  EGLDisplay display = getDisplay();
+  if (display == EGL_NO_DISPLAY) {
+    return nullptr;
+  }
+  // the API binding is per thread
+  eglBindAPI(EGL_OPENGL_API);
+
+  const EGLint configAttribs[] = {EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE,
+                                  EGL_OPENGL_BIT, EGL_NONE};
+  EGLConfig config;
+  EGLint numConfigs = 0;
+  if (!eglChooseConfig(display, configAttribs, &config, 1, &numConfigs) || numConfigs == 0) {
+    fprintf(stderr, "EGL: no OpenGL config\n");
+    return nullptr;
+  }
+
+  // the shaders are GLSL 1.30, so ask for a compatibility profile
+  const EGLint contextAttribs[] = {EGL_CONTEXT_MAJOR_VERSION,
+                                   4,
+                                   EGL_CONTEXT_MINOR_VERSION,
+                                   5,
+                                   EGL_CONTEXT_OPENGL_PROFILE_MASK,
+                                   EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT,
+                                   EGL_NONE};
+  EGLContext shareContext = share ? (EGLContext)share->context : EGL_NO_CONTEXT;
+  EGLContext context = eglCreateContext(display, config, shareContext, contextAttribs);
+  if (context == EGL_NO_CONTEXT) {
+    context = eglCreateContext(display, config, shareContext, nullptr);
+  }
+  if (context == EGL_NO_CONTEXT) {
+    fprintf(stderr, "EGL: failed to create context, error 0x%x\n", eglGetError());
+    return nullptr;
+  }
+
+  std::unique_ptr<EGLHeadlessContext> result(new EGLHeadlessContext);
+  result->display = display;
+  result->context = context;
+  result->id.context = nextGLContextId++;
+  result->id.shareGroup = share ? share->id.shareGroup : result->id.context;
+  return result;
+}
+
+bool EGLHeadlessContext::IsAvailable() { return getDisplay() != EGL_NO_DISPLAY; }
+
+EGLHeadlessContext::~EGLHeadlessContext() {
+  if (eglGetCurrentContext() == (EGLContext)context) {
+    releaseCurrent();
+  }
+  eglDestroyContext((EGLDisplay)display, (EGLContext)context);
+}
+
+bool EGLHeadlessContext::makeCurrent() const {
+  // rendering only ever goes to framebuffer objects, so no surface is needed
+  if (!eglMakeCurrent((EGLDisplay)display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                      (EGLContext)context)) {
+    return false;
+  }
+  currentGLContext = id;
+  return true;
+}
+
+void EGLHeadlessContext::releaseCurrent() {
+  EGLDisplay display = eglGetCurrentDisplay();
+  if (display != EGL_NO_DISPLAY) {
+    eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  }
+  currentGLContext = {};
+}
+
+#else
+
+std::unique_ptr<EGLHeadlessContext> EGLHeadlessContext::Create(const EGLHeadlessContext *) {
+  fprintf(stderr, "EGL: compiled without EGL support\n");
+  return nullptr;
+}
+
+bool EGLHeadlessContext::IsAvailable() { return false; }
+
+EGLHeadlessContext::~EGLHeadlessContext() {}
+
+bool EGLHeadlessContext::makeCurrent() const { return false; }
+
+void EGLHeadlessContext::releaseCurrent() {}
+
+#endif
+
+} // namespace Optifuser
@@ -0,0 +1,67 @@
+#include "gl_commands.h"
+#include "profiler.h"
+
+namespace Optifuser {
+
+void GLCommandQueue::setRenderThread(std::thread::id id) {
+  renderThread = id;
+  renderShareGroup = currentGLContext.shareGroup;
+}
+
+bool GLCommandQueue::isRenderThread() const {
+  std::thread::id thread = renderThread;
+  if (thread == std::thread::id()) {
+    return true;
+  }
+  return thread == std::this_thread::get_id() &&
+         currentGLContext.shareGroup == renderShareGroup;
+}
+
+bool GLCommandQueue::isGLThread() const {
+  std::thread::id thread = renderThread;
+  return currentGLContext.context || thread == std::thread::id() ||
+         thread == std::this_thread::get_id();
+}
+
+void GLCommandQueue::push(std::function<void()> command) {
+  std::lock_guard<std::mutex> lock(mutex);
+  commands.push_back(std::move(command));
+}
+
+std::shared_ptr<GLCommandToken> GLCommandQueue::submit(std::function<void()> command) {
+  if (isGLThread()) {
+    command();
+    return nullptr;
+  }
+  auto token = std::make_shared<GLCommandToken>();
+  push([token, command = std::move(command)] {
+    if (!token->cancelled) {
+      command();
+      token->done = true;
+    }
+  });
+  return token;
+}
+
+void GLCommandQueue::execute() {
+  OPTIFUSER_PROFILE_SCOPE("GLCommandQueue::execute");
+  if (!isRenderThread()) {
+    return;
+  }
+  std::lock_guard<std::mutex> executeLock(executeMutex);
+  std::vector<std::function<void()>> batch;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    batch.swap(commands);
+  }
+  for (auto &command : batch) {
+    command();
+  }
+}
+
+size_t GLCommandQueue::pending() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return commands.size();
+}
+
+} // namespace Optifuser
@@ -0,0 +1,32 @@
+#include "gl_stats.h"
+
+namespace Optifuser {
+
+GLCounters &GLCounters::operator+=(const GLCounters &other) {
+  drawCalls += other.drawCalls;
+  triangles += other.triangles;
+  programSwitches += other.programSwitches;
+  textureBinds += other.textureBinds;
+  uniformUploads += other.uniformUploads;
+  bufferUploads += other.bufferUploads;
+  uploadBytes += other.uploadBytes;
+  readbacks += other.readbacks;
+  readbackBytes += other.readbackBytes;
+  return *this;
+}
+
+GLCounters GLCounters::operator-(const GLCounters &other) const {
+  GLCounters result;
+  result.drawCalls = drawCalls - other.drawCalls;
+  result.triangles = triangles - other.triangles;
+  result.programSwitches = programSwitches - other.programSwitches;
+  result.textureBinds = textureBinds - other.textureBinds;
+  result.uniformUploads = uniformUploads - other.uniformUploads;
+  result.bufferUploads = bufferUploads - other.bufferUploads;
+  result.uploadBytes = uploadBytes - other.uploadBytes;
+  result.readbacks = readbacks - other.readbacks;
+  result.readbackBytes = readbackBytes - other.readbackBytes;
+  return result;
+}
+
+} // namespace Optifuser
@@ -0,0 +1,91 @@
+#include "gpu_timer.h"
+#include <algorithm>
+
+namespace Optifuser {
+
+GpuTimer::GpuTimer(const std::vector<std::string> &names) {
+  passes.resize(names.size());
+  for (size_t i = 0; i < names.size(); ++i) {
+    passes[i].name = names[i];
+    glGenQueries(BUFFERED_FRAMES, passes[i].queries);
+  }
+}
+
+GpuTimer::~GpuTimer() {
+  for (auto &p : passes) {
+    glDeleteQueries(BUFFERED_FRAMES, p.queries);
+  }
+}
+
+void GpuTimer::beginFrame() {
+  frame = (frame + 1) % BUFFERED_FRAMES;
+  for (auto &p : passes) {
+    if (!p.pending[frame]) {
+      continue;
+    }
+    GLint available = 0;
+    glGetQueryObjectiv(p.queries[frame], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) {
+      continue;
+    }
+    GLuint64 ns = 0;
+    glGetQueryObjectui64v(p.queries[frame], GL_QUERY_RESULT, &ns);
+    p.pending[frame] = false;
+    // the first frame is dominated by driver warm-up (some drivers even report garbage)
+    if (!p.warmedUp) {
+      p.warmedUp = true;
+      continue;
+    }
+    p.last = ns * 1e-6f;
+    if (p.history.size() < HISTORY_SIZE) {
+      p.history.push_back(p.last);
+    } else {
+      p.history[p.next] = p.last;
+    }
+    p.next = (p.next + 1) % HISTORY_SIZE;
+  }
+}
+
+void GpuTimer::begin(uint32_t pass) {
+  if (activePass >= 0 || passes[pass].pending[frame]) {
+    return;
+  }
+  glBeginQuery(GL_TIME_ELAPSED, passes[pass].queries[frame]);
+  activePass = pass;
+}
+
+void GpuTimer::end() {
+  if (activePass < 0) {
+    return;
+  }
+  glEndQuery(GL_TIME_ELAPSED);
+  passes[activePass].pending[frame] = true;
+  activePass = -1;
+}
+
+PassTimings GpuTimer::getTimings() const {
+  PassTimings timings;
+  for (auto &p : passes) {
+    PassTiming t;
+    t.name = p.name;
+    t.samples = p.history.size();
+    if (!p.history.empty()) {
+      std::vector<float> sorted = p.history;
+      std::sort(sorted.begin(), sorted.end());
+      float sum = 0.f;
+      for (float ms : sorted) {
+        sum += ms;
+      }
+      t.lastMs = p.last;
+      t.averageMs = sum / sorted.size();
+      t.p50Ms = sorted[sorted.size() / 2];
+      t.p95Ms = sorted[std::min(sorted.size() - 1, sorted.size() * 95 / 100)];
+      t.maxMs = sorted.back();
+    }
+    timings.totalAverageMs += t.averageMs;
+    timings.passes.push_back(t);
+  }
+  return timings;
+}
+
+} // namespace Optifuser
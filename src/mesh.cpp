@@ -1,31 +1,54 @@
 #include "mesh.h"
+#include "gl_context.h"
+#include "gl_stats.h"
 
 namespace Optifuser {
-MeshBase::MeshBase() : vao(0), vbo(0), ebo(0) {}
+MeshBase::MeshBase() {}
 
-MeshBase::~MeshBase() {
+static void releaseMesh(GLuint vao, GLuint vbo, GLuint ebo, uint32_t vaoContext,
+                        const std::vector<std::pair<uint32_t, GLuint>> &contextVaos) {
   if (vbo)
     glDeleteBuffers(1, &vbo);
   if (ebo)
     glDeleteBuffers(1, &ebo);
-  if (vao)
+  if (vao && vaoContext == currentGLContext.context)
     glDeleteVertexArrays(1, &vao);
+  // vertex arrays of other contexts can only be deleted there and are left to context teardown
+  for (auto [context, contextVao] : contextVaos) {
+    if (context == currentGLContext.context) {
+      glDeleteVertexArrays(1, &contextVao);
+    }
+  }
 }
 
-MeshBase::MeshBase(const std::vector<Vertex> &inVertices,
-                   const std::vector<GLuint> &inIndices) {
-  vertices = inVertices;
-  indices = inIndices;
-
-  glGenVertexArrays(1, &vao);
-  glBindVertexArray(vao);
+MeshBase::~MeshBase() {
+  if (glCommands.isGLThread()) {
+    if (glCreation) {
+      glCreation->cancelled = true;
+    }
+    releaseMesh(vao, vbo, ebo, vaoContext, contextVaos);
+    return;
+  }
+  glCommands.synchronize([this] {
+    if (glCreation) {
+      glCreation->cancelled = true;
+    }
+    if (vao || vbo || ebo) {
+      glCommands.push([vao = vao, vbo = vbo, ebo = ebo, vaoContext = vaoContext,
+                       contextVaos = contextVaos, upload = pendingUpload] {
+        if (upload) {
+          upload->cancelled = true;
+        }
+        releaseMesh(vao, vbo, ebo, vaoContext, contextVaos);
+      });
+    }
+    pendingUpload = nullptr;
+  });
+}
 
-  glGenBuffers(1, &vbo);
+void MeshBase::setupVertexArray() const {
   glBindBuffer(GL_ARRAY_BUFFER, vbo);
 
-  glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0],
-               GL_STATIC_DRAW);
-
   glEnableVertexAttribArray(0);
   glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)0);
 
@@ -45,13 +68,67 @@ MeshBase::MeshBase(const std::vector<Vertex> &inVertices,
   glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
                         (void *)(11 * sizeof(float)));
 
-  glGenBuffers(1, &ebo);
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint),
-               &indices[0], GL_STATIC_DRAW);
 }
 
-GLuint MeshBase::getVAO() const { return vao; }
+void MeshBase::uploadBuffer(GLenum target, GLuint buffer, const void *data, size_t size) {
+  UploadQueue *uploads = currentUploadQueue();
+  if (!uploads) {
+    glBufferData(target, size, data, GL_STATIC_DRAW);
+    ++glCounters.bufferUploads;
+    glCounters.uploadBytes += size;
+    return;
+  }
+  glBufferData(target, size, nullptr, GL_STATIC_DRAW);
+  if (!pendingUpload) {
+    pendingUpload = std::make_shared<UploadTicket>();
+  }
+  auto bytes = static_cast<const uint8_t *>(data);
+  uploads->queueBuffer(pendingUpload, buffer, 0, std::vector<uint8_t>(bytes, bytes + size));
+}
+
+MeshBase::MeshBase(const std::vector<Vertex> &inVertices,
+                   const std::vector<GLuint> &inIndices) {
+  vertices = inVertices;
+  indices = inIndices;
+  computeBounds();
+
+  glCreation = glCommands.submit([this] {
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+
+    glGenBuffers(1, &vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+
+    uploadBuffer(GL_ARRAY_BUFFER, vbo, vertices.data(), vertices.size() * sizeof(Vertex));
+
+    glGenBuffers(1, &ebo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    uploadBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo, indices.data(), indices.size() * sizeof(GLuint));
+    setupVertexArray();
+    vaoContext = currentGLContext.context;
+  });
+}
+
+GLuint MeshBase::getVAO() const {
+  uint32_t context = currentGLContext.context;
+  if (context == vaoContext) {
+    return vao;
+  }
+  // the buffers are shared with the other contexts of the share group, vertex arrays are not
+  std::lock_guard<std::mutex> lock(contextVaoMutex);
+  for (auto [c, contextVao] : contextVaos) {
+    if (c == context) {
+      return contextVao;
+    }
+  }
+  GLuint contextVao;
+  glGenVertexArrays(1, &contextVao);
+  glBindVertexArray(contextVao);
+  setupVertexArray();
+  contextVaos.push_back({context, contextVao});
+  return contextVao;
+}
 GLuint MeshBase::getVBO() const { return vbo; }
 GLuint MeshBase::getEBO() const { return ebo; }
 
@@ -59,6 +136,18 @@ const std::vector<Vertex> &MeshBase::getVertices() const { return vertices; }
 
 const std::vector<GLuint> &MeshBase::getIndices() const { return indices; }
 
+void MeshBase::computeBounds() {
+  if (vertices.empty()) {
+    return;
+  }
+  aabbMin = aabbMax = vertices[0].position;
+  for (auto &v : vertices) {
+    aabbMin = glm::min(aabbMin, v.position);
+    aabbMax = glm::max(aabbMax, v.position);
+  }
+  hasBounds = true;
+}
+
 TriangleMesh::TriangleMesh(const std::vector<Vertex> &inVertices,
                            const std::vector<GLuint> &inIndices,
                            bool recalcNormal) {
@@ -67,39 +156,68 @@ TriangleMesh::TriangleMesh(const std::vector<Vertex> &inVertices,
 
   if (recalcNormal)
     recalculateNormals();
+  upload();
+}
 
-  glGenVertexArrays(1, &vao);
-  glBindVertexArray(vao);
-
-  glGenBuffers(1, &vbo);
-  glBindBuffer(GL_ARRAY_BUFFER, vbo);
-
-  glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0],
-               GL_STATIC_DRAW);
-
-  glEnableVertexAttribArray(0);
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)0);
-
-  glEnableVertexAttribArray(1);
-  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                        (void *)(3 * sizeof(float)));
+TriangleMesh::TriangleMesh(const std::vector<Vertex> &inVertices,
+                           const std::vector<GLuint> &inIndices, const std::vector<MeshLod> &lods,
+                           bool recalcNormal) {
+  vertices = inVertices;
+  indices = inIndices;
+  for (auto &lod : lods) {
+    lodRanges.push_back({static_cast<uint32_t>(indices.size() + lodIndices.size()),
+                         static_cast<uint32_t>(lod.indices.size()), lod.error});
+    lodIndices.insert(lodIndices.end(), lod.indices.begin(), lod.indices.end());
+  }
 
-  glEnableVertexAttribArray(2);
-  glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                        (void *)(6 * sizeof(float)));
+  if (recalcNormal)
+    recalculateNormals();
+  upload();
+}
 
-  glEnableVertexAttribArray(3);
-  glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                        (void *)(8 * sizeof(float)));
+void TriangleMesh::upload() {
+  computeBounds();
+  lodRanges.insert(lodRanges.begin(), {0, static_cast<uint32_t>(indices.size()), 0.f});
+
+  std::vector<GLushort> shortIndices;
+  std::vector<GLuint> allIndices;
+  if (vertices.size() <= 0x10000) {
+    indexType = GL_UNSIGNED_SHORT;
+    shortIndices.assign(indices.begin(), indices.end());
+    shortIndices.insert(shortIndices.end(), lodIndices.begin(), lodIndices.end());
+  } else {
+    indexType = GL_UNSIGNED_INT;
+    allIndices = indices;
+    allIndices.insert(allIndices.end(), lodIndices.begin(), lodIndices.end());
+  }
 
-  glEnableVertexAttribArray(4);
-  glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                        (void *)(11 * sizeof(float)));
+  glCreation = glCommands.submit(
+      [this, shortIndices = std::move(shortIndices), allIndices = std::move(allIndices)] {
+        glGenVertexArrays(1, &vao);
+        glBindVertexArray(vao);
+
+        glGenBuffers(1, &vbo);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+
+        uploadBuffer(GL_ARRAY_BUFFER, vbo, vertices.data(), vertices.size() * sizeof(Vertex));
+
+        glGenBuffers(1, &ebo);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+        if (indexType == GL_UNSIGNED_SHORT) {
+          uploadBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo, shortIndices.data(),
+                       shortIndices.size() * sizeof(GLushort));
+        } else {
+          uploadBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo, allIndices.data(),
+                       allIndices.size() * sizeof(GLuint));
+        }
+        setupVertexArray();
+        vaoContext = currentGLContext.context;
+      });
+}
 
-  glGenBuffers(1, &ebo);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint),
-               &indices[0], GL_STATIC_DRAW);
+size_t TriangleMesh::getGpuMemorySize() const {
+  size_t indexSize = indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+  return vertices.size() * sizeof(Vertex) + (indices.size() + lodIndices.size()) * indexSize;
 }
 
 void TriangleMesh::recalculateNormals() {
@@ -133,7 +251,33 @@ void TriangleMesh::recalculateNormals() {
 
 void TriangleMesh::draw() const {
   glBindVertexArray(getVAO());
-  glDrawElements(GL_TRIANGLES, getIndices().size(), GL_UNSIGNED_INT, 0);
+  glDrawElements(GL_TRIANGLES, getIndices().size(), indexType, 0);
+  ++glCounters.drawCalls;
+  glCounters.triangles += getIndices().size() / 3;
+}
+
+void TriangleMesh::drawLod(uint32_t level) const {
+  auto &range = lodRanges[std::min<size_t>(level, lodRanges.size() - 1)];
+  glBindVertexArray(getVAO());
+  size_t indexSize = indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+  glDrawElements(GL_TRIANGLES, range.indexCount, indexType,
+                 (void *)(range.indexOffset * indexSize));
+  ++glCounters.drawCalls;
+  glCounters.triangles += range.indexCount / 3;
+}
+
+uint32_t TriangleMesh::getLodCount() const { return lodRanges.size(); }
+
+float TriangleMesh::getLodError(uint32_t level) const {
+  return lodRanges[std::min<size_t>(level, lodRanges.size() - 1)].error;
+}
+
+std::span<const GLuint> TriangleMesh::getLodIndices(uint32_t level) const {
+  auto &range = lodRanges[std::min<size_t>(level, lodRanges.size() - 1)];
+  if (range.indexOffset == 0) {
+    return {indices.data(), range.indexCount};
+  }
+  return {lodIndices.data() + (range.indexOffset - indices.size()), range.indexCount};
 }
 
 std::shared_ptr<TriangleMesh> NewCubeMesh() {
@@ -152,38 +296,56 @@ std::shared_ptr<TriangleMesh> NewCubeMesh() {
 void LineMesh::draw() const {
   glBindVertexArray(getVAO());
   glDrawElements(GL_LINES, getIndices().size(), GL_UNSIGNED_INT, 0);
+  ++glCounters.drawCalls;
 }
 
 DynamicMesh::DynamicMesh(int maxvcount)
     : vertexCount(0), maxVertexCount(maxvcount) {
 
-  glGenVertexArrays(1, &vao);
-  glBindVertexArray(vao);
-  glGenBuffers(1, &vbo);
-  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  glCreation = glCommands.submit([this] {
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+    glGenBuffers(1, &vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
 
-  glBufferData(GL_ARRAY_BUFFER, maxVertexCount * 6 * sizeof(float), NULL,
-               GL_DYNAMIC_DRAW);
-  glEnableVertexAttribArray(0);
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void *)0);
+    glBufferData(GL_ARRAY_BUFFER, maxVertexCount * 6 * sizeof(float), NULL,
+                 GL_DYNAMIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void *)0);
 
-  glEnableVertexAttribArray(1);
-  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float),
-                        (void *)(3 * sizeof(float)));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float),
+                          (void *)(3 * sizeof(float)));
 
-  glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  });
 }
 
 DynamicMesh::~DynamicMesh() {
-  if (vbo)
-    glDeleteBuffers(1, &vbo);
-  if (vao)
-    glDeleteVertexArrays(1, &vao);
+  if (glCommands.isGLThread()) {
+    if (glCreation) {
+      glCreation->cancelled = true;
+    }
+    releaseMesh(vao, vbo, 0, currentGLContext.context, {});
+    return;
+  }
+  glCommands.synchronize([this] {
+    if (glCreation) {
+      glCreation->cancelled = true;
+    }
+    if (vao || vbo) {
+      glCommands.push([vao = vao, vbo = vbo] {
+        releaseMesh(vao, vbo, 0, currentGLContext.context, {});
+      });
+    }
+  });
 }
 
 void DynamicMesh::draw() const {
   glBindVertexArray(getVAO());
   glDrawArrays(GL_TRIANGLES, 0, vertexCount);
+  ++glCounters.drawCalls;
+  glCounters.triangles += vertexCount / 3;
 }
 
 void DynamicMesh::setVertexCount(int vcount) {
@@ -0,0 +1,207 @@
+#include "mesh_optimizer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+namespace Optifuser {
+
+size_t WeldVertices(std::vector<Vertex> &vertices, std::vector<GLuint> &indices) {
+  struct Hash {
+    const Vertex *data;
+    size_t operator()(GLuint i) const {
+      // FNV-1a over the raw vertex
+      auto bytes = reinterpret_cast<const unsigned char *>(data + i);
+      size_t h = 14695981039346656037ull;
+      for (size_t k = 0; k < sizeof(Vertex); ++k) {
+        h = (h ^ bytes[k]) * 1099511628211ull;
+      }
+      return h;
+    }
+  };
+  struct Equal {
+    const Vertex *data;
+    bool operator()(GLuint a, GLuint b) const {
+      return std::memcmp(data + a, data + b, sizeof(Vertex)) == 0;
+    }
+  };
+  std::unordered_map<GLuint, GLuint, Hash, Equal> unique(vertices.size(), Hash{vertices.data()},
+                                                         Equal{vertices.data()});
+
+  std::vector<GLuint> remap(vertices.size());
+  std::vector<Vertex> welded;
+  welded.reserve(vertices.size());
+  for (GLuint i = 0; i < vertices.size(); ++i) {
+    auto [it, inserted] = unique.try_emplace(i, welded.size());
+    if (inserted) {
+      welded.push_back(vertices[i]);
+    }
+    remap[i] = it->second;
+  }
+  for (auto &i : indices) {
+    i = remap[i];
+  }
+  size_t removed = vertices.size() - welded.size();
+  vertices = std::move(welded);
+  return removed;
+}
+
+static constexpr int CACHE_SIZE = 32;
+static constexpr float CACHE_DECAY_POWER = 1.5f;
+static constexpr float LAST_TRIANGLE_SCORE = 0.75f;
+static constexpr float VALENCE_BOOST_SCALE = 2.f;
+static constexpr float VALENCE_BOOST_POWER = 0.5f;
+
+static float vertexScore(int cachePosition, uint32_t remainingTriangles) {
+  if (remainingTriangles == 0) {
+    return -1.f;
+  }
+  float score = 0.f;
+  if (cachePosition >= 0) {
+    // the vertices of the last triangle get a fixed score to avoid preferring strips
+    score = cachePosition < 3 ? LAST_TRIANGLE_SCORE
+                              : std::pow(1.f - (cachePosition - 3) / float(CACHE_SIZE - 3),
+                                         CACHE_DECAY_POWER);
+  }
+  return score + VALENCE_BOOST_SCALE * std::pow(float(remainingTriangles), -VALENCE_BOOST_POWER);
+}
+
+void OptimizeVertexCache(std::vector<GLuint> &indices, size_t vertexCount) {
+  size_t triangleCount = indices.size() / 3;
+  if (triangleCount < 2) {
+    return;
+  }
+
+  // vertex -> triangle adjacency, the live triangles of v are
+  // adjacency[offsets[v], offsets[v] + remaining[v])
+  std::vector<uint32_t> remaining(vertexCount, 0);
+  std::vector<uint32_t> offsets(vertexCount + 1, 0);
+  for (GLuint v : indices) {
+    ++remaining[v];
+  }
+  for (size_t v = 0; v < vertexCount; ++v) {
+    offsets[v + 1] = offsets[v] + remaining[v];
+  }
+  std::vector<uint32_t> adjacency(indices.size());
+  {
+    std::vector<uint32_t> cursor(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < triangleCount * 3; ++i) {
+      adjacency[cursor[indices[i]]++] = i / 3;
+    }
+  }
+
+  std::vector<int> cachePosition(vertexCount, -1);
+  std::vector<float> vScore(vertexCount);
+  for (size_t v = 0; v < vertexCount; ++v) {
+    vScore[v] = vertexScore(-1, remaining[v]);
+  }
+  std::vector<float> tScore(triangleCount);
+  std::vector<bool> emitted(triangleCount, false);
+  for (size_t t = 0; t < triangleCount; ++t) {
+    tScore[t] = vScore[indices[3 * t]] + vScore[indices[3 * t + 1]] + vScore[indices[3 * t + 2]];
+  }
+
+  std::vector<GLuint> result;
+  result.reserve(triangleCount * 3);
+  std::vector<GLuint> cache, newCache;
+  size_t nextUnemitted = 0;
+  int64_t best = -1;
+  while (result.size() < triangleCount * 3) {
+    if (best < 0) {
+      // nothing adjacent to the cache, continue with the next triangle in input order
+      while (emitted[nextUnemitted]) {
+        ++nextUnemitted;
+      }
+      best = nextUnemitted;
+    }
+    emitted[best] = true;
+    const GLuint *tri = &indices[3 * best];
+
+    newCache.clear();
+    for (int k = 0; k < 3; ++k) {
+      GLuint v = tri[k];
+      result.push_back(v);
+      if (std::find(newCache.begin(), newCache.end(), v) == newCache.end()) {
+        newCache.push_back(v);
+      }
+      uint32_t *begin = &adjacency[offsets[v]];
+      uint32_t *end = begin + remaining[v];
+      std::iter_swap(std::find(begin, end, (uint32_t)best), end - 1);
+      --remaining[v];
+    }
+    for (GLuint v : cache) {
+      if (v != tri[0] && v != tri[1] && v != tri[2]) {
+        newCache.push_back(v);
+      }
+    }
+
+    for (size_t i = 0; i < newCache.size(); ++i) {
+      GLuint v = newCache[i];
+      cachePosition[v] = i < CACHE_SIZE ? i : -1;
+      float score = vertexScore(cachePosition[v], remaining[v]);
+      float delta = score - vScore[v];
+      vScore[v] = score;
+      for (uint32_t k = 0; k < remaining[v]; ++k) {
+        tScore[adjacency[offsets[v] + k]] += delta;
+      }
+    }
+    if (newCache.size() > CACHE_SIZE) {
+      newCache.resize(CACHE_SIZE);
+    }
+    std::swap(cache, newCache);
+
+    best = -1;
+    float bestScore = -1.f;
+    for (GLuint v : cache) {
+      for (uint32_t k = 0; k < remaining[v]; ++k) {
+        uint32_t t = adjacency[offsets[v] + k];
+        if (tScore[t] > bestScore) {
+          bestScore = tScore[t];
+          best = t;
+        }
+      }
+    }
+  }
+  indices = std::move(result);
+}
+
+void OptimizeVertexFetch(std::vector<Vertex> &vertices, std::vector<GLuint> &indices,
+                         std::vector<MeshLod> &lods) {
+  constexpr GLuint UNUSED = ~0u;
+  std::vector<GLuint> remap(vertices.size(), UNUSED);
+  std::vector<Vertex> reordered;
+  reordered.reserve(vertices.size());
+
+  auto visit = [&](std::vector<GLuint> &list) {
+    for (auto &i : list) {
+      if (remap[i] == UNUSED) {
+        remap[i] = reordered.size();
+        reordered.push_back(vertices[i]);
+      }
+      i = remap[i];
+    }
+  };
+  visit(indices);
+  for (auto &lod : lods) {
+    visit(lod.indices);
+  }
+  vertices = std::move(reordered);
+}
+
+float ComputeACMR(const std::vector<GLuint> &indices, size_t vertexCount, uint32_t cacheSize) {
+  if (indices.size() < 3) {
+    return 0.f;
+  }
+  std::vector<uint32_t> insertedAt(vertexCount, 0);
+  uint32_t time = cacheSize + 1;
+  size_t misses = 0;
+  for (GLuint v : indices) {
+    if (time - insertedAt[v] > cacheSize) {
+      insertedAt[v] = time++;
+      ++misses;
+    }
+  }
+  return float(misses) / (indices.size() / 3);
+}
+
+} // namespace Optifuser
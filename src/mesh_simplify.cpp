@@ -0,0 +1,405 @@
+#include "mesh_simplify.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+namespace Optifuser {
+
+namespace {
+
+constexpr double BORDER_WEIGHT = 10.0;
+constexpr uint32_t MIN_LOD_TRIANGLES = 32;
+constexpr float MAX_LOD_ERROR = 0.25f;
+
+struct Quadric {
+  // upper triangle of the symmetric 4x4 error matrix
+  double a00 = 0, a01 = 0, a02 = 0, a03 = 0;
+  double a11 = 0, a12 = 0, a13 = 0;
+  double a22 = 0, a23 = 0;
+  double a33 = 0;
+  double weight = 0;
+
+  static Quadric FromPlane(const glm::dvec3 &n, double d, double w) {
+    Quadric q;
+    q.a00 = n.x * n.x * w;
+    q.a01 = n.x * n.y * w;
+    q.a02 = n.x * n.z * w;
+    q.a03 = n.x * d * w;
+    q.a11 = n.y * n.y * w;
+    q.a12 = n.y * n.z * w;
+    q.a13 = n.y * d * w;
+    q.a22 = n.z * n.z * w;
+    q.a23 = n.z * d * w;
+    q.a33 = d * d * w;
+    q.weight = w;
+    return q;
+  }
+
+  Quadric &operator+=(const Quadric &q) {
+    a00 += q.a00;
+    a01 += q.a01;
+    a02 += q.a02;
+    a03 += q.a03;
+    a11 += q.a11;
+    a12 += q.a12;
+    a13 += q.a13;
+    a22 += q.a22;
+    a23 += q.a23;
+    a33 += q.a33;
+    weight += q.weight;
+    return *this;
+  }
+
+  // weighted mean squared distance of p to the accumulated planes
+  double error(const glm::vec3 &p) const {
+    double x = p.x, y = p.y, z = p.z;
+    double e = a00 * x * x + 2 * a01 * x * y + 2 * a02 * x * z + 2 * a03 * x + a11 * y * y +
+               2 * a12 * y * z + 2 * a13 * y + a22 * z * z + 2 * a23 * z + a33;
+    return weight > 0 ? std::abs(e) / weight : 0.0;
+  }
+};
+
+struct PositionHash {
+  size_t operator()(const glm::vec3 &p) const {
+    uint32_t h[3];
+    std::memcpy(h, &p, sizeof(h));
+    return (h[0] * 73856093u) ^ (h[1] * 19349663u) ^ (h[2] * 83492791u);
+  }
+};
+
+struct Collapse {
+  GLuint from;
+  GLuint to;
+  double cost;
+};
+
+inline uint64_t edgeKey(GLuint a, GLuint b) {
+  return a < b ? (uint64_t(a) << 32) | b : (uint64_t(b) << 32) | a;
+}
+
+} // namespace
+
+std::vector<GLuint> SimplifyMesh(const std::vector<Vertex> &vertices,
+                                 const std::vector<GLuint> &indices, size_t targetIndexCount,
+                                 float targetError, float *resultError) {
+  if (resultError) {
+    *resultError = 0.f;
+  }
+  size_t vertexCount = vertices.size();
+  if (indices.size() <= targetIndexCount || vertexCount == 0) {
+    return indices;
+  }
+
+  // vertices sharing a position (attribute seams) are collapsed as one
+  std::vector<GLuint> canonical(vertexCount);
+  {
+    std::unordered_map<glm::vec3, GLuint, PositionHash> table;
+    table.reserve(vertexCount);
+    for (GLuint v = 0; v < vertexCount; ++v) {
+      const glm::vec3 &p = vertices[v].position;
+      // adding zero turns -0.f into 0.f so equal positions hash equally
+      auto it = table.try_emplace(glm::vec3(p.x + 0.f, p.y + 0.f, p.z + 0.f), v).first;
+      canonical[v] = it->second;
+    }
+  }
+  std::vector<GLuint> wedgeStart(vertexCount + 1, 0);
+  std::vector<GLuint> wedges(vertexCount);
+  for (GLuint v = 0; v < vertexCount; ++v) {
+    wedgeStart[canonical[v] + 1]++;
+  }
+  for (size_t i = 0; i < vertexCount; ++i) {
+    wedgeStart[i + 1] += wedgeStart[i];
+  }
+  {
+    std::vector<GLuint> fill(wedgeStart.begin(), wedgeStart.end() - 1);
+    for (GLuint v = 0; v < vertexCount; ++v) {
+      wedges[fill[canonical[v]]++] = v;
+    }
+  }
+
+  glm::vec3 lo = vertices[0].position, hi = vertices[0].position;
+  for (auto &v : vertices) {
+    lo = glm::min(lo, v.position);
+    hi = glm::max(hi, v.position);
+  }
+  double radius = glm::length(hi - lo) * 0.5;
+  if (radius <= 0) {
+    return indices;
+  }
+  double errorLimit = targetError * radius * targetError * radius;
+
+  auto position = [&](GLuint c) { return glm::dvec3(vertices[c].position); };
+
+  // accumulate face and border quadrics
+  std::vector<Quadric> quadrics(vertexCount);
+  std::unordered_map<uint64_t, uint32_t> edgeUse;
+  edgeUse.reserve(indices.size());
+  for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+    GLuint c[3] = {canonical[indices[t]], canonical[indices[t + 1]], canonical[indices[t + 2]]};
+    if (c[0] == c[1] || c[1] == c[2] || c[0] == c[2]) {
+      continue;
+    }
+    for (int e = 0; e < 3; ++e) {
+      edgeUse[edgeKey(c[e], c[(e + 1) % 3])]++;
+    }
+  }
+  for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+    GLuint c[3] = {canonical[indices[t]], canonical[indices[t + 1]], canonical[indices[t + 2]]};
+    if (c[0] == c[1] || c[1] == c[2] || c[0] == c[2]) {
+      continue;
+    }
+    glm::dvec3 p[3] = {position(c[0]), position(c[1]), position(c[2])};
+    glm::dvec3 n = glm::cross(p[1] - p[0], p[2] - p[0]);
+    double area = glm::length(n);
+    if (area <= 0) {
+      continue;
+    }
+    n /= area;
+    Quadric q = Quadric::FromPlane(n, -glm::dot(n, p[0]), area * 0.5);
+    for (int i = 0; i < 3; ++i) {
+      quadrics[c[i]] += q;
+    }
+
+    // keep open borders in place with planes perpendicular to the face
+    for (int e = 0; e < 3; ++e) {
+      if (edgeUse[edgeKey(c[e], c[(e + 1) % 3])] != 1) {
+        continue;
+      }
+      glm::dvec3 edge = p[(e + 1) % 3] - p[e];
+      double length = glm::length(edge);
+      if (length <= 0) {
+        continue;
+      }
+      glm::dvec3 m = glm::normalize(glm::cross(edge, n));
+      Quadric b = Quadric::FromPlane(m, -glm::dot(m, p[e]), length * length * BORDER_WEIGHT);
+      quadrics[c[e]] += b;
+      quadrics[c[(e + 1) % 3]] += b;
+    }
+  }
+
+  std::vector<GLuint> parent(vertexCount);
+  for (GLuint v = 0; v < vertexCount; ++v) {
+    parent[v] = v;
+  }
+  auto find = [&](GLuint v) {
+    GLuint root = v;
+    while (parent[root] != root) {
+      root = parent[root];
+    }
+    while (parent[v] != root) {
+      GLuint next = parent[v];
+      parent[v] = root;
+      v = next;
+    }
+    return root;
+  };
+
+  std::vector<GLuint> tris = indices;
+  std::vector<GLuint> current;
+  std::vector<GLuint> adjStart, adjacency;
+  std::vector<uint64_t> edges;
+  std::vector<uint8_t> border(vertexCount), locked(vertexCount);
+  std::vector<Collapse> candidates;
+  double maxError = 0;
+
+  while (true) {
+    // drop triangles degenerated by the previous pass
+    current.clear();
+    size_t kept = 0;
+    for (size_t t = 0; t + 2 < tris.size(); t += 3) {
+      GLuint a = find(canonical[tris[t]]);
+      GLuint b = find(canonical[tris[t + 1]]);
+      GLuint c = find(canonical[tris[t + 2]]);
+      if (a == b || b == c || a == c) {
+        continue;
+      }
+      current.insert(current.end(), {a, b, c});
+      tris[kept++] = tris[t];
+      tris[kept++] = tris[t + 1];
+      tris[kept++] = tris[t + 2];
+    }
+    tris.resize(kept);
+    size_t indexCount = current.size();
+    if (indexCount <= targetIndexCount) {
+      break;
+    }
+
+    adjStart.assign(vertexCount + 1, 0);
+    for (GLuint v : current) {
+      adjStart[v + 1]++;
+    }
+    for (size_t i = 0; i < vertexCount; ++i) {
+      adjStart[i + 1] += adjStart[i];
+    }
+    adjacency.resize(current.size());
+    {
+      std::vector<GLuint> fill(adjStart.begin(), adjStart.end() - 1);
+      for (size_t i = 0; i < current.size(); ++i) {
+        adjacency[fill[current[i]]++] = i / 3;
+      }
+    }
+
+    // edges used by a single triangle are borders
+    edges.clear();
+    for (size_t t = 0; t < current.size(); t += 3) {
+      for (int e = 0; e < 3; ++e) {
+        edges.push_back(edgeKey(current[t + e], current[t + (e + 1) % 3]));
+      }
+    }
+    std::sort(edges.begin(), edges.end());
+    std::fill(border.begin(), border.end(), 0);
+    for (size_t i = 0; i < edges.size();) {
+      size_t j = i + 1;
+      while (j < edges.size() && edges[j] == edges[i]) {
+        ++j;
+      }
+      if (j - i == 1) {
+        border[edges[i] >> 32] = border[edges[i] & 0xffffffff] = 1;
+      }
+      i = j;
+    }
+
+    candidates.clear();
+    for (size_t i = 0; i < edges.size();) {
+      size_t j = i + 1;
+      while (j < edges.size() && edges[j] == edges[i]) {
+        ++j;
+      }
+      GLuint a = edges[i] >> 32;
+      GLuint b = edges[i] & 0xffffffff;
+      bool borderEdge = j - i == 1;
+      // border vertices may only slide along the border
+      bool ab = !border[a] || (border[b] && borderEdge);
+      bool ba = !border[b] || (border[a] && borderEdge);
+      Quadric q = quadrics[a];
+      q += quadrics[b];
+      double costAB = ab ? q.error(vertices[b].position) : INFINITY;
+      double costBA = ba ? q.error(vertices[a].position) : INFINITY;
+      if (ab || ba) {
+        if (costAB <= costBA) {
+          candidates.push_back({a, b, costAB});
+        } else {
+          candidates.push_back({b, a, costBA});
+        }
+      }
+      i = j;
+    }
+    std::sort(candidates.begin(), candidates.end(),
+              [](const Collapse &x, const Collapse &y) { return x.cost < y.cost; });
+
+    std::fill(locked.begin(), locked.end(), 0);
+    size_t collapses = 0;
+    for (auto &collapse : candidates) {
+      if (indexCount <= targetIndexCount || collapse.cost > errorLimit) {
+        break;
+      }
+      GLuint from = collapse.from;
+      GLuint to = collapse.to;
+      if (locked[from] || locked[to]) {
+        continue;
+      }
+
+      // reject collapses that flip or squash neighbouring triangles
+      bool safe = true;
+      for (GLuint k = adjStart[from]; k < adjStart[from + 1] && safe; ++k) {
+        const GLuint *tri = &current[adjacency[k] * 3];
+        if (tri[0] == to || tri[1] == to || tri[2] == to) {
+          continue;
+        }
+        glm::dvec3 p[3], q[3];
+        for (int i = 0; i < 3; ++i) {
+          p[i] = position(tri[i]);
+          q[i] = tri[i] == from ? position(to) : p[i];
+        }
+        glm::dvec3 n0 = glm::cross(p[1] - p[0], p[2] - p[0]);
+        glm::dvec3 n1 = glm::cross(q[1] - q[0], q[2] - q[0]);
+        double l0 = glm::length(n0), l1 = glm::length(n1);
+        if (l1 <= 0 || glm::dot(n0, n1) <= 0.25 * l0 * l1) {
+          safe = false;
+        }
+      }
+      if (!safe) {
+        continue;
+      }
+
+      parent[from] = to;
+      quadrics[to] += quadrics[from];
+      for (GLuint k = adjStart[from]; k < adjStart[from + 1]; ++k) {
+        const GLuint *tri = &current[adjacency[k] * 3];
+        if (tri[0] == to || tri[1] == to || tri[2] == to) {
+          indexCount -= 3;
+        }
+        locked[tri[0]] = locked[tri[1]] = locked[tri[2]] = 1;
+      }
+      maxError = std::max(maxError, collapse.cost);
+      collapses++;
+    }
+    if (!collapses) {
+      break;
+    }
+  }
+
+  // map every corner to the wedge of its surviving vertex with the closest attributes
+  std::vector<GLuint> result;
+  result.reserve(tris.size());
+  for (size_t t = 0; t + 2 < tris.size(); t += 3) {
+    GLuint corner[3];
+    for (int i = 0; i < 3; ++i) {
+      GLuint w = tris[t + i];
+      GLuint c = find(canonical[w]);
+      if (c == canonical[w]) {
+        corner[i] = w;
+        continue;
+      }
+      float best = INFINITY;
+      for (GLuint k = wedgeStart[c]; k < wedgeStart[c + 1]; ++k) {
+        const Vertex &x = vertices[wedges[k]];
+        glm::vec3 dn = x.normal - vertices[w].normal;
+        glm::vec2 dt = x.texCoord - vertices[w].texCoord;
+        float d = glm::dot(dn, dn) + glm::dot(dt, dt);
+        if (d < best) {
+          best = d;
+          corner[i] = wedges[k];
+        }
+      }
+    }
+    if (canonical[corner[0]] == canonical[corner[1]] ||
+        canonical[corner[1]] == canonical[corner[2]] ||
+        canonical[corner[0]] == canonical[corner[2]]) {
+      continue;
+    }
+    result.insert(result.end(), corner, corner + 3);
+  }
+
+  if (resultError) {
+    *resultError = static_cast<float>(std::sqrt(maxError) / radius);
+  }
+  return result;
+}
+
+std::vector<MeshLod> BuildLodChain(const std::vector<Vertex> &vertices,
+                                   const std::vector<GLuint> &indices, uint32_t maxLevels) {
+  std::vector<MeshLod> lods;
+  lods.reserve(maxLevels);
+  float error = 0.f;
+  for (uint32_t level = 0; level < maxLevels; ++level) {
+    const std::vector<GLuint> &source = level ? lods.back().indices : indices;
+    size_t target = source.size() / 6 * 3;
+    if (target < MIN_LOD_TRIANGLES * 3) {
+      break;
+    }
+    float levelError = 0.f;
+    auto simplified = SimplifyMesh(vertices, source, target, MAX_LOD_ERROR, &levelError);
+    // stop once a level no longer saves a meaningful number of triangles
+    if (simplified.empty() || simplified.size() * 20 > source.size() * 17) {
+      break;
+    }
+    // errors of successive levels add up since each is built from the previous one
+    error += levelError;
+    lods.push_back({std::move(simplified), error});
+  }
+  return lods;
+}
+
+} // namespace Optifuser
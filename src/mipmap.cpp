@@ -0,0 +1,143 @@
+#include "mipmap.h"
+#include "profiler.h"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <thread>
+
+namespace Optifuser {
+
+int MipLevelCount(int width, int height) {
+  int levels = 1;
+  for (int size = std::max(width, height); size > 1; size /= 2) {
+    ++levels;
+  }
+  return levels;
+}
+
+static float srgbToLinear(float c) {
+  return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+static float linearToSrgb(float c) {
+  return c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.f / 2.4f) - 0.055f;
+}
+
+static float besselI0(float x) {
+  float sum = 1, term = 1;
+  for (int k = 1; k < 20; ++k) {
+    term *= (x / (2 * k)) * (x / (2 * k));
+    sum += term;
+  }
+  return sum;
+}
+
+// weights of source texels 2x + k for k in [1 - R, R], R = size / 2
+static std::vector<float> filterWeights(MipFilter filter) {
+  if (filter == MipFilter::Box) {
+    return {0.5f, 0.5f};
+  }
+  // Kaiser windowed sinc, 3 destination texels wide
+  const float width = 3.f, alpha = 4.f;
+  const int radius = 6;
+  std::vector<float> weights;
+  float sum = 0;
+  for (int k = 1 - radius; k <= radius; ++k) {
+    float t = (k - 0.5f) / 2.f; // distance to the destination texel center
+    float sinc = std::sin(float(M_PI) * t) / (float(M_PI) * t);
+    float r = t / width;
+    float window = besselI0(alpha * std::sqrt(std::max(0.f, 1 - r * r))) / besselI0(alpha);
+    weights.push_back(sinc * window);
+    sum += weights.back();
+  }
+  for (float &w : weights) {
+    w /= sum;
+  }
+  return weights;
+}
+
+static void parallelRows(int rows, uint32_t threadCount,
+                         const std::function<void(int, int)> &work) {
+  // small levels are not worth a thread
+  int bands = std::clamp<int>(rows / 32, 1, threadCount);
+  std::vector<std::thread> workers;
+  for (int t = 1; t < bands; ++t) {
+    workers.emplace_back(work, rows * t / bands, rows * (t + 1) / bands);
+  }
+  work(0, rows / bands);
+  for (auto &worker : workers) {
+    worker.join();
+  }
+}
+
+std::vector<std::vector<uint8_t>> GenerateMipChain(const uint8_t *pixels, int width, int height,
+                                                   int channels, bool srgb, MipFilter filter,
+                                                   uint32_t threadCount) {
+  OPTIFUSER_PROFILE_SCOPE("GenerateMipChain");
+  if (threadCount == 0) {
+    threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+  auto weights = filterWeights(filter);
+  int radius = weights.size() / 2;
+  int colorChannels = srgb && channels >= 3 ? 3 : 0; // alpha is always linear
+
+  std::vector<std::vector<uint8_t>> chain;
+  chain.emplace_back(pixels, pixels + width * height * channels);
+
+  // levels are filtered from the previous unquantized level
+  std::vector<float> level(width * height * channels);
+  for (size_t i = 0; i < level.size(); ++i) {
+    float v = pixels[i] / 255.f;
+    level[i] = int(i % channels) < colorChannels ? srgbToLinear(v) : v;
+  }
+
+  int w = width, h = height;
+  while (w > 1 || h > 1) {
+    int w2 = std::max(1, w / 2), h2 = std::max(1, h / 2);
+
+    std::vector<float> rows(w2 * h * channels);
+    parallelRows(h, threadCount, [&](int begin, int end) {
+      for (int y = begin; y < end; ++y) {
+        for (int x = 0; x < w2; ++x) {
+          for (int c = 0; c < channels; ++c) {
+            float sum = 0;
+            for (int k = 1 - radius; k <= radius; ++k) {
+              int sx = std::clamp(2 * x + k, 0, w - 1);
+              sum += weights[k + radius - 1] * level[(y * w + sx) * channels + c];
+            }
+            rows[(y * w2 + x) * channels + c] = sum;
+          }
+        }
+      }
+    });
+
+    std::vector<float> next(w2 * h2 * channels);
+    std::vector<uint8_t> quantized(w2 * h2 * channels);
+    parallelRows(h2, threadCount, [&](int begin, int end) {
+      for (int y = begin; y < end; ++y) {
+        for (int x = 0; x < w2; ++x) {
+          for (int c = 0; c < channels; ++c) {
+            float sum = 0;
+            for (int k = 1 - radius; k <= radius; ++k) {
+              int sy = std::clamp(2 * y + k, 0, h - 1);
+              sum += weights[k + radius - 1] * rows[(sy * w2 + x) * channels + c];
+            }
+            // the sinc lobes overshoot at sharp edges
+            sum = std::clamp(sum, 0.f, 1.f);
+            int i = (y * w2 + x) * channels + c;
+            next[i] = sum;
+            quantized[i] = uint8_t((c < colorChannels ? linearToSrgb(sum) : sum) * 255.f + 0.5f);
+          }
+        }
+      }
+    });
+
+    chain.push_back(std::move(quantized));
+    level = std::move(next);
+    w = w2;
+    h = h2;
+  }
+  return chain;
+}
+
+} // namespace Optifuser
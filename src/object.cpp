@@ -1,7 +1,26 @@
 #include "object.h"
+#include "gl_context.h"
+#include "scene.h"
 #include <map>
+#include <mutex>
+#include <utility>
 
 namespace Optifuser {
+
+// primitive meshes are shared, but their buffers are only visible within one share group
+static std::shared_ptr<TriangleMesh> cachedMesh(const std::string &name,
+                                                const std::vector<Vertex> &vertices,
+                                                const std::vector<GLuint> &indices,
+                                                bool recalcNormal) {
+  static std::mutex mutex;
+  static std::map<std::pair<std::string, uint32_t>, std::shared_ptr<TriangleMesh>> meshes;
+  std::lock_guard<std::mutex> lock(mutex);
+  auto &mesh = meshes[{name, currentGLContext.shareGroup}];
+  if (!mesh) {
+    mesh = std::make_shared<TriangleMesh>(vertices, indices, recalcNormal);
+  }
+  return mesh;
+}
 glm::mat4 Object::getModelMat() const {
   glm::mat4 t = glm::toMat4(rotation);
   t[0] *= scale.x;
@@ -14,8 +33,65 @@ glm::mat4 Object::getModelMat() const {
   return t;
 }
 
+bool Object::updateLocalTransform(glm::mat4 &localMatrix) {
+  const glm::quat &r = preparedRotation;
+  if (!transformDirty && position == preparedPosition && scale == preparedScale &&
+      rotation.w == r.w && rotation.x == r.x && rotation.y == r.y && rotation.z == r.z) {
+    return false;
+  }
+  transformDirty = false;
+  preparedPosition = position;
+  preparedRotation = rotation;
+  preparedScale = scale;
+  localMatrix = getModelMat();
+  return true;
+}
+
 void Object::setScene(Scene *inScene) { scene = inScene; }
 
+void Object::markDirty() {
+  // objects not prepared yet are read in full when they are
+  if (dirty || !parent || dataIndex == UINT32_MAX) {
+    return;
+  }
+  Object *root = this;
+  while (root->parent) {
+    root = root->parent;
+  }
+  if (root->scene && !root->toRemove) {
+    root->scene->queueDirty(this);
+  }
+}
+
+void Object::setMaterial(std::shared_ptr<PBRMaterial> material) {
+  pbrMaterial = std::move(material);
+  markDirty();
+}
+
+void Object::setObjId(uint32_t id) {
+  uint32_t old = std::exchange(objId, id);
+  if (scene && old != id) {
+    scene->reindexIds(*this, segmentId, old);
+  }
+  markDirty();
+}
+
+void Object::setSegmentId(uint32_t id) {
+  uint32_t old = std::exchange(segmentId, id);
+  if (scene && old != id) {
+    scene->reindexIds(*this, old, objId);
+  }
+  markDirty();
+}
+
+void Object::markRemoved() {
+  if (scene) {
+    scene->removeObject(this);
+  } else {
+    toRemove = true;
+  }
+}
+
 Scene *Object::getScene() const { return scene; }
 
 std::shared_ptr<AbstractMeshBase> Object::getMesh() const { return mesh; }
@@ -24,6 +100,13 @@ void Object::addChild(std::unique_ptr<Object> child) {
   assert(child->getScene() == nullptr);
   child->parent = this;
   children.push_back(std::move(child));
+  Object *root = this;
+  while (root->parent) {
+    root = root->parent;
+  }
+  if (root->scene) {
+    root->scene->markHierarchyChanged();
+  }
 }
 
 std::unique_ptr<Object> NewNoisePlane(unsigned int res) {
@@ -107,8 +190,7 @@ std::unique_ptr<Object> NewYZPlane() {
   vertices.push_back(Vertex(glm::vec3(0, 1, -1), glm::vec3(1, 0, 0), glm::vec2(1, 1),
                             glm::vec3(0, 0, -1), glm::vec3(0, 1, 0)));
   std::vector<uint32_t> indices = {0, 1, 2, 0, 2, 3};
-  static auto mesh = std::make_shared<TriangleMesh>(vertices, indices);
-  auto obj = NewObject<Object>(mesh);
+  auto obj = NewObject<Object>(cachedMesh("YZPlane", vertices, indices, false));
   obj->name = "YZPlane";
   return obj;
 }
@@ -136,8 +218,7 @@ std::unique_ptr<Object> NewFlatCube() {
                                  8,  9,  10, 10, 11, 8,  12, 13, 14, 14, 15, 12,
                                  16, 17, 18, 18, 19, 16, 20, 21, 22, 22, 23, 20};
 
-  static auto cubeMesh = std::make_shared<TriangleMesh>(vertices, indices, true);
-  auto obj = NewObject<Object>(cubeMesh);
+  auto obj = NewObject<Object>(cachedMesh("FlatCube", vertices, indices, true));
   obj->name = "FlatCube";
   return obj;
 }
@@ -150,8 +231,7 @@ std::unique_ptr<Object> NewCube() {
       Vertex(glm::vec3(1.0, 1.0, -1.0)),   Vertex(glm::vec3(-1.0, 1.0, -1.0))};
   std::vector<GLuint> indices = {0, 1, 2, 2, 3, 0, 1, 5, 6, 6, 2, 1, 7, 6, 5, 5, 4, 7,
                                  4, 0, 3, 3, 7, 4, 4, 5, 1, 1, 0, 4, 3, 2, 6, 6, 7, 3};
-  static auto cubeMesh = std::make_shared<TriangleMesh>(vertices, indices, true);
-  auto obj = NewObject<Object>(cubeMesh);
+  auto obj = NewObject<Object>(cachedMesh("cube", vertices, indices, true));
   obj->name = "cube";
   return obj;
 }
@@ -1,10 +1,14 @@
 #include "objectLoader.h"
 #include "mesh.h"
+#include "mesh_optimizer.h"
+#include "mesh_simplify.h"
+#include "profiler.h"
 #include <assimp/Importer.hpp>
 #include <assimp/postprocess.h>
 #include <assimp/scene.h>
 #include <experimental/filesystem>
 #include <iostream>
+#include <mutex>
 #include <spdlog/sinks/stdout_color_sinks.h>
 #include <spdlog/spdlog.h>
 #include <string>
@@ -14,6 +18,11 @@ namespace fs = std::filesystem;
 
 namespace Optifuser {
 
+// loading may run on a worker thread, where GL work is deferred and there is no error state
+static GLenum pendingGLError() {
+  return glCommands.isGLThread() ? glGetError() : GLenum(GL_NO_ERROR);
+}
+
 // trim from start (in place)
 static inline void ltrim(std::string &s) {
   s.erase(s.begin(), std::find_if(s.begin(), s.end(), [](int ch) {
@@ -46,17 +55,24 @@ float shininessToRoughness(float ns) {
 }
 
 std::vector<std::unique_ptr<Object>> LoadObj(const std::string file, bool ignoreRootTransform,
-                                             glm::vec3 upAxis, glm::vec3 forwardAxis) {
+                                             glm::vec3 upAxis, glm::vec3 forwardAxis,
+                                             uint32_t lodLevels, bool optimizeMeshes) {
+  OPTIFUSER_PROFILE_SCOPE("LoadObj");
   std::shared_ptr<spdlog::logger> logger;
-  if (!spdlog::get("Optifuser")) {
-    logger = std::make_shared<spdlog::logger>(
-        "Optifuser", std::make_shared<spdlog::sinks::stderr_color_sink_st>());
-    spdlog::register_logger(logger);
-  } else {
-    logger = spdlog::get("Optifuser");
+  {
+    // loaders may run on several render threads
+    static std::mutex loggerMutex;
+    std::lock_guard<std::mutex> lock(loggerMutex);
+    if (!spdlog::get("Optifuser")) {
+      logger = std::make_shared<spdlog::logger>(
+          "Optifuser", std::make_shared<spdlog::sinks::stderr_color_sink_mt>());
+      spdlog::register_logger(logger);
+    } else {
+      logger = spdlog::get("Optifuser");
+    }
   }
 
-  auto err = glGetError();
+  auto err = pendingGLError();
   if (err != GL_NO_ERROR) {
     logger->critical("OpenGL Error: {0:x}", err);
     throw std::runtime_error("An OpenGL Error has occurred before object loading");
@@ -82,7 +98,11 @@ std::vector<std::unique_ptr<Object>> LoadObj(const std::string file, bool ignore
     importer.SetPropertyInteger(AI_CONFIG_PP_PTV_ADD_ROOT_TRANSFORMATION, 0);
   }
 
-  const aiScene *scene = importer.ReadFile(file, flags);
+  const aiScene *scene;
+  {
+    OPTIFUSER_PROFILE_SCOPE("LoadObj import");
+    scene = importer.ReadFile(file, flags);
+  }
 
   if (!scene) {
     logger->warn("Cannot load scene from file: {}. Error: {}", file, importer.GetErrorString());
@@ -102,6 +122,7 @@ std::vector<std::unique_ptr<Object>> LoadObj(const std::string file, bool ignore
     mat = std::make_shared<PBRMaterial>();
   }
   for (uint32_t i = 0; i < scene->mNumMaterials; i++) {
+    OPTIFUSER_PROFILE_SCOPE("LoadObj material");
     auto *m = scene->mMaterials[i];
     aiColor3D color = aiColor3D(0, 0, 0);
     float alpha = 1;
@@ -129,14 +150,14 @@ std::vector<std::unique_ptr<Object>> LoadObj(const std::string file, bool ignore
       if (!fs::exists(fullPath)) {
         logger->error("No texture file found: {}.", fullPath);
       } else {
-        auto tex = LoadTexture(fullPath, 0);
+        auto tex = LoadCompressedTexture(fullPath, TextureUsage::Color);
         if (!tex) {
           logger->error("Failed to open texture: {}.", fullPath);
         } else {
           pbrMats[i]->kd_map = tex;
           logger->info("{}: Diffuse texture {}", tex->getId(), fullPath);
 
-          auto err = glGetError();
+          auto err = pendingGLError();
           if (err != GL_NO_ERROR) {
             logger->error("Diffuse texture loading failed: {0:x}", err);
             // throw std::runtime_error("Diffuse texture loading failed");
@@ -154,12 +175,12 @@ std::vector<std::unique_ptr<Object>> LoadObj(const std::string file, bool ignore
       if (!fs::exists(fullPath)) {
         logger->error("No texture file found: {}.", fullPath);
       } else {
-        auto tex = LoadTexture(fullPath, 0);
+        auto tex = LoadCompressedTexture(fullPath, TextureUsage::Color);
         if (!tex) {
           logger->error("Failed to open texture: {}.", fullPath);
         } else {
           logger->info("{}: Specular texture {}", tex->getId(), fullPath);
-          auto err = glGetError();
+          auto err = pendingGLError();
           if (err != GL_NO_ERROR) {
             logger->error("Loading failed: {0:x}", err);
             // throw std::runtime_error("Specular texture loading failed");
@@ -177,13 +198,13 @@ std::vector<std::unique_ptr<Object>> LoadObj(const std::string file, bool ignore
       if (!fs::exists(fullPath)) {
         logger->error("No texture file found: {}.", fullPath);
       } else {
-        auto tex = LoadTexture(fullPath, 0);
+        auto tex = LoadCompressedTexture(fullPath, TextureUsage::Height);
         if (!tex) {
           logger->error("Failed to open texture: {}.", fullPath);
         } else {
           pbrMats[i]->height_map = tex;
           logger->info("{}: Height texture {}", tex->getId(), fullPath);
-          auto err = glGetError();
+          auto err = pendingGLError();
           if (err != GL_NO_ERROR) {
             logger->error("Loading failed: {0:x}", err);
             // throw std::runtime_error("Height texture loading failed");
@@ -201,13 +222,13 @@ std::vector<std::unique_ptr<Object>> LoadObj(const std::string file, bool ignore
       if (!fs::exists(fullPath)) {
         logger->error("No texture file found: {}.", fullPath);
       } else {
-        auto tex = LoadTexture(fullPath, 0);
+        auto tex = LoadCompressedTexture(fullPath, TextureUsage::Normal);
         if (!tex) {
           logger->error("Failed to open texture: {}.", fullPath);
         } else {
           pbrMats[i]->normal_map = tex;
           logger->info("{}: Normal texture {}", tex->getId(), fullPath);
-          auto err = glGetError();
+          auto err = pendingGLError();
           if (err != GL_NO_ERROR) {
             logger->error("Loading failed: {0:x}", err);
             // throw std::runtime_error("Normal texture loading failed");
@@ -218,6 +239,7 @@ std::vector<std::unique_ptr<Object>> LoadObj(const std::string file, bool ignore
   }
 
   for (uint32_t i = 0; i < scene->mNumMeshes; i++) {
+    OPTIFUSER_PROFILE_SCOPE("LoadObj mesh");
     std::vector<Vertex> vertices;
     std::vector<uint32_t> indices;
     auto mesh = scene->mMeshes[i];
@@ -256,7 +278,37 @@ std::vector<std::unique_ptr<Object>> LoadObj(const std::string file, bool ignore
       indices.push_back(face.mIndices[1]);
       indices.push_back(face.mIndices[2]);
     }
-    auto m = std::make_shared<TriangleMesh>(vertices, indices);
+    size_t vertexCount = vertices.size();
+    size_t memory = vertices.size() * sizeof(Vertex) + indices.size() * sizeof(GLuint);
+    float acmr = ComputeACMR(indices, vertices.size());
+
+    std::vector<MeshLod> lods;
+    if (optimizeMeshes) {
+      OPTIFUSER_PROFILE_SCOPE("WeldVertices");
+      WeldVertices(vertices, indices);
+    }
+    if (lodLevels) {
+      OPTIFUSER_PROFILE_SCOPE("BuildLodChain");
+      lods = BuildLodChain(vertices, indices, lodLevels);
+    }
+    if (optimizeMeshes) {
+      OPTIFUSER_PROFILE_SCOPE("OptimizeVertexCache");
+      OptimizeVertexCache(indices, vertices.size());
+      for (auto &lod : lods) {
+        OptimizeVertexCache(lod.indices, vertices.size());
+      }
+      OptimizeVertexFetch(vertices, indices, lods);
+    }
+    std::shared_ptr<TriangleMesh> m;
+    {
+      OPTIFUSER_PROFILE_SCOPE("TriangleMesh upload");
+      m = std::make_shared<TriangleMesh>(vertices, indices, lods);
+    }
+    logger->info("Mesh {}: {} triangles, {} -> {} vertices, ACMR {:.3f} -> {:.3f}, "
+                 "{:.1f} KB -> {:.1f} KB ({} LODs)",
+                 i, indices.size() / 3, vertexCount, vertices.size(), acmr,
+                 ComputeACMR(indices, vertices.size()), memory / 1024.f,
+                 m->getGpuMemorySize() / 1024.f, lods.size());
     objects.push_back(NewObject<Object>(m));
     objects.back()->pbrMaterial = pbrMats[mesh->mMaterialIndex];
   }
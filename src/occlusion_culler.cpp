@@ -0,0 +1,330 @@
+#include "occlusion_culler.h"
+#include "profiler.h"
+#include <algorithm>
+#include <chrono>
+#include <cfloat>
+#include <cmath>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace Optifuser {
+
+// edge functions and depth plane of a triangle in depth buffer pixels
+struct OcclusionCuller::ScreenTriangle {
+  float a[3], b[3], c[3];
+  float z0, dzdx, dzdy;
+  int minX, maxX, minY, maxY;
+};
+
+static constexpr uint32_t BAND_HEIGHT = 16;
+static constexpr uint32_t OBJECTS_PER_JOB = 64;
+
+OcclusionCuller::OcclusionCuller(uint32_t threadCount) {
+  if (threadCount == 0) {
+    threadCount = std::clamp(std::thread::hardware_concurrency(), 2u, 5u) - 1;
+  }
+  for (uint32_t i = 0; i < threadCount; ++i) {
+    workers.emplace_back(&OcclusionCuller::workerLoop, this);
+  }
+}
+
+OcclusionCuller::~OcclusionCuller() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    quit = true;
+  }
+  wake.notify_all();
+  for (auto &w : workers) {
+    w.join();
+  }
+}
+
+void OcclusionCuller::workerLoop() {
+  OPTIFUSER_PROFILE_THREAD("occlusion worker");
+  uint32_t generation = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [&] { return quit || jobGeneration != generation; });
+      if (quit) {
+        return;
+      }
+      generation = jobGeneration;
+    }
+    for (uint32_t i; (i = nextJob++) < jobCount;) {
+      job(i);
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      --busyWorkers;
+    }
+    done.notify_one();
+  }
+}
+
+void OcclusionCuller::parallelFor(uint32_t count, const std::function<void(uint32_t)> &fn) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    job = fn;
+    jobCount = count;
+    nextJob = 0;
+    busyWorkers = workers.size();
+    ++jobGeneration;
+  }
+  wake.notify_all();
+  for (uint32_t i; (i = nextJob++) < count;) {
+    fn(i);
+  }
+  std::unique_lock<std::mutex> lock(mutex);
+  done.wait(lock, [&] { return busyWorkers == 0; });
+}
+
+// clip a triangle against the near plane (z > -w), producing up to 4 vertices
+static int clipNear(const glm::vec4 in[3], glm::vec4 out[4]) {
+  int n = 0;
+  for (int i = 0; i < 3; ++i) {
+    const glm::vec4 &p = in[i];
+    const glm::vec4 &q = in[(i + 1) % 3];
+    float dp = p.z + p.w;
+    float dq = q.z + q.w;
+    if (dp >= 0) {
+      out[n++] = p;
+    }
+    if ((dp >= 0) != (dq >= 0)) {
+      out[n++] = p + (q - p) * (dp / (dp - dq));
+    }
+  }
+  return n;
+}
+
+void OcclusionCuller::collectOccluders(const ObjectData &data, const glm::mat4 &viewProj,
+                                       const CameraSpec &camera) {
+  std::vector<std::pair<float, uint32_t>> candidates;
+  glm::mat4 viewMat = camera.getViewMat();
+  glm::mat4 projMat = camera.getProjectionMat();
+  for (uint32_t i : data.opaque) {
+    const glm::vec4 &sphere = data.bounds[i];
+    if (data.lodLevels[i] < 0 || sphere.w < 0.f ||
+        !dynamic_cast<const TriangleMesh *>(data.mesh(i))) {
+      continue;
+    }
+    float radius = CameraSpec::getProjectedRadius(viewMat, projMat, glm::vec3(sphere), sphere.w);
+    if (radius >= settings.minOccluderSize) {
+      candidates.push_back({radius, i});
+    }
+  }
+  uint32_t count = std::min<size_t>(candidates.size(), settings.maxOccluders);
+  std::partial_sort(candidates.begin(), candidates.begin() + count, candidates.end(),
+                    [](auto &a, auto &b) { return a.first > b.first; });
+
+  float w = settings.width;
+  float h = settings.height;
+  triangles.clear();
+  for (uint32_t i = 0; i < count; ++i) {
+    uint32_t index = candidates[i].second;
+    auto mesh = static_cast<const TriangleMesh *>(data.mesh(index));
+    uint32_t level = 0;
+    while (level + 1 < mesh->getLodCount() &&
+           mesh->getLodError(level + 1) <= settings.occluderLodError) {
+      ++level;
+    }
+    auto indices = mesh->getLodIndices(level);
+    auto &vertices = mesh->getVertices();
+    glm::mat4 mvp = viewProj * data.worldMatrices[index];
+
+    for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+      glm::vec4 clip[3];
+      for (int k = 0; k < 3; ++k) {
+        clip[k] = mvp * glm::vec4(vertices[indices[t + k]].position, 1.f);
+      }
+      glm::vec4 poly[4];
+      int n = clipNear(clip, poly);
+      glm::vec3 s[4];
+      for (int k = 0; k < n; ++k) {
+        s[k] = glm::vec3((poly[k].x / poly[k].w * 0.5f + 0.5f) * w,
+                         (poly[k].y / poly[k].w * 0.5f + 0.5f) * h, poly[k].z / poly[k].w);
+      }
+      for (int k = 1; k + 1 < n; ++k) {
+        glm::vec3 v0 = s[0], v1 = s[k], v2 = s[k + 1];
+        float area = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+        if (std::abs(area) < 1e-6f) {
+          continue;
+        }
+        // occluders are treated as double sided
+        if (area < 0) {
+          std::swap(v1, v2);
+          area = -area;
+        }
+        ScreenTriangle tri;
+        tri.minX = std::max(0, (int)std::floor(std::min({v0.x, v1.x, v2.x})));
+        tri.maxX = std::min((int)w, (int)std::ceil(std::max({v0.x, v1.x, v2.x})));
+        tri.minY = std::max(0, (int)std::floor(std::min({v0.y, v1.y, v2.y})));
+        tri.maxY = std::min((int)h, (int)std::ceil(std::max({v0.y, v1.y, v2.y})));
+        if (tri.minX >= tri.maxX || tri.minY >= tri.maxY) {
+          continue;
+        }
+        const glm::vec3 *v[3] = {&v0, &v1, &v2};
+        for (int e = 0; e < 3; ++e) {
+          const glm::vec3 &p = *v[e];
+          const glm::vec3 &q = *v[(e + 1) % 3];
+          tri.a[e] = p.y - q.y;
+          tri.b[e] = q.x - p.x;
+          tri.c[e] = p.x * q.y - p.y * q.x;
+        }
+        tri.dzdx = ((v1.z - v0.z) * (v2.y - v0.y) - (v2.z - v0.z) * (v1.y - v0.y)) / area;
+        tri.dzdy = ((v2.z - v0.z) * (v1.x - v0.x) - (v1.z - v0.z) * (v2.x - v0.x)) / area;
+        tri.z0 = v0.z - tri.dzdx * v0.x - tri.dzdy * v0.y;
+        triangles.push_back(tri);
+      }
+    }
+  }
+  stats.occluders = count;
+  stats.occluderTriangles = triangles.size();
+}
+
+void OcclusionCuller::rasterizeBand(uint32_t y0, uint32_t y1) {
+  OPTIFUSER_PROFILE_SCOPE("OcclusionCuller rasterizeBand");
+  const uint32_t width = settings.width;
+  for (const ScreenTriangle &tri : triangles) {
+    int minY = std::max<int>(tri.minY, y0);
+    int maxY = std::min<int>(tri.maxY, y1);
+    int minX = tri.minX & ~3;
+    for (int y = minY; y < maxY; ++y) {
+      float py = y + 0.5f;
+      float *row = depth.data() + y * width;
+#ifdef __SSE2__
+      __m128 e0 = _mm_set1_ps(tri.b[0] * py + tri.c[0]);
+      __m128 e1 = _mm_set1_ps(tri.b[1] * py + tri.c[1]);
+      __m128 e2 = _mm_set1_ps(tri.b[2] * py + tri.c[2]);
+      __m128 zy = _mm_set1_ps(tri.z0 + tri.dzdy * py);
+      __m128 a0 = _mm_set1_ps(tri.a[0]);
+      __m128 a1 = _mm_set1_ps(tri.a[1]);
+      __m128 a2 = _mm_set1_ps(tri.a[2]);
+      __m128 dzdx = _mm_set1_ps(tri.dzdx);
+      __m128 zero = _mm_setzero_ps();
+      for (int x = minX; x < tri.maxX; x += 4) {
+        __m128 px = _mm_add_ps(_mm_set1_ps((float)x), _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f));
+        __m128 inside = _mm_and_ps(
+            _mm_and_ps(_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a0, px), e0), zero),
+                       _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a1, px), e1), zero)),
+            _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a2, px), e2), zero));
+        if (!_mm_movemask_ps(inside)) {
+          continue;
+        }
+        __m128 z = _mm_add_ps(_mm_mul_ps(dzdx, px), zy);
+        __m128 old = _mm_loadu_ps(row + x);
+        __m128 nearest = _mm_min_ps(old, z);
+        _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, old)));
+      }
+#else
+      for (int x = tri.minX; x < tri.maxX; ++x) {
+        float px = x + 0.5f;
+        if (tri.a[0] * px + tri.b[0] * py + tri.c[0] >= 0 &&
+            tri.a[1] * px + tri.b[1] * py + tri.c[1] >= 0 &&
+            tri.a[2] * px + tri.b[2] * py + tri.c[2] >= 0) {
+          row[x] = std::min(row[x], tri.z0 + tri.dzdx * px + tri.dzdy * py);
+        }
+      }
+#endif
+    }
+  }
+}
+
+bool OcclusionCuller::isOccluded(const glm::mat4 &mvp, const glm::vec3 &bmin,
+                                 const glm::vec3 &bmax) const {
+  glm::vec2 smin(FLT_MAX), smax(-FLT_MAX);
+  float zmin = FLT_MAX;
+  for (int i = 0; i < 8; ++i) {
+    glm::vec4 p = mvp * glm::vec4(i & 1 ? bmax.x : bmin.x, i & 2 ? bmax.y : bmin.y,
+                                  i & 4 ? bmax.z : bmin.z, 1.f);
+    if (p.w <= 1e-6f || p.z < -p.w) {
+      return false; // crosses the near plane
+    }
+    glm::vec3 ndc = glm::vec3(p) / p.w;
+    smin = glm::min(smin, glm::vec2(ndc.x, ndc.y));
+    smax = glm::max(smax, glm::vec2(ndc.x, ndc.y));
+    zmin = std::min(zmin, ndc.z);
+  }
+  int x0 = std::max(0, (int)std::floor((smin.x * 0.5f + 0.5f) * settings.width));
+  int x1 = std::min((int)settings.width, (int)std::ceil((smax.x * 0.5f + 0.5f) * settings.width));
+  int y0 = std::max(0, (int)std::floor((smin.y * 0.5f + 0.5f) * settings.height));
+  int y1 = std::min((int)settings.height, (int)std::ceil((smax.y * 0.5f + 0.5f) * settings.height));
+  if (x0 >= x1 || y0 >= y1) {
+    return false; // outside the view, left to the GPU
+  }
+
+  for (int y = y0; y < y1; ++y) {
+    const float *row = depth.data() + y * settings.width;
+#ifdef __SSE2__
+    __m128 z = _mm_set1_ps(zmin);
+    __m128 lo = _mm_set1_ps((float)x0);
+    __m128 hi = _mm_set1_ps((float)x1);
+    for (int x = x0 & ~3; x < x1; x += 4) {
+      __m128 px = _mm_add_ps(_mm_set1_ps((float)x), _mm_set_ps(3.f, 2.f, 1.f, 0.f));
+      __m128 valid = _mm_and_ps(_mm_cmpge_ps(px, lo), _mm_cmplt_ps(px, hi));
+      if (_mm_movemask_ps(_mm_and_ps(valid, _mm_cmpge_ps(_mm_loadu_ps(row + x), z)))) {
+        return false;
+      }
+    }
+#else
+    for (int x = x0; x < x1; ++x) {
+      if (row[x] >= zmin) {
+        return false;
+      }
+    }
+#endif
+  }
+  return true;
+}
+
+void OcclusionCuller::cull(Scene &scene, const CameraSpec &camera) {
+  OPTIFUSER_PROFILE_SCOPE("OcclusionCuller::cull");
+  auto start = std::chrono::high_resolution_clock::now();
+
+  // rows are processed 4 pixels at a time
+  settings.width = std::max(4u, (settings.width + 3) & ~3u);
+  settings.height = std::max(1u, settings.height);
+  depth.assign(settings.width * settings.height, FLT_MAX);
+
+  glm::mat4 viewProj = camera.getProjectionMat() * camera.getViewMat();
+  ObjectData &data = scene.getObjectData();
+  collectOccluders(data, viewProj, camera);
+
+  uint32_t bands = (settings.height + BAND_HEIGHT - 1) / BAND_HEIGHT;
+  parallelFor(bands, [this](uint32_t band) {
+    rasterizeBand(band * BAND_HEIGHT, std::min(settings.height, (band + 1) * BAND_HEIGHT));
+  });
+
+  std::vector<uint32_t> objects;
+  for (auto list : {&data.opaque, &data.transparent}) {
+    for (uint32_t i : *list) {
+      if (data.lodLevels[i] >= 0 && data.bounds[i].w >= 0.f) {
+        objects.push_back(i);
+      }
+    }
+  }
+  std::atomic<uint32_t> culled = 0;
+  parallelFor((objects.size() + OBJECTS_PER_JOB - 1) / OBJECTS_PER_JOB, [&](uint32_t j) {
+    size_t end = std::min(objects.size(), (j + 1) * (size_t)OBJECTS_PER_JOB);
+    for (size_t k = j * OBJECTS_PER_JOB; k < end; ++k) {
+      uint32_t i = objects[k];
+      auto mesh = data.mesh(i);
+      if (isOccluded(viewProj * data.worldMatrices[i], mesh->getAABBMin(), mesh->getAABBMax())) {
+        data.lodLevels[i] = data.objects[i]->lodLevel = -1;
+        if (settings.cullShadowCasters) {
+          data.shadowLodLevels[i] = data.objects[i]->shadowLodLevel = -1;
+        }
+        ++culled;
+      }
+    }
+  });
+
+  stats.tested = objects.size();
+  stats.culled = culled;
+  stats.cpuMs = std::chrono::duration<float, std::milli>(
+                    std::chrono::high_resolution_clock::now() - start)
+                    .count();
+}
+
+} // namespace Optifuser
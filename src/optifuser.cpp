@@ -1,7 +1,10 @@
 #include "optifuser.h"
+#include "egl_context.h"
+#include "gl_commands.h"
 #include "imgui.h"
 #include "backends/imgui_impl_glfw.h"
 #include "backends/imgui_impl_opengl3.h"
+#include <mutex>
 #include <spdlog/spdlog.h>
 #include "spdlog/sinks/stdout_color_sinks.h"
 
@@ -10,6 +13,9 @@ namespace Optifuser {
 bool glfwInitialized = false;
 GLFWwindow *mainWindow;
 Input input;
+ContextBackend contextBackend = ContextBackend::Auto;
+std::unique_ptr<EGLHeadlessContext> mainEGLContext;
+std::mutex globalContextMutex;
 
 Input &getInput() { return input; }
 
@@ -21,10 +27,70 @@ void wheelCallback(GLFWwindow *window, double xoffset, double yoffset) {
   input.wheelCallback(xoffset, yoffset);
 }
 
-void ensureGlobalContext() {
+void setContextBackend(ContextBackend backend) {
+  std::lock_guard<std::mutex> lock(globalContextMutex);
+  if (glfwInitialized || mainEGLContext) {
+    fprintf(stderr, "warning: the context backend cannot change after context creation\n");
+    return;
+  }
+  contextBackend = backend;
+}
+
+ContextBackend getContextBackend() { return contextBackend; }
+
+static bool initEGLContext() {
+  mainEGLContext = EGLHeadlessContext::Create();
+  if (!mainEGLContext || !mainEGLContext->makeCurrent()) {
+    mainEGLContext = nullptr;
+    return false;
+  }
+  // GLEW also probes GLX, which fails harmlessly without an X display
+  glewExperimental = GL_TRUE;
+  GLenum err = glewInit();
+  if (err != GLEW_OK && err != GLEW_ERROR_NO_GLX_DISPLAY) {
+    fprintf(stderr, "error: GLEW initialization failed: %s\n", glewGetErrorString(err));
+    exit(1);
+  }
+  glEnable(GL_DEPTH_TEST);
+  glDepthFunc(GL_LESS);
+  glCommands.setRenderThread();
+  return true;
+}
+
+void ensureGlobalContext(bool headless) {
+  // offscreen contexts may be created from several worker threads at once
+  std::lock_guard<std::mutex> lock(globalContextMutex);
+  if (mainEGLContext) {
+    if (!headless) {
+      throw std::runtime_error("A window context needs the GLFW backend, but a headless EGL "
+                               "context exists; call setContextBackend(ContextBackend::GLFW)");
+    }
+    return;
+  }
   if (glfwInitialized) {
     return;
   }
+
+  ContextBackend backend = contextBackend;
+  if (backend == ContextBackend::Auto) {
+    const char *env = std::getenv("OPTIFUSER_CONTEXT_BACKEND");
+    if (env && std::string(env) == "egl") {
+      backend = ContextBackend::EGL;
+    } else if (env && std::string(env) == "glfw") {
+      backend = ContextBackend::GLFW;
+    } else {
+      backend = headless ? ContextBackend::EGL : ContextBackend::GLFW;
+    }
+  }
+  if (backend == ContextBackend::EGL) {
+    if (initEGLContext()) {
+      contextBackend = ContextBackend::EGL;
+      return;
+    }
+    fprintf(stderr, "warning: EGL context creation failed, falling back to GLFW\n");
+  }
+  contextBackend = ContextBackend::GLFW;
+
   if (!glfwInit()) {
     fprintf(stderr, "error: Could not initialize GLFW\n");
     exit(1);
@@ -46,6 +112,7 @@ void ensureGlobalContext() {
 
   glewExperimental = GL_TRUE;
   glewInit();
+  glCommands.setRenderThread();
 
 #ifdef _VERBOSE
   const GLubyte *glrenderer = glGetString(GL_RENDERER);
@@ -136,17 +203,58 @@ void GLFWRenderContext::destroy() { glfwDestroyWindow(mainWindow); }
 GLFWwindow *GLFWRenderContext::getWindow() const { return mainWindow; }
 
 OffscreenRenderContext::OffscreenRenderContext(int w, int h) {
-  ensureGlobalContext();
+  ensureGlobalContext(true);
+  width = w;
+  height = h;
+  glGenFramebuffers(1, &fbo);
+  renderer.init();
+  renderer.resize(w, h);
+}
+
+OffscreenRenderContext::OffscreenRenderContext(int w, int h,
+                                               std::unique_ptr<EGLHeadlessContext> context)
+    : glContext(std::move(context)) {
   width = w;
   height = h;
+  makeCurrent();
+  glEnable(GL_DEPTH_TEST);
+  glDepthFunc(GL_LESS);
   glGenFramebuffers(1, &fbo);
   renderer.init();
   renderer.resize(w, h);
 }
 
+std::unique_ptr<OffscreenRenderContext>
+OffscreenRenderContext::CreateIndependent(int w, int h, bool shareObjects) {
+  ensureGlobalContext(true);
+  if (!mainEGLContext) {
+    throw std::runtime_error("Independent offscreen contexts need the EGL context backend");
+  }
+  auto context = EGLHeadlessContext::Create(shareObjects ? mainEGLContext.get() : nullptr);
+  if (!context) {
+    throw std::runtime_error("Failed to create an EGL context");
+  }
+  return std::unique_ptr<OffscreenRenderContext>(
+      new OffscreenRenderContext(w, h, std::move(context)));
+}
+
 OffscreenRenderContext::~OffscreenRenderContext() {
-  renderer.exit();
-  glDeleteFramebuffers(1, &fbo);
+  // GL objects of the renderer are released on its own context, they leak if it is lost
+  if (glContext && !glContext->makeCurrent()) {
+    fprintf(stderr, "error: failed to make the offscreen context current, skipping GL cleanup\n");
+  } else {
+    renderer.exit();
+    glDeleteFramebuffers(1, &fbo);
+  }
+  if (glContext) {
+    releaseShaderCache(glContext->getId().context);
+  }
+}
+
+void OffscreenRenderContext::makeCurrent() const {
+  if (glContext && !glContext->makeCurrent()) {
+    throw std::runtime_error("Failed to make the offscreen context current");
+  }
 }
 
 #ifdef _USE_OPTIX
@@ -288,19 +288,21 @@ optix::Transform OptixRenderer::getObjectTransform(const Object *obj) {
       mat["roughness"]->setFloat(obj->pbrMaterial->roughness);
       mat["ks"]->setFloat(obj->pbrMaterial->ks);
       mat["metallic"]->setFloat(obj->pbrMaterial->metallic);
-      if (obj->pbrMaterial->kd_map->getId()) {
-        mat["has_kd_map"]->setInt(1);
-        mat["kd_map"]->setTextureSampler(getTextureSampler(obj->pbrMaterial->kd_map.get()));
-      } else {
+      optix::TextureSampler kdSampler = getTextureSampler(obj->pbrMaterial->kd_map.get());
+      if (!kdSampler) {
         mat["has_kd_map"]->setInt(0);
         mat["kd_map"]->setTextureSampler(getEmptySampler());
-      }
-      if (obj->pbrMaterial->ks_map->getId()) {
-        mat["has_ks_map"]->setInt(1);
-        mat["ks_map"]->setTextureSampler(getTextureSampler(obj->pbrMaterial->ks_map.get()));
       } else {
+        mat["has_kd_map"]->setInt(1);
+        mat["kd_map"]->setTextureSampler(kdSampler);
+      }
+      optix::TextureSampler ksSampler = getTextureSampler(obj->pbrMaterial->ks_map.get());
+      if (!ksSampler) {
         mat["has_ks_map"]->setInt(0);
         mat["ks_map"]->setTextureSampler(getEmptySampler());
+      } else {
+        mat["has_ks_map"]->setInt(1);
+        mat["ks_map"]->setTextureSampler(ksSampler);
       }
     }
     gio->setMaterial(0, mat);
@@ -342,9 +344,19 @@ optix::Geometry OptixRenderer::getMeshGeometry(const TriangleMesh *mesh) {
     vertices->setElementSize(sizeof(float) * 14);
     vertices->setSize(mesh->getVertices().size());
 
-    optix::Buffer indices = context->createBufferFromGLBO(RT_BUFFER_INPUT, mesh->getEBO());
-    indices->setFormat(RT_FORMAT_UNSIGNED_INT3);
-    indices->setSize(mesh->getIndices().size() / 3);
+    optix::Buffer indices;
+    if (mesh->getIndexType() == GL_UNSIGNED_INT) {
+      indices = context->createBufferFromGLBO(RT_BUFFER_INPUT, mesh->getEBO());
+      indices->setFormat(RT_FORMAT_UNSIGNED_INT3);
+      indices->setSize(mesh->getIndices().size() / 3);
+    } else {
+      // the element buffer holds 16-bit indices, give OptiX a 32-bit copy
+      indices = context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_UNSIGNED_INT3,
+                                      mesh->getIndices().size() / 3);
+      memcpy(indices->map(), mesh->getIndices().data(),
+             mesh->getIndices().size() * sizeof(GLuint));
+      indices->unmap();
+    }
 
     g = context->createGeometry();
     g["vertex_buffer"]->setBuffer(vertices);
@@ -435,7 +447,14 @@ optix::TextureSampler OptixRenderer::getTextureSampler(const Texture *tex) {
   auto p = _texture_sampler.find(tex);
   optix::TextureSampler sampler = 0;
   if (p == _texture_sampler.end()) {
-    sampler = context->createTextureSamplerFromGLImage(tex->getId(), RT_TARGET_GL_TEXTURE_2D);
+    if (tex->isCompressed()) {
+      // OptiX has no block compressed GL interop, the material renders without the map
+      std::cerr << "Block compressed textures cannot be ray traced, load them with "
+                   "textureLoading.compress off"
+                << std::endl;
+    } else {
+      sampler = context->createTextureSamplerFromGLImage(tex->getId(), RT_TARGET_GL_TEXTURE_2D);
+    }
     _texture_sampler[tex] = sampler;
   } else {
     sampler = p->second;
@@ -1,4 +1,5 @@
 #include "passes/ao_pass.h"
+#include "gl_stats.h"
 #include <iostream>
 
 namespace Optifuser {
@@ -24,13 +25,41 @@ void AOPass::init() {
 void AOPass::setShader(const std::string &vs, const std::string &fs) {
   m_vertFile = vs;
   m_fragFile = fs;
-  m_shader = std::make_shared<Shader>(vs.c_str(), fs.c_str());
+  m_shader = LoadShader(vs, fs);
   if (!m_shader) {
     std::cerr << "Composite Shader Creation Failed." << std::endl;
   }
 }
 
 
+void AOPass::setReconstructionShaders(const std::string &vs, const std::string &downsampleFs,
+                                      const std::string &blurFs, const std::string &upsampleFs) {
+  m_reconstructionFiles[0] = vs;
+  m_reconstructionFiles[1] = downsampleFs;
+  m_reconstructionFiles[2] = blurFs;
+  m_reconstructionFiles[3] = upsampleFs;
+  m_downsampleShader = LoadShader(vs, downsampleFs);
+  m_blurShader = LoadShader(vs, blurFs);
+  m_upsampleShader = LoadShader(vs, upsampleFs);
+}
+
+void AOPass::reloadShaders() {
+  if (!m_vertFile.empty()) {
+    setShader(m_vertFile, m_fragFile);
+  }
+  if (!m_reconstructionFiles[0].empty()) {
+    setReconstructionShaders(m_reconstructionFiles[0], m_reconstructionFiles[1],
+                             m_reconstructionFiles[2], m_reconstructionFiles[3]);
+  }
+}
+
+void AOPass::updateShaders() {
+  m_shader.update();
+  m_downsampleShader.update();
+  m_blurShader.update();
+  m_upsampleShader.update();
+}
+
 void AOPass::setFbo(GLuint fbo) {
   m_fbo = fbo;
 }
@@ -38,6 +67,7 @@ void AOPass::setFbo(GLuint fbo) {
 void AOPass::setAttachment(GLuint texture, int width, int height) {
   m_width = width;
   m_height = height;
+  m_outputTexture = texture;
 
   glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
   glBindTexture(GL_TEXTURE_2D, texture);
@@ -46,6 +76,16 @@ void AOPass::setAttachment(GLuint texture, int width, int height) {
   glDrawBuffers(1, attachments);
 }
 
+void AOPass::setReducedTextures(GLuint packedtex, GLuint rawtex, GLuint blurtex, int downsample,
+                                int width, int height) {
+  m_packedTexture = packedtex;
+  m_rawTexture = rawtex;
+  m_blurTexture = blurtex;
+  m_downsample = downsample;
+  m_lowWidth = width;
+  m_lowHeight = height;
+}
+
 void AOPass::setInputTextures(int count, GLuint *colortex, GLuint depthtex) {
   m_colorTextures.resize(0);
   m_colorTextures.insert(m_colorTextures.begin(), colortex, colortex + count);
@@ -59,6 +99,10 @@ void AOPass::setRandomTexture(GLuint randomtex, int width, int height) {
 }
 
 void AOPass::render(const CameraSpec &camera) const {
+  if (m_packedTexture && m_downsampleShader && m_blurShader && m_upsampleShader) {
+    renderReduced(camera);
+    return;
+  }
   glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
   glViewport(0, 0, m_width, m_height);
   glDisable(GL_DEPTH_TEST);
@@ -76,6 +120,7 @@ void AOPass::render(const CameraSpec &camera) const {
   }
   m_shader->setInt("viewWidth", m_width);
   m_shader->setInt("viewHeight", m_height);
+  m_shader->setVec2("viewScale", m_viewScale);
 
   glm::mat4 projMat = camera.getProjectionMat();
   m_shader->setMatrix("gbufferProjectionMatrix", projMat);
@@ -84,6 +129,74 @@ void AOPass::render(const CameraSpec &camera) const {
   // render quad
   glBindVertexArray(m_quadVao);
   glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+  ++glCounters.drawCalls;
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void AOPass::drawQuad(GLuint target, int width, int height) const {
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target, 0);
+  glViewport(0, 0, width, height);
+  glBindVertexArray(m_quadVao);
+  glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+  ++glCounters.drawCalls;
+}
+
+void AOPass::renderReduced(const CameraSpec &camera) const {
+  glm::mat4 projMat = camera.getProjectionMat();
+  glm::mat4 projMatInv = glm::inverse(projMat);
+  GLuint normaltex = m_colorTextures.size() > 2 ? m_colorTextures[2] : 0;
+
+  glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+  glDisable(GL_DEPTH_TEST);
+
+  // pack the nearest normal and depth of each footprint
+  m_downsampleShader->use();
+  m_downsampleShader->setTexture("colortex2", normaltex, 0);
+  m_downsampleShader->setTexture("depthtex0", m_depthTexture, 1);
+  m_downsampleShader->setInt("downsample", m_downsample);
+  m_downsampleShader->setVec2("viewScale", m_viewScale);
+  m_downsampleShader->setMatrix("gbufferProjectionMatrixInverse", projMatInv);
+  drawQuad(m_packedTexture, m_lowWidth, m_lowHeight);
+
+  m_shader->use();
+  m_shader->setTexture("packedtex", m_packedTexture, 0);
+  // inputs of the full resolution shader, so ssao.fsh also works here
+  for (size_t n = 0; n < m_colorTextures.size(); n++) {
+    m_shader->setTexture("colortex" + std::to_string(n), m_colorTextures[n], n + 1);
+  }
+  m_shader->setTexture("depthtex0", m_depthTexture, m_colorTextures.size() + 1);
+  if (m_randomtex) {
+    m_shader->setTexture("randomtex", m_randomtex, m_colorTextures.size() + 2);
+    m_shader->setInt("randomtexWidth", m_randomtexWidth);
+    m_shader->setInt("randomtexHeight", m_randomtexHeight);
+  }
+  m_shader->setInt("viewWidth", m_lowWidth);
+  m_shader->setInt("viewHeight", m_lowHeight);
+  m_shader->setVec2("viewScale", m_lowViewScale);
+  m_shader->setInt("sampleCount", m_sampleCount);
+  m_shader->setMatrix("gbufferProjectionMatrix", projMat);
+  m_shader->setMatrix("gbufferProjectionMatrixInverse", projMatInv);
+  drawQuad(m_rawTexture, m_lowWidth, m_lowHeight);
+
+  // separable depth aware blur
+  m_blurShader->use();
+  m_blurShader->setTexture("packedtex", m_packedTexture, 1);
+  m_blurShader->setVec2("viewScale", m_lowViewScale);
+  m_blurShader->setTexture("aotex", m_rawTexture, 0);
+  m_blurShader->setVec2("direction", {1, 0});
+  drawQuad(m_blurTexture, m_lowWidth, m_lowHeight);
+  m_blurShader->setTexture("aotex", m_blurTexture, 0);
+  m_blurShader->setVec2("direction", {0, 1});
+  drawQuad(m_rawTexture, m_lowWidth, m_lowHeight);
+
+  m_upsampleShader->use();
+  m_upsampleShader->setTexture("aotex", m_rawTexture, 0);
+  m_upsampleShader->setTexture("packedtex", m_packedTexture, 1);
+  m_upsampleShader->setTexture("depthtex0", m_depthTexture, 2);
+  m_upsampleShader->setVec2("viewScale", m_viewScale);
+  m_upsampleShader->setMatrix("gbufferProjectionMatrixInverse", projMatInv);
+  drawQuad(m_outputTexture, m_width, m_height);
+
   glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
@@ -5,21 +5,16 @@ namespace Optifuser {
 void renderGlobalAxis(const glm::mat4 modelMat, const glm::mat4 &viewMat, const glm::mat4 &projMat,
                       Shader *shader, float length = 0.1, float thickness = 0.005) {
 
-  static std::unique_ptr<Object> x = nullptr;
-  static std::unique_ptr<Object> y = nullptr;
-  static std::unique_ptr<Object> z = nullptr;
+  // the cube mesh is cached by NewCube for the current share group
+  auto x = NewCube();
+  auto y = NewCube();
+  auto z = NewCube();
 
   shader->setMatrix("gbufferViewMatrix", viewMat);
   // shader->setMatrix("gbufferViewMatrixInverse", glm::inverse(viewMat));
   shader->setMatrix("gbufferProjectionMatrix", projMat);
   // shader->setMatrix("gbufferProjectionMatrixInverse", glm::inverse(projMat));
 
-  if (!x) {
-    x = NewCube();
-    y = NewCube();
-    z = NewCube();
-  }
-
   x->scale = {length, thickness, thickness};
   x->position = {length, 0, 0};
   y->scale = {thickness, length, thickness};
@@ -60,6 +55,7 @@ void AxisPass::render(const Scene &scene, const CameraSpec &camera) {
   // glm::mat4 projMatInv = glm::inverse(projMat);
 
   m_shader->use();
+  m_shader->setVec2("projectionJitter", m_jitter);
 
   for (auto &[pos, rot, scale] : scene.getAxes()) {
     glm::mat4 t = glm::toMat4(rot);
@@ -1,4 +1,5 @@
 #include "passes/composite_pass.h"
+#include "gl_stats.h"
 #include <iostream>
 
 namespace Optifuser {
@@ -24,7 +25,7 @@ void CompositePass::init() {
 void CompositePass::setShader(const std::string &vs, const std::string &fs) {
   m_vertFile = vs;
   m_fragFile = fs;
-  m_shader = std::make_shared<Shader>(vs.c_str(), fs.c_str());
+  m_shader = LoadShader(vs, fs);
   if (!m_shader) {
     std::cerr << "Composite Shader Creation Failed." << std::endl;
   }
@@ -76,10 +77,13 @@ void CompositePass::render() const {
   }
   m_shader->setInt("viewWidth", m_width);
   m_shader->setInt("viewHeight", m_height);
+  m_shader->setVec2("viewScale", m_viewScale);
+  m_shader->setVec2("outputScale", m_outputScale);
 
   // render quad
   glBindVertexArray(m_quadVao);
   glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+  ++glCounters.drawCalls;
   glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
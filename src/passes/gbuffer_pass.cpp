@@ -28,7 +28,7 @@ void GBufferPass::init() { m_initialized = true; }
 void GBufferPass::setShader(const std::string &vs, const std::string &fs) {
   m_vertFile = vs;
   m_fragFile = fs;
-  m_shader = std::make_shared<Shader>(vs.c_str(), fs.c_str());
+  m_shader = LoadShader(vs, fs);
   if (!m_shader) {
     std::cerr << "GBuffer Shader Creation Failed." << std::endl;
   }
@@ -54,8 +54,12 @@ void GBufferPass::setDepthAttachment(GLuint depthtex, bool clear) {
 // helper method for rendering an object tree
 static void renderObjectTree(const Object &obj, const glm::mat4 &viewMat,
                              const glm::mat4 &viewMatInv, const glm::mat4 &projMat,
-                             const glm::mat4 &projMatInv, Shader *defaultShader,
-                             bool renderSegmentation) {
+                             const glm::mat4 &projMatInv, const glm::mat4 &prevModelMat,
+                             const glm::mat4 &prevViewProjMat, const glm::vec2 &jitter,
+                             Shader *defaultShader, bool renderSegmentation) {
+  if (obj.lodLevel < 0) {
+    return;
+  }
 
   glm::mat4 modelMat = obj.globalModelMatrix;
   auto mesh = obj.getMesh();
@@ -79,26 +83,35 @@ static void renderObjectTree(const Object &obj, const glm::mat4 &viewMat,
 
   shader->setMatrix("gbufferModelMatrix", modelMat);
   shader->setMatrix("gbufferModelMatrixInverse", glm::inverse(modelMat));
+  shader->setMatrix("gbufferPreviousModelMatrix", prevModelMat);
+  shader->setMatrix("gbufferPreviousViewProjectionMatrix", prevViewProjMat);
+  shader->setVec2("projectionJitter", jitter);
   // shader->setVec3("material.ka", obj.material.ka);
   shader->setVec4("material.kd", obj.pbrMaterial->kd);
   shader->setFloat("material.ks", obj.pbrMaterial->ks);
   shader->setFloat("material.roughness", obj.pbrMaterial->roughness);
   shader->setFloat("material.metallic", obj.pbrMaterial->metallic);
   shader->setTexture("material.kd_map", obj.pbrMaterial->kd_map->getId(), 0);
-  shader->setBool("material.has_kd_map", obj.pbrMaterial->kd_map->getId() != 0);
+  shader->setBool("material.has_kd_map", obj.pbrMaterial->kd_map->isResident());
   shader->setTexture("material.ks_map", obj.pbrMaterial->ks_map->getId(), 1);
-  shader->setBool("material.has_ks_map", obj.pbrMaterial->ks_map->getId() != 0);
+  shader->setBool("material.has_ks_map", obj.pbrMaterial->ks_map->isResident());
   shader->setTexture("material.height_map", obj.pbrMaterial->height_map->getId(), 2);
-  shader->setBool("material.has_height_map", obj.pbrMaterial->height_map->getId() != 0);
+  shader->setBool("material.has_height_map", obj.pbrMaterial->height_map->isResident());
   shader->setTexture("material.normal_map", obj.pbrMaterial->normal_map->getId(), 3);
-  shader->setBool("material.has_normal_map", obj.pbrMaterial->normal_map->getId() != 0);
+  shader->setBool("material.has_normal_map", obj.pbrMaterial->normal_map->isResident());
   auto &userData = obj.getUserData();
   shader->setUserData("user_data", userData.size(), userData.data());
-  mesh->draw();
+  mesh->drawLod(obj.lodLevel);
+}
+
+void GBufferPass::enableMotionVectors(bool enable) {
+  m_motionVectors = enable;
+  m_previousModelMatrices.clear();
+  m_modelMatrices.clear();
+  m_hasPrevious = false;
 }
 
-void GBufferPass::render(const Scene &scene, const CameraSpec &camera,
-                         bool renderSegmentation) const {
+void GBufferPass::render(const Scene &scene, const CameraSpec &camera, bool renderSegmentation) {
   glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
   glViewport(0, 0, m_width, m_height);
 
@@ -115,10 +128,28 @@ void GBufferPass::render(const Scene &scene, const CameraSpec &camera,
   glm::mat4 projMat = camera.getProjectionMat();
 
   glm::mat4 projMatInv = glm::inverse(projMat);
+  glm::mat4 viewProj = projMat * viewMat;
+  glm::mat4 prevViewProj = m_hasPrevious ? m_previousViewProjection : viewProj;
 
+  // objects missing from the previous render get no motion
   for (const auto &obj : scene.getOpaqueObjects()) {
-    renderObjectTree(*obj, viewMat, viewMatInv, projMat, projMatInv, m_shader.get(),
-                     renderSegmentation);
+    glm::mat4 prevModelMat = obj->globalModelMatrix;
+    if (m_motionVectors) {
+      auto it = m_previousModelMatrices.find(obj);
+      if (it != m_previousModelMatrices.end()) {
+        prevModelMat = it->second;
+      }
+      m_modelMatrices[obj] = obj->globalModelMatrix;
+    }
+    renderObjectTree(*obj, viewMat, viewMatInv, projMat, projMatInv, prevModelMat, prevViewProj,
+                     m_jitter, m_shader.get(), renderSegmentation);
+  }
+
+  if (m_motionVectors) {
+    m_previousModelMatrices.swap(m_modelMatrices);
+    m_modelMatrices.clear();
+    m_previousViewProjection = viewProj;
+    m_hasPrevious = true;
   }
 }
 
@@ -1,4 +1,5 @@
 #include "passes/lighting_pass.h"
+#include "gl_stats.h"
 #include "debug.h"
 
 namespace Optifuser {
@@ -20,7 +21,7 @@ void LightingPass::setFbo(GLuint fbo) {
 void LightingPass::setShader(const std::string &vs, const std::string &fs) {
   m_vertFile = vs;
   m_fragFile = fs;
-  m_shader = std::make_shared<Shader>(vs.c_str(), fs.c_str());
+  m_shader = LoadShader(vs, fs);
 }
 
 void LightingPass::init() {
@@ -123,6 +124,7 @@ void LightingPass::render(const Scene &scene, const CameraSpec &camera) const {
   m_shader->setInt("randomtexHeight", m_randomtex_height);
   m_shader->setInt("viewWidth", m_width);
   m_shader->setInt("viewHeight", m_height);
+  m_shader->setVec2("viewScale", m_viewScale);
 
   if (m_shadowtex && directionalLights.size()) {
     glm::vec3 dir = directionalLights[0].direction;
@@ -153,6 +155,7 @@ void LightingPass::render(const Scene &scene, const CameraSpec &camera) const {
   // render quad
   glBindVertexArray(m_quadVao);
   glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+  ++glCounters.drawCalls;
 }
 
 } // namespace Optifuser
@@ -17,7 +17,7 @@ void ShadowPass::setFbo(GLuint fbo) {
 void ShadowPass::setShader(const std::string &vs, const std::string &fs) {
   m_vertFile = vs;
   m_fragFile = fs;
-  m_shader = std::make_shared<Shader>(vs.c_str(), fs.c_str());
+  m_shader = LoadShader(vs, fs);
 }
 
 void ShadowPass::setDepthAttachment(GLuint depthtex, int width, int height) {
@@ -37,17 +37,6 @@ void ShadowPass::bindAttachments() const {
   glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
-// helper method for rendering an object tree
-void renderObjectTree(const Object &obj, Shader *shader) {
-
-  glm::mat4 modelMat = obj.globalModelMatrix;
-  auto mesh = obj.getMesh();
-  if (mesh && obj.visibility > 0.f) {
-    shader->setMatrix("gbufferModelMatrix", modelMat);
-    mesh->draw();
-  }
-}
-
 void ShadowPass::render(const Scene &scene, const CameraSpec &camera) const {
   glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
   glViewport(0, 0, m_width, m_height);
@@ -75,8 +64,13 @@ void ShadowPass::render(const Scene &scene, const CameraSpec &camera) const {
 
   m_shader->setMatrix("lightSpaceMatrix", lightSpaceMatrix);
 
-  for (const auto &obj : scene.getOpaqueObjects()) {
-    renderObjectTree(*obj, m_shader.get());
+  // only the transform and mesh are needed, read from the scene arrays
+  auto &data = scene.getObjectData();
+  for (uint32_t i : data.opaque) {
+    if (data.shadowLodLevels[i] >= 0) {
+      m_shader->setMatrix("gbufferModelMatrix", data.worldMatrices[i]);
+      data.mesh(i)->drawLod(data.shadowLodLevels[i]);
+    }
   }
 }
 
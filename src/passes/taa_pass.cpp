@@ -0,0 +1,83 @@
+#include "passes/taa_pass.h"
+#include "debug.h"
+#include "gl_stats.h"
+#include <iostream>
+
+namespace Optifuser {
+
+TAAPass::TAAPass() {}
+TAAPass::~TAAPass() {
+  glDeleteBuffers(1, &m_quadVbo);
+  glDeleteVertexArrays(1, &m_quadVao);
+}
+
+void TAAPass::init() {
+  m_initialized = true;
+  glGenVertexArrays(1, &m_quadVao);
+  glBindVertexArray(m_quadVao);
+  glGenBuffers(1, &m_quadVbo);
+  glBindBuffer(GL_ARRAY_BUFFER, m_quadVbo);
+  glEnableVertexAttribArray(0);
+  static float vertices[] = {0, 0, 1, 0, 1, 1, 0, 1};
+  glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), &vertices[0], GL_STATIC_DRAW);
+  glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void *)0);
+}
+
+void TAAPass::setShader(const std::string &vs, const std::string &fs) {
+  m_vertFile = vs;
+  m_fragFile = fs;
+  m_shader = LoadShader(vs, fs);
+  if (!m_shader) {
+    std::cerr << "TAA Shader Creation Failed." << std::endl;
+  }
+}
+
+void TAAPass::setFbo(GLuint fbo) {
+  m_fbo = fbo;
+  LABEL_FRAMEBUFFER(fbo, "TAA FBO");
+}
+
+void TAAPass::setInputTextures(GLuint lighting, GLuint motion, GLuint depth) {
+  m_lightingTexture = lighting;
+  m_motionTexture = motion;
+  m_depthTexture = depth;
+}
+
+void TAAPass::setHistoryTextures(GLuint history0, GLuint history1, int width, int height) {
+  m_historyTextures[0] = history0;
+  m_historyTextures[1] = history1;
+  m_width = width;
+  m_height = height;
+  m_historyValid = false;
+}
+
+void TAAPass::render() {
+  GLuint history = m_historyTextures[m_current];
+  m_current = 1 - m_current;
+
+  glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                         m_historyTextures[m_current], 0);
+  GLuint attachments[1] = {GL_COLOR_ATTACHMENT0};
+  glDrawBuffers(1, attachments);
+  glViewport(0, 0, m_width, m_height);
+  glDisable(GL_DEPTH_TEST);
+  m_shader->use();
+
+  m_shader->setTexture("lightingtex", m_lightingTexture, 0);
+  m_shader->setTexture("historytex", history, 1);
+  m_shader->setTexture("motiontex", m_motionTexture, 2);
+  m_shader->setTexture("depthtex0", m_depthTexture, 3);
+  m_shader->setVec2("viewScale", m_viewScale);
+  m_shader->setBool("historyValid", m_historyValid);
+  m_shader->setFloat("blendFactor", m_blendFactor);
+
+  // render quad
+  glBindVertexArray(m_quadVao);
+  glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+  ++glCounters.drawCalls;
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  m_historyValid = true;
+}
+
+} // namespace Optifuser
@@ -25,7 +25,7 @@ void TransparencyPass::init() { m_initialized = true; }
 void TransparencyPass::setShader(const std::string &vs, const std::string &fs) {
   m_vertFile = vs;
   m_fragFile = fs;
-  m_shader = std::make_shared<Shader>(vs.c_str(), fs.c_str());
+  m_shader = LoadShader(vs, fs);
   if (!m_shader) {
     std::cerr << "Transparency Pass Shader Creation Failed." << std::endl;
   }
@@ -48,6 +48,9 @@ void TransparencyPass::setColorAttachments(int num, GLuint *tex, int width, int
 void TransparencyPass::setDepthAttachment(GLuint depthtex) { m_depthtex = depthtex; }
 
 static void renderObjectTree(const Object &obj, Shader *shader, bool renderSegmentation) {
+  if (obj.lodLevel < 0) {
+    return;
+  }
 
   glm::mat4 modelMat = obj.globalModelMatrix;
   auto mesh = obj.getMesh();
@@ -65,17 +68,17 @@ static void renderObjectTree(const Object &obj, Shader *shader, bool renderSegme
   shader->setFloat("material.roughness", obj.pbrMaterial->roughness);
   shader->setFloat("material.metallic", obj.pbrMaterial->metallic);
   shader->setTexture("material.kd_map", obj.pbrMaterial->kd_map->getId(), 0);
-  shader->setBool("material.has_kd_map", obj.pbrMaterial->kd_map->getId() != 0);
+  shader->setBool("material.has_kd_map", obj.pbrMaterial->kd_map->isResident());
   shader->setTexture("material.ks_map", obj.pbrMaterial->ks_map->getId(), 1);
-  shader->setBool("material.has_ks_map", obj.pbrMaterial->ks_map->getId() != 0);
+  shader->setBool("material.has_ks_map", obj.pbrMaterial->ks_map->isResident());
   shader->setTexture("material.height_map", obj.pbrMaterial->height_map->getId(), 2);
-  shader->setBool("material.has_height_map", obj.pbrMaterial->height_map->getId() != 0);
+  shader->setBool("material.has_height_map", obj.pbrMaterial->height_map->isResident());
   shader->setTexture("material.normal_map", obj.pbrMaterial->normal_map->getId(), 3);
-  shader->setBool("material.has_normal_map", obj.pbrMaterial->normal_map->getId() != 0);
+  shader->setBool("material.has_normal_map", obj.pbrMaterial->normal_map->isResident());
   shader->setFloat("opacity", obj.visibility);
   auto &userData = obj.getUserData();
   shader->setUserData("user_data", userData.size(), userData.data());
-  mesh->draw();
+  mesh->drawLod(obj.lodLevel);
 }
 
 void TransparencyPass::render(const Scene &scene, const CameraSpec &camera,
@@ -100,6 +103,7 @@ void TransparencyPass::render(const Scene &scene, const CameraSpec &camera,
   m_shader->setMatrix("gbufferViewMatrixInverse", viewMatInv);
   m_shader->setMatrix("gbufferProjectionMatrix", projMat);
   m_shader->setMatrix("gbufferProjectionMatrixInverse", projMatInv);
+  m_shader->setVec2("projectionJitter", m_jitter);
   m_shader->setMatrix("environmentViewMatrix", viewMat);
   m_shader->setMatrix("environmentViewMatrixInverse", viewMatInv);
   m_shader->setVec3("ambientLight", scene.getAmbientLight());
@@ -0,0 +1,148 @@
+#include "profiler.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace Optifuser {
+
+namespace {
+
+struct Event {
+  const char *name;
+  uint64_t begin;
+  uint64_t end; // equal to begin for counters
+  double value;
+  bool isCounter;
+};
+
+// written only by its thread; readers use the release/acquire on `written`
+struct ThreadRing {
+  uint32_t tid;
+  std::string name;
+  std::atomic<uint64_t> written = 0;
+  std::array<Event, Profiler::EVENTS_PER_THREAD> events;
+};
+
+struct Registry {
+  std::mutex mutex;
+  std::vector<std::unique_ptr<ThreadRing>> rings; // kept after their thread exits
+  std::atomic<bool> enabled = true;
+  std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+};
+
+Registry &registry() {
+  static Registry r;
+  return r;
+}
+
+thread_local ThreadRing *threadRing = nullptr;
+
+ThreadRing *getThreadRing() {
+  if (!threadRing) {
+    auto &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.rings.push_back(std::make_unique<ThreadRing>());
+    threadRing = r.rings.back().get();
+    threadRing->tid = r.rings.size();
+    threadRing->name = "thread " + std::to_string(threadRing->tid);
+  }
+  return threadRing;
+}
+
+void record(const Event &e) {
+  ThreadRing *ring = getThreadRing();
+  uint64_t w = ring->written.load(std::memory_order_relaxed);
+  ring->events[w % Profiler::EVENTS_PER_THREAD] = e;
+  ring->written.store(w + 1, std::memory_order_release);
+}
+
+void writeEscaped(FILE *f, const std::string &s) {
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      fputc('\\', f);
+    }
+    fputc(c, f);
+  }
+}
+
+} // namespace
+
+uint64_t Profiler::now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() -
+                                                              registry().epoch)
+      .count();
+}
+
+void Profiler::setEnabled(bool enable) { registry().enabled = enable; }
+
+bool Profiler::isEnabled() { return registry().enabled; }
+
+void Profiler::setThreadName(const std::string &name) {
+  ThreadRing *ring = getThreadRing();
+  std::lock_guard<std::mutex> lock(registry().mutex);
+  ring->name = name;
+}
+
+void Profiler::zone(const char *name, uint64_t begin, uint64_t end) {
+  if (registry().enabled.load(std::memory_order_relaxed)) {
+    record({name, begin, end, 0.0, false});
+  }
+}
+
+void Profiler::counter(const char *name, double value) {
+  if (registry().enabled.load(std::memory_order_relaxed)) {
+    uint64_t t = now();
+    record({name, t, t, value, true});
+  }
+}
+
+bool Profiler::writeChromeTrace(const std::string &filename) {
+  FILE *f = fopen(filename.c_str(), "w");
+  if (!f) {
+    fprintf(stderr, "Failed to open %s for writing the trace\n", filename.c_str());
+    return false;
+  }
+  auto &r = registry();
+  std::lock_guard<std::mutex> lock(r.mutex);
+  fprintf(f, "{\"traceEvents\":[\n");
+  bool first = true;
+  for (auto &ring : r.rings) {
+    fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":\"",
+            first ? "" : ",\n", ring->tid);
+    writeEscaped(f, ring->name);
+    fprintf(f, "\"}}");
+    first = false;
+
+    uint64_t written = ring->written.load(std::memory_order_acquire);
+    uint64_t count = std::min<uint64_t>(written, EVENTS_PER_THREAD);
+    for (uint64_t i = written - count; i < written; ++i) {
+      const Event &e = ring->events[i % EVENTS_PER_THREAD];
+      fprintf(f, ",\n{\"name\":\"");
+      writeEscaped(f, e.name);
+      if (e.isCounter) {
+        fprintf(f, "\",\"ph\":\"C\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"args\":{\"value\":%g}}",
+                ring->tid, e.begin * 1e-3, e.value);
+      } else {
+        fprintf(f, "\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}", ring->tid,
+                e.begin * 1e-3, (e.end - e.begin) * 1e-3);
+      }
+    }
+  }
+  fprintf(f, "\n],\"displayTimeUnit\":\"ms\"}\n");
+  fclose(f);
+  return true;
+}
+
+void Profiler::clear() {
+  auto &r = registry();
+  std::lock_guard<std::mutex> lock(r.mutex);
+  for (auto &ring : r.rings) {
+    ring->written = 0;
+  }
+}
+
+} // namespace Optifuser
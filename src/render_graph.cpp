@@ -0,0 +1,200 @@
+#include "render_graph.h"
+#include "debug.h"
+#include <algorithm>
+#include <limits>
+
+namespace Optifuser {
+
+bool TextureDesc::operator==(const TextureDesc &other) const {
+  return internalFormat == other.internalFormat && format == other.format &&
+         type == other.type && width == other.width && height == other.height;
+}
+
+size_t TextureDesc::bytes() const {
+  size_t texel;
+  switch (internalFormat) {
+  case GL_RGBA32F:
+    texel = 16;
+    break;
+  case GL_RGBA16F:
+    texel = 8;
+    break;
+  case GL_R16F:
+    texel = 2;
+    break;
+  default:
+    texel = 4;
+  }
+  return texel * width * height;
+}
+
+RenderGraph::~RenderGraph() { releaseTextures(); }
+
+void RenderGraph::reset() {
+  resources.clear();
+  passes.clear();
+}
+
+RenderGraph::Resource RenderGraph::importTexture(const std::string &name, GLuint texture) {
+  ResourceInfo info;
+  info.name = name;
+  info.imported = true;
+  info.texture = texture;
+  resources.push_back(info);
+  return resources.size() - 1;
+}
+
+RenderGraph::Resource RenderGraph::createTexture(const std::string &name,
+                                                 const TextureDesc &desc) {
+  ResourceInfo info;
+  info.name = name;
+  info.desc = desc;
+  resources.push_back(info);
+  return resources.size() - 1;
+}
+
+void RenderGraph::markOutput(Resource resource) { resources[resource].output = true; }
+
+void RenderGraph::addPass(const std::string &name, uint32_t tag, std::vector<Resource> reads,
+                          std::vector<Resource> writes) {
+  passes.push_back({name, tag, std::move(reads), std::move(writes)});
+}
+
+void RenderGraph::compile() {
+  // walk backwards from the outputs, a pass is live if a later live pass or the caller needs
+  // something it writes
+  std::vector<bool> needed(resources.size());
+  for (size_t r = 0; r < resources.size(); ++r) {
+    needed[r] = resources[r].imported || resources[r].output;
+  }
+  for (size_t p = passes.size(); p-- > 0;) {
+    auto &pass = passes[p];
+    pass.live = std::any_of(pass.writes.begin(), pass.writes.end(),
+                            [&](Resource r) { return needed[r]; });
+    if (pass.live) {
+      for (Resource r : pass.reads) {
+        needed[r] = true;
+      }
+    }
+  }
+
+  // lifetimes of transient textures in pass indices, outputs live until the end of the frame
+  const uint32_t NONE = std::numeric_limits<uint32_t>::max();
+  std::vector<uint32_t> first(resources.size(), NONE), last(resources.size(), 0);
+  for (uint32_t p = 0; p < passes.size(); ++p) {
+    if (!passes[p].live) {
+      continue;
+    }
+    for (auto *list : {&passes[p].reads, &passes[p].writes}) {
+      for (Resource r : *list) {
+        first[r] = std::min(first[r], p);
+        last[r] = std::max(last[r], p);
+      }
+    }
+  }
+  std::vector<Resource> order;
+  for (Resource r = 0; r < resources.size(); ++r) {
+    if (resources[r].imported) {
+      continue;
+    }
+    resources[r].texture = 0;
+    if (first[r] != NONE) {
+      if (resources[r].output) {
+        last[r] = passes.size();
+      }
+      order.push_back(r);
+    }
+  }
+  std::stable_sort(order.begin(), order.end(),
+                   [&](Resource a, Resource b) { return first[a] < first[b]; });
+
+  for (auto &t : pool) {
+    t.used = false;
+  }
+  std::vector<std::string> labels(pool.size());
+  for (Resource r : order) {
+    auto &info = resources[r];
+    PhysicalTexture *texture = nullptr;
+    for (auto &t : pool) {
+      if (t.desc == info.desc && (!t.used || t.busyUntil < first[r])) {
+        texture = &t;
+        break;
+      }
+    }
+    if (!texture) {
+      PhysicalTexture t = {0, info.desc, 0, false};
+      glGenTextures(1, &t.id);
+      glBindTexture(GL_TEXTURE_2D, t.id);
+      glTexImage2D(GL_TEXTURE_2D, 0, info.desc.internalFormat, info.desc.width, info.desc.height,
+                   0, info.desc.format, info.desc.type, NULL);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+      pool.push_back(t);
+      labels.emplace_back();
+      texture = &pool.back();
+    }
+    texture->used = true;
+    texture->busyUntil = last[r];
+    info.texture = texture->id;
+    auto &label = labels[texture - pool.data()];
+    label += label.empty() ? info.name : " / " + info.name;
+  }
+
+  // textures nothing was placed in are released, e.g. after a resize
+  size_t n = 0;
+  for (size_t i = 0; i < pool.size(); ++i) {
+    if (!pool[i].used) {
+      glDeleteTextures(1, &pool[i].id);
+      continue;
+    }
+    LABEL_TEXTURE(pool[i].id, labels[i]);
+    pool[n++] = pool[i];
+  }
+  pool.resize(n);
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+GLuint RenderGraph::getTexture(Resource resource) const { return resources[resource].texture; }
+
+bool RenderGraph::isLive(uint32_t tag) const {
+  for (auto &pass : passes) {
+    if (pass.tag == tag) {
+      return pass.live;
+    }
+  }
+  return false;
+}
+
+void RenderGraph::releaseTextures() {
+  for (auto &t : pool) {
+    glDeleteTextures(1, &t.id);
+  }
+  pool.clear();
+  for (auto &info : resources) {
+    if (!info.imported) {
+      info.texture = 0;
+    }
+  }
+}
+
+size_t RenderGraph::getTransientBytes() const {
+  size_t bytes = 0;
+  for (auto &info : resources) {
+    if (!info.imported && info.texture) {
+      bytes += info.desc.bytes();
+    }
+  }
+  return bytes;
+}
+
+size_t RenderGraph::getAllocatedBytes() const {
+  size_t bytes = 0;
+  for (auto &t : pool) {
+    bytes += t.desc.bytes();
+  }
+  return bytes;
+}
+
+} // namespace Optifuser
@@ -1,17 +1,68 @@
 #include "renderer.h"
 #include "debug.h"
+#include "profiler.h"
+#include <chrono>
+#include <cmath>
 #include <iostream>
 namespace Optifuser {
 
+// indexed by FBO_TYPE
+static const char *PASS_NAMES[] = {"shadow", "gbuffer", "ao",        "lighting", "transparency",
+                                   "axis",   "taa",     "composite", "display"};
+
+// low discrepancy sequence for the TAA jitter
+static float halton(uint32_t index, uint32_t base) {
+  float f = 1.f, r = 0.f;
+  for (; index > 0; index /= base) {
+    f /= base;
+    r += f * (index % base);
+  }
+  return r;
+}
+
+// GPU timer query, GL counters, CPU time, debug group and profiler zone around one pass
+class PassScope {
+  GpuTimerScope timer;
+  PassStats &stats;
+  GLCounters start;
+  std::chrono::steady_clock::time_point startTime;
+#ifdef OPTIFUSER_PROFILER
+  ProfileZone zone;
+#endif
+
+public:
+  PassScope(GpuTimer *t, FBO_TYPE pass, PassStats *s)
+      : timer(t, pass), stats(s[pass]), start(glCounters),
+        startTime(std::chrono::steady_clock::now())
+#ifdef OPTIFUSER_PROFILER
+        ,
+        zone(PASS_NAMES[pass])
+#endif
+  {
+    PUSH_DEBUG_GROUP(PASS_NAMES[pass]);
+  }
+  ~PassScope() {
+    POP_DEBUG_GROUP();
+    stats.counters += glCounters - start;
+    stats.cpuMs += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() -
+                                                            startTime)
+                       .count();
+  }
+};
+
 Renderer::Renderer() {
   for (int n = 0; n < N_COLORTEX; ++n) {
     colortex[n] = 0;
   }
   segtex[0] = segtex[1] = segtex[2] = 0;
   usertex[0] = 0;
+  aoReducedtex[0] = aoReducedtex[1] = aoReducedtex[2] = 0;
   for (int n = 0; n < FBO_TYPE::COUNT; ++n) {
     m_fbo[n] = 0;
   }
+  for (int n = 0; n < FBO_TYPE::COPY; ++n) {
+    passStats[n].name = PASS_NAMES[n];
+  }
 }
 
 void Renderer::deleteTextures() {
@@ -23,17 +74,10 @@ void Renderer::deleteTextures() {
     colortex[n] = 0;
   }
 
-  glDeleteTextures(1, &lightingtex);
-  lightingtex = 0;
-
-  glDeleteTextures(1, &lightingtex2);
-  lightingtex2 = 0;
-
-  glDeleteTextures(1, &outputtex);
-  outputtex = 0;
-
-  glDeleteTextures(1, &aotex);
-  aotex = 0;
+  // transient textures belong to the render graph
+  render_graph.releaseTextures();
+  lightingtex = lightingtex2 = outputtex = aotex = 0;
+  aoReducedtex[0] = aoReducedtex[1] = aoReducedtex[2] = 0;
 
   glDeleteTextures(3, segtex);
   segtex[0] = segtex[1] = segtex[2] = 0;
@@ -41,46 +85,189 @@ void Renderer::deleteTextures() {
   glDeleteTextures(1, usertex);
   usertex[0] = 0;
 
+  deleteShadowTexture();
+  deleteMotionTextures();
+}
+
+void Renderer::deleteShadowTexture() {
   glDeleteTextures(1, &shadowtex);
+  shadowtex = 0;
 }
 
+// Passes are toggled in place: only the pass and the textures it owns are created or released,
+// the render graph is rebuilt from pooled textures. Textures are only created by resize.
+
 void Renderer::enableShadowPass(bool enable, int shadowmapSize, float shadowFrustumSize) {
+  bool resized = m_shadowSize != GLuint(shadowmapSize);
   shadowPassEnabled = enable;
   m_shadowSize = shadowmapSize;
   m_shadowFrustumSize = shadowFrustumSize;
-  if (initialized) {
-    exit();
-    init(scaling);
-    initTextures();
+  if (!initialized) {
+    return;
+  }
+  if (!enable) {
+    shadow_pass = nullptr;
+    deleteShadowTexture();
+  } else if (!shadow_pass) {
+    shadow_pass = std::make_unique<ShadowPass>();
+    shadow_pass->init();
+    shadow_pass->setFbo(m_fbo[FBO_TYPE::SHADOW]);
+  }
+  if (!depthtex) {
+    return;
+  }
+  if (enable && (!shadowtex || resized)) {
+    initShadowTexture();
+  }
+  rebindTextures();
+}
+
+void Renderer::enableAOPass(bool enable, int downsample, int sampleCount) {
+  aoPassEnabled = enable;
+  if (downsample != 1 && downsample != 2 && downsample != 4) {
+    std::cerr << "AO downsample factor must be 1, 2 or 4, using 1" << std::endl;
+    downsample = 1;
+  }
+  m_aoDownsample = downsample;
+  m_aoSampleCount = glm::clamp(sampleCount, 1, 64);
+  if (!initialized) {
+    return;
+  }
+  if (!enable) {
+    ao_pass = nullptr;
+  } else if (!ao_pass) {
+    ao_pass = std::make_unique<AOPass>();
+    ao_pass->init();
+    ao_pass->setFbo(m_fbo[FBO_TYPE::AO]);
+    if (!m_aoShaders.empty()) {
+      ao_pass->setShader(m_aoShaders[0], m_aoShaders[1]);
+    }
+    if (!m_aoReconstructionShaders.empty()) {
+      ao_pass->setReconstructionShaders(m_aoReconstructionShaders[0], m_aoReconstructionShaders[1],
+                                        m_aoReconstructionShaders[2],
+                                        m_aoReconstructionShaders[3]);
+    }
+  }
+  // AO textures come from the render graph pool
+  if (depthtex) {
     rebindTextures();
   }
 }
 
-void Renderer::enableAOPass(bool enable) {
-  aoPassEnabled = true;
-  if (initialized) {
-    exit();
-    init(scaling);
-    initTextures();
+void Renderer::enableOcclusionCulling(bool enable) {
+  if (!enable) {
+    occlusion_culler = nullptr;
+  } else if (!occlusion_culler) {
+    occlusion_culler = std::make_unique<OcclusionCuller>();
+  }
+}
+
+void Renderer::enableGpuTimers(bool enable) {
+  if (!enable) {
+    gpu_timer = nullptr;
+  } else if (!gpu_timer) {
+    gpu_timer = std::make_unique<GpuTimer>(
+        std::vector<std::string>(std::begin(PASS_NAMES), std::end(PASS_NAMES)));
+  }
+}
+
+void Renderer::enableDynamicResolution(bool enable, const DynamicResolutionSettings &settings) {
+  if (!enable) {
+    dynamic_resolution = nullptr;
+    setRenderScale(1.f);
+    return;
+  }
+  dynamic_resolution = std::make_unique<DynamicResolution>(settings);
+  enableGpuTimers(true);
+  setRenderScale(dynamic_resolution->getScale());
+}
+
+void Renderer::setRenderScale(float scale) {
+  m_renderScale = glm::clamp(scale, 0.1f, 1.f);
+  if (!initialized || !depthtex) {
+    return;
+  }
+  GLuint width = m_renderWidth, height = m_renderHeight;
+  updateRenderSize();
+  if (width != m_renderWidth || height != m_renderHeight) {
+    rebindTextures();
+  }
+}
+
+void Renderer::updateRenderSize() {
+  m_renderWidth = glm::clamp(GLuint(std::lround(m_width * m_renderScale)), 1u, m_width);
+  m_renderHeight = glm::clamp(GLuint(std::lround(m_height * m_renderScale)), 1u, m_height);
+}
+
+void Renderer::enableMotionVectors(bool enable) {
+  motionVectorsEnabled = enable;
+  if (!initialized) {
+    return;
+  }
+  gbuffer_pass->enableMotionVectors(motionVectorsEnabled || taaEnabled);
+  if (depthtex) {
+    initMotionTextures();
+    rebindTextures();
+  }
+}
+
+void Renderer::enableTAA(bool enable, float blendFactor) {
+  taaEnabled = enable;
+  m_taaBlendFactor = glm::clamp(blendFactor, 0.01f, 1.f);
+  if (!initialized) {
+    return;
+  }
+  if (!enable) {
+    taa_pass = nullptr;
+  } else if (!taa_pass) {
+    taa_pass = std::make_unique<TAAPass>();
+    taa_pass->init();
+    taa_pass->setFbo(m_fbo[FBO_TYPE::TAA]);
+  }
+  gbuffer_pass->enableMotionVectors(motionVectorsEnabled || taaEnabled);
+  if (depthtex) {
+    initMotionTextures();
     rebindTextures();
   }
 }
 
 void Renderer::enableAxisPass(bool enable) {
   axisPassEnabled = enable;
-  if (initialized) {
-    exit();
-    init(scaling);
-    initTextures();
+  if (!initialized) {
+    return;
+  }
+  if (!enable) {
+    axis_pass = nullptr;
+  } else if (!axis_pass) {
+    axis_pass = std::make_unique<AxisPass>();
+    axis_pass->init();
+    axis_pass->setFbo(m_fbo[FBO_TYPE::AXIS]);
+  }
+  if (depthtex) {
     rebindTextures();
   }
 }
+
 void Renderer::enableDisplayPass(bool enable) {
   displayPassEnabled = enable;
-  if (initialized) {
-    exit();
-    init(scaling);
-    initTextures();
+  if (!initialized) {
+    return;
+  }
+  if (!enable) {
+    display_pass = nullptr;
+  } else if (!display_pass) {
+    display_pass = std::make_unique<CompositePass>();
+    display_pass->init();
+    display_pass->setFbo(m_fbo[FBO_TYPE::DISPLAY]);
+  }
+  if (depthtex) {
+    rebindTextures();
+  }
+}
+
+void Renderer::setRequiredOutputs(uint32_t outputs) {
+  requiredOutputs = outputs;
+  if (initialized && depthtex) {
     rebindTextures();
   }
 }
@@ -92,7 +279,10 @@ void Renderer::enableGlobalAxes(bool enable) {
 }
 
 void Renderer::initTextures() {
-  randomtex = CreateRandomTexture(256, 256, 0);
+  // the noise texture does not depend on the size
+  if (!randomtex) {
+    randomtex = CreateRandomTexture(256, 256, 0);
+  }
 
   deleteTextures();
 
@@ -100,71 +290,43 @@ void Renderer::initTextures() {
   glGenTextures(N_COLORTEX, colortex);
   for (int n = 0; n < N_COLORTEX; n++) {
     glBindTexture(GL_TEXTURE_2D, colortex[n]);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, m_width, m_height, 0, GL_RGBA, GL_FLOAT, NULL);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, m_textureWidth, m_textureHeight, 0,
+                 GL_RGBA, GL_FLOAT, NULL);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     LABEL_TEXTURE(colortex[n], "colortex" + std::to_string(n));
   }
 
-  if (aoPassEnabled) {
-    glGenTextures(1, &aotex);
-    glBindTexture(GL_TEXTURE_2D, aotex);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, m_width, m_height, 0, GL_RED, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    LABEL_TEXTURE(aotex, "aotex");
-  }
-
   glGenTextures(3, segtex);
   glBindTexture(GL_TEXTURE_2D, segtex[0]);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_R32I, m_width, m_height, 0, GL_RED_INTEGER, GL_INT, NULL);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_R32I, m_textureWidth, m_textureHeight, 0,
+               GL_RED_INTEGER, GL_INT, NULL);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
   LABEL_TEXTURE(segtex[0], "segmentation tex");
 
   glBindTexture(GL_TEXTURE_2D, segtex[1]);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_R32I, m_width, m_height, 0, GL_RED_INTEGER, GL_INT, NULL);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_R32I, m_textureWidth, m_textureHeight, 0,
+               GL_RED_INTEGER, GL_INT, NULL);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
   LABEL_TEXTURE(segtex[1], "segmentation tex 2");
 
   glBindTexture(GL_TEXTURE_2D, segtex[2]);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, m_width, m_height, 0, GL_RGBA, GL_FLOAT, NULL);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, m_textureWidth, m_textureHeight, 0,
+               GL_RGBA, GL_FLOAT, NULL);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
   LABEL_TEXTURE(segtex[2], "segmentation color tex");
 
   glGenTextures(1, usertex);
   glBindTexture(GL_TEXTURE_2D, usertex[0]);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, m_width, m_height, 0, GL_RGBA, GL_FLOAT, NULL);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, m_textureWidth, m_textureHeight, 0,
+               GL_RGBA, GL_FLOAT, NULL);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
   LABEL_TEXTURE(usertex[0], "User Texture 0");
 
-  // lightingtex
-  glGenTextures(1, &lightingtex);
-  glBindTexture(GL_TEXTURE_2D, lightingtex);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, m_width, m_height, 0, GL_RGBA, GL_FLOAT, NULL);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  LABEL_TEXTURE(lightingtex, "lighting");
-
-  // alternative lighting tex for compositing
-  glGenTextures(1, &lightingtex2);
-  glBindTexture(GL_TEXTURE_2D, lightingtex2);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, m_width, m_height, 0, GL_RGBA, GL_FLOAT, NULL);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  LABEL_TEXTURE(lightingtex2, "lighting2");
-
-  // displaytex
-  glGenTextures(1, &outputtex);
-  glBindTexture(GL_TEXTURE_2D, outputtex);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, m_width, m_height, 0, GL_RGBA, GL_FLOAT, NULL);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  LABEL_TEXTURE(outputtex, "output");
-
   // depthtex
   glGenTextures(1, &depthtex);
   glBindTexture(GL_TEXTURE_2D, depthtex);
@@ -173,25 +335,73 @@ void Renderer::initTextures() {
   glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
   glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
 
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, m_width, m_height, 0, GL_DEPTH_COMPONENT,
-               GL_FLOAT, 0);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, m_textureWidth, m_textureHeight, 0,
+               GL_DEPTH_COMPONENT, GL_FLOAT, 0);
   LABEL_TEXTURE(depthtex, "gbuffer depth");
 
   // GLfloat color[4] = {1.f, 1.f, 1.f, 1.f};
   // glTextureParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, color);
 
   if (shadowPassEnabled) {
-    // shadowtex
-    glGenTextures(1, &shadowtex);
-    glBindTexture(GL_TEXTURE_2D, shadowtex);
+    initShadowTexture();
+  }
+  initMotionTextures();
+}
+
+void Renderer::initShadowTexture() {
+  deleteShadowTexture();
+  glGenTextures(1, &shadowtex);
+  glBindTexture(GL_TEXTURE_2D, shadowtex);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, m_shadowSize, m_shadowSize, 0,
+               GL_DEPTH_COMPONENT, GL_FLOAT, 0);
+  LABEL_TEXTURE(shadowtex, "shadow map");
+}
+
+// creates or releases the motion and TAA history textures to match the enabled features
+void Renderer::initMotionTextures() {
+  bool motion = motionVectorsEnabled || taaEnabled;
+  if (motion && !motiontex) {
+    glGenTextures(1, &motiontex);
+    glBindTexture(GL_TEXTURE_2D, motiontex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, m_textureWidth, m_textureHeight, 0, GL_RG, GL_FLOAT,
+                 NULL);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, m_shadowSize, m_shadowSize, 0,
-                 GL_DEPTH_COMPONENT, GL_FLOAT, 0);
-    LABEL_TEXTURE(shadowtex, "shadow map");
+    LABEL_TEXTURE(motiontex, "motion vectors");
+  } else if (!motion && motiontex) {
+    glDeleteTextures(1, &motiontex);
+    motiontex = 0;
+  }
+
+  if (taaEnabled && !historytex[0]) {
+    // sampled bilinearly at the reprojected position
+    glGenTextures(2, historytex);
+    for (int n = 0; n < 2; ++n) {
+      glBindTexture(GL_TEXTURE_2D, historytex[n]);
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, m_textureWidth, m_textureHeight, 0, GL_RGBA,
+                   GL_FLOAT, NULL);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+      LABEL_TEXTURE(historytex[n], "taa history " + std::to_string(n));
+    }
+  } else if (!taaEnabled && historytex[0]) {
+    glDeleteTextures(2, historytex);
+    historytex[0] = historytex[1] = 0;
   }
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void Renderer::deleteMotionTextures() {
+  glDeleteTextures(1, &motiontex);
+  motiontex = 0;
+  glDeleteTextures(2, historytex);
+  historytex[0] = historytex[1] = 0;
 }
 
 void Renderer::setAxisShader(const std::string &vs, const std::string &fs) {
@@ -214,11 +424,24 @@ void Renderer::setAOShader(const std::string &vs, const std::string &fs) {
   if (!initialized) {
     throw std::runtime_error("Initialization required before setting shader");
   }
+  m_aoShaders = {vs, fs};
   if (aoPassEnabled) {
     ao_pass->setShader(vs, fs);
   }
 }
 
+void Renderer::setAOReconstructionShaders(const std::string &vs, const std::string &downsampleFs,
+                                          const std::string &blurFs,
+                                          const std::string &upsampleFs) {
+  if (!initialized) {
+    throw std::runtime_error("Initialization required before setting shader");
+  }
+  m_aoReconstructionShaders = {vs, downsampleFs, blurFs, upsampleFs};
+  if (aoPassEnabled) {
+    ao_pass->setReconstructionShaders(vs, downsampleFs, blurFs, upsampleFs);
+  }
+}
+
 void Renderer::setDeferredShader(const std::string &vs, const std::string &fs) {
   if (!initialized) {
     throw std::runtime_error("Initialization required before setting shader");
@@ -242,6 +465,15 @@ void Renderer::setTransparencyShader(const std::string &vs, const std::string &f
   transparency_pass->setShader(vs, fs);
 }
 
+void Renderer::setTAAShader(const std::string &vs, const std::string &fs) {
+  if (!initialized) {
+    throw std::runtime_error("Initialization required before setting shader");
+  }
+  if (taaEnabled) {
+    taa_pass->setShader(vs, fs);
+  }
+}
+
 void Renderer::setCompositeShader(const std::string &vs, const std::string &fs) {
   if (!initialized) {
     throw std::runtime_error("Initialization required before setting shader");
@@ -263,12 +495,18 @@ void Renderer::init(float s) {
   glCullFace(GL_BACK);
 
   glGenFramebuffers(FBO_TYPE::COUNT, m_fbo);
+  // names only become objects (and can be labelled) once bound
+  for (GLuint fbo : m_fbo) {
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
   if (!gbuffer_pass) {
     gbuffer_pass = std::make_unique<GBufferPass>();
     gbuffer_pass->init();
   }
   gbuffer_pass->setFbo(m_fbo[FBO_TYPE::GBUFFER]);
+  gbuffer_pass->enableMotionVectors(motionVectorsEnabled || taaEnabled);
 
   if (!aoPassEnabled) {
     ao_pass = nullptr;
@@ -294,8 +532,6 @@ void Renderer::init(float s) {
       shadow_pass->init();
     }
     shadow_pass->setFbo(m_fbo[FBO_TYPE::SHADOW]);
-    shadow_pass->setFrustumSize(m_shadowFrustumSize);
-    lighting_pass->setShadowFrustumSize(m_shadowFrustumSize);
   }
 
   if (!axisPassEnabled) {
@@ -314,6 +550,16 @@ void Renderer::init(float s) {
   }
   transparency_pass->setFbo(m_fbo[FBO_TYPE::TRANSPARENCY]);
 
+  if (!taaEnabled) {
+    taa_pass = nullptr;
+  } else {
+    if (!taa_pass) {
+      taa_pass = std::make_unique<TAAPass>();
+      taa_pass->init();
+    }
+    taa_pass->setFbo(m_fbo[FBO_TYPE::TAA]);
+  }
+
   if (!composite_pass) {
     composite_pass = std::make_unique<CompositePass>();
     composite_pass->init();
@@ -343,7 +589,123 @@ void Renderer::exit() {
   glDeleteFramebuffers(FBO_TYPE::COUNT, m_fbo);
 }
 
+void Renderer::buildRenderGraph() {
+  using Resource = RenderGraph::Resource;
+  RenderGraph &graph = render_graph;
+  graph.reset();
+
+  // G-buffer textures are read back and picked from, so they are imported and always produced
+  std::vector<Resource> gbuffer;
+  for (int n = 0; n < N_COLORTEX; ++n) {
+    gbuffer.push_back(graph.importTexture("colortex" + std::to_string(n), colortex[n]));
+  }
+  std::vector<Resource> inputs = gbuffer;
+  for (int n = 0; n < 3; ++n) {
+    gbuffer.push_back(graph.importTexture("segtex" + std::to_string(n), segtex[n]));
+  }
+  gbuffer.push_back(graph.importTexture("usertex0", usertex[0]));
+  Resource depth = graph.importTexture("gbuffer depth", depthtex);
+  inputs.push_back(depth);
+
+  // transient textures have the allocated size too, so a new render size reuses the pool
+  TextureDesc color = {GL_RGBA32F, GL_RGBA, GL_FLOAT, m_textureWidth, m_textureHeight};
+  Resource lighting = graph.createTexture("lighting", color);
+  Resource composite = graph.createTexture("lighting2", color);
+  Resource output = graph.createTexture("output", color);
+  if (requiredOutputs & OUTPUT_LIGHTING) {
+    graph.markOutput(composite);
+  }
+  if (requiredOutputs & OUTPUT_DISPLAY) {
+    graph.markOutput(output);
+  }
+
+  std::vector<Resource> lightingInputs = inputs;
+  if (shadowPassEnabled) {
+    Resource shadow = graph.importTexture("shadow map", shadowtex);
+    graph.addPass("shadow", FBO_TYPE::SHADOW, {}, {shadow});
+    lightingInputs.push_back(shadow);
+  }
+  std::vector<Resource> gbufferOutputs = gbuffer;
+  gbufferOutputs.push_back(depth);
+  Resource motion = 0;
+  if (motiontex) {
+    motion = graph.importTexture("motion vectors", motiontex);
+    gbufferOutputs.push_back(motion);
+  }
+  graph.addPass("gbuffer", FBO_TYPE::GBUFFER, {}, gbufferOutputs);
+
+  Resource ao = 0, aoReduced[3] = {};
+  if (aoPassEnabled) {
+    ao = graph.createTexture("aotex",
+                             {GL_R32F, GL_RED, GL_FLOAT, m_textureWidth, m_textureHeight});
+    GLuint w = (m_textureWidth + m_aoDownsample - 1) / m_aoDownsample;
+    GLuint h = (m_textureHeight + m_aoDownsample - 1) / m_aoDownsample;
+    aoReduced[0] =
+        graph.createTexture("ao packed normal depth", {GL_RGBA32F, GL_RGBA, GL_FLOAT, w, h});
+    aoReduced[1] = graph.createTexture("ao raw", {GL_R16F, GL_RED, GL_FLOAT, w, h});
+    aoReduced[2] = graph.createTexture("ao blur", {GL_R16F, GL_RED, GL_FLOAT, w, h});
+    graph.addPass("ao", FBO_TYPE::AO, inputs, {ao, aoReduced[0], aoReduced[1], aoReduced[2]});
+    lightingInputs.push_back(ao);
+  }
+  graph.addPass("lighting", FBO_TYPE::LIGHTING, lightingInputs, {lighting});
+  if (axisPassEnabled) {
+    graph.addPass("axis", FBO_TYPE::AXIS, {lighting, depth}, {lighting});
+  }
+
+  // transparency blends into the G-buffer and the lighting, or only the G-buffer when no
+  // output needs the lighting, which is then culled
+  std::vector<Resource> blended = gbuffer;
+  blended.push_back(lighting);
+  std::vector<Resource> blendedInputs = blended;
+  blendedInputs.push_back(depth);
+  if (requiredOutputs) {
+    graph.addPass("transparency", FBO_TYPE::TRANSPARENCY, blendedInputs, blended);
+  } else {
+    std::vector<Resource> gbufferInputs = gbuffer;
+    gbufferInputs.push_back(depth);
+    graph.addPass("transparency", FBO_TYPE::TRANSPARENCY, gbufferInputs, gbuffer);
+  }
+  std::vector<Resource> compositeInputs = blendedInputs;
+  if (taaEnabled) {
+    // composite reads whichever history texture was resolved into this frame
+    Resource history[2] = {graph.importTexture("taa history 0", historytex[0]),
+                           graph.importTexture("taa history 1", historytex[1])};
+    graph.addPass("taa", FBO_TYPE::TAA, {lighting, motion, depth, history[0], history[1]},
+                  {history[0], history[1]});
+    compositeInputs[gbuffer.size()] = history[0];
+    compositeInputs.push_back(history[1]);
+  }
+  graph.addPass("composite", FBO_TYPE::COMPOSITE, compositeInputs, {composite});
+  if (displayPassEnabled) {
+    blendedInputs[gbuffer.size()] = composite;
+    graph.addPass("display", FBO_TYPE::DISPLAY, blendedInputs, {output});
+  }
+  graph.compile();
+
+  lightingtex = graph.getTexture(lighting);
+  lightingtex2 = graph.getTexture(composite);
+  outputtex = graph.getTexture(output);
+  aotex = aoPassEnabled ? graph.getTexture(ao) : 0;
+  for (int n = 0; n < 3; ++n) {
+    aoReducedtex[n] = aoPassEnabled ? graph.getTexture(aoReduced[n]) : 0;
+  }
+}
+
 void Renderer::rebindTextures() {
+  buildRenderGraph();
+
+  // the passes up to transparency render into the bottom left m_renderWidth x m_renderHeight of
+  // the textures, composite and display upscale it to the output size
+  glm::vec2 viewScale = {float(m_renderWidth) / m_textureWidth,
+                         float(m_renderHeight) / m_textureHeight};
+  bool upscaled = m_renderWidth != m_width || m_renderHeight != m_height;
+  if (lightingtex) {
+    glBindTexture(GL_TEXTURE_2D, lightingtex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, upscaled ? GL_LINEAR : GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, upscaled ? GL_LINEAR : GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+  }
+
   GLuint tex[N_COLORTEX + 4 + 1];
   int n_tex = N_COLORTEX;
   for (int n = 0; n < N_COLORTEX; ++n) {
@@ -355,82 +717,268 @@ void Renderer::rebindTextures() {
   tex[N_COLORTEX + 3] = usertex[0];
   n_tex = N_COLORTEX + 4;
   if (shadowPassEnabled) {
-    shadow_pass->setDepthAttachment(shadowtex, m_shadowSize, m_shadowSize);
-    lighting_pass->setShadowTexture(shadowtex, m_shadowSize);
+    bindShadowPass();
+  } else {
+    lighting_pass->setShadowTexture(0, 0);
   }
 
-  gbuffer_pass->setColorAttachments(n_tex, tex, m_width, m_height);
+  tex[N_COLORTEX + 4] = motiontex;
+  gbuffer_pass->setColorAttachments(n_tex + (motiontex ? 1 : 0), tex, m_renderWidth,
+                                    m_renderHeight);
   gbuffer_pass->setDepthAttachment(depthtex);
   gbuffer_pass->bindAttachments();
 
   if (aoPassEnabled) {
-    ao_pass->setAttachment(aotex, m_width, m_height);
-    ao_pass->setInputTextures(N_COLORTEX, colortex, depthtex);
-    ao_pass->setRandomTexture(randomtex->getId(), randomtex->getWidth(), randomtex->getHeight());
+    bindAOPass();
+  } else {
+    lighting_pass->setAOTexture(0);
   }
 
-  lighting_pass->setAttachment(lightingtex, m_width, m_height);
+  lighting_pass->setAttachment(lightingtex, m_renderWidth, m_renderHeight);
+  lighting_pass->setViewScale(viewScale);
   lighting_pass->setInputTextures(N_COLORTEX, colortex, depthtex);
   lighting_pass->setRandomTexture(randomtex->getId(), randomtex->getWidth(),
                                   randomtex->getHeight());
-  lighting_pass->setAOTexture(aotex);
 
   tex[N_COLORTEX + 4] = lightingtex;
-  transparency_pass->setColorAttachments(n_tex + 1, tex, m_width, m_height);
+  transparency_pass->setColorAttachments(n_tex + 1, tex, m_renderWidth, m_renderHeight);
   transparency_pass->setDepthAttachment(depthtex);
   transparency_pass->bindAttachments();
 
   if (axisPassEnabled) {
-    axis_pass->setColorAttachments(1, &lightingtex, m_width, m_height);
-    axis_pass->setDepthAttachment(depthtex);
-    axis_pass->bindAttachments();
+    bindAxisPass();
   }
 
+  if (taaEnabled) {
+    bindTAAPass();
+    taa_pass->setViewScale(viewScale);
+    tex[N_COLORTEX + 4] = taa_pass->getOutputTexture();
+  }
   composite_pass->setAttachment(lightingtex2, m_width, m_height);
+  composite_pass->setViewScale(viewScale);
   composite_pass->setInputTextures(n_tex + 1, tex, depthtex);
   composite_pass->setRandomTexture(randomtex->getId(), randomtex->getWidth(),
                                    randomtex->getHeight());
 
-  tex[N_COLORTEX + 4] = lightingtex2;
-
   if (displayPassEnabled) {
-    display_pass->setAttachment(outputtex, m_width, m_height);
-    display_pass->setInputTextures(n_tex + 1, tex, depthtex);
+    bindDisplayPass();
+    display_pass->setViewScale(viewScale);
+    display_pass->setOutputScale(
+        {float(m_width) / m_textureWidth, float(m_height) / m_textureHeight});
+  }
+}
+
+void Renderer::bindShadowPass() {
+  shadow_pass->setFrustumSize(m_shadowFrustumSize);
+  shadow_pass->setDepthAttachment(shadowtex, m_shadowSize, m_shadowSize);
+  lighting_pass->setShadowFrustumSize(m_shadowFrustumSize);
+  lighting_pass->setShadowTexture(shadowtex, m_shadowSize);
+}
+
+void Renderer::bindAOPass() {
+  ao_pass->setAttachment(aotex, m_renderWidth, m_renderHeight);
+  ao_pass->setInputTextures(N_COLORTEX, colortex, depthtex);
+  ao_pass->setRandomTexture(randomtex->getId(), randomtex->getWidth(), randomtex->getHeight());
+  GLuint lowWidth = (m_renderWidth + m_aoDownsample - 1) / m_aoDownsample;
+  GLuint lowHeight = (m_renderHeight + m_aoDownsample - 1) / m_aoDownsample;
+  ao_pass->setReducedTextures(aoReducedtex[0], aoReducedtex[1], aoReducedtex[2], m_aoDownsample,
+                              lowWidth, lowHeight);
+  ao_pass->setSampleCount(m_aoSampleCount);
+  GLuint lowTextureWidth = (m_textureWidth + m_aoDownsample - 1) / m_aoDownsample;
+  GLuint lowTextureHeight = (m_textureHeight + m_aoDownsample - 1) / m_aoDownsample;
+  ao_pass->setViewScale(
+      {float(m_renderWidth) / m_textureWidth, float(m_renderHeight) / m_textureHeight},
+      {float(lowWidth) / lowTextureWidth, float(lowHeight) / lowTextureHeight});
+  lighting_pass->setAOTexture(aotex);
+}
+
+void Renderer::bindTAAPass() {
+  taa_pass->setInputTextures(lightingtex, motiontex, depthtex);
+  taa_pass->setHistoryTextures(historytex[0], historytex[1], m_renderWidth, m_renderHeight);
+  taa_pass->setBlendFactor(m_taaBlendFactor);
+}
+
+void Renderer::bindAxisPass() {
+  axis_pass->setColorAttachments(1, &lightingtex, m_renderWidth, m_renderHeight);
+  axis_pass->setDepthAttachment(depthtex);
+  axis_pass->bindAttachments();
+}
+
+void Renderer::bindDisplayPass() {
+  // the composite inputs, with the composite output in place of the lighting
+  GLuint tex[N_COLORTEX + 4 + 1];
+  for (int n = 0; n < N_COLORTEX; ++n) {
+    tex[n] = colortex[n];
   }
+  tex[N_COLORTEX] = segtex[0];
+  tex[N_COLORTEX + 1] = segtex[1];
+  tex[N_COLORTEX + 2] = segtex[2];
+  tex[N_COLORTEX + 3] = usertex[0];
+  // the composite output has the output size, display shaders sample it at outputcoord
+  tex[N_COLORTEX + 4] = lightingtex2;
+  display_pass->setAttachment(outputtex, m_width, m_height);
+  display_pass->setInputTextures(N_COLORTEX + 4 + 1, tex, depthtex);
 }
 
 void Renderer::resize(GLuint w, GLuint h) {
+  if (depthtex && m_width == w * scaling && m_height == h * scaling) {
+    return;
+  }
   m_width = w * scaling;
   m_height = h * scaling;
 
-  initTextures();
+  // shrinking keeps the textures, the view then covers a part of them
+  if (!depthtex || m_width > m_textureWidth || m_height > m_textureHeight) {
+    m_textureWidth = m_width;
+    m_textureHeight = m_height;
+    initTextures();
+  }
+  updateRenderSize();
   rebindTextures();
 }
 
-void Renderer::reloadShaders() { std::cerr << "Not implemented" << std::endl; }
+void Renderer::reloadShaders() {
+  // programs are swapped in by renderScene once they compiled
+  if (shadow_pass) {
+    shadow_pass->reloadShaders();
+  }
+  gbuffer_pass->reloadShaders();
+  if (ao_pass) {
+    ao_pass->reloadShaders();
+  }
+  lighting_pass->reloadShaders();
+  if (axis_pass) {
+    axis_pass->reloadShaders();
+  }
+  transparency_pass->reloadShaders();
+  if (taa_pass) {
+    taa_pass->reloadShaders();
+  }
+  composite_pass->reloadShaders();
+  if (display_pass) {
+    display_pass->reloadShaders();
+  }
+}
+
+void Renderer::updateShaders() {
+  if (shadow_pass) {
+    shadow_pass->updateShaders();
+  }
+  gbuffer_pass->updateShaders();
+  if (ao_pass) {
+    ao_pass->updateShaders();
+  }
+  lighting_pass->updateShaders();
+  if (axis_pass) {
+    axis_pass->updateShaders();
+  }
+  transparency_pass->updateShaders();
+  if (taa_pass) {
+    taa_pass->updateShaders();
+  }
+  composite_pass->updateShaders();
+  if (display_pass) {
+    display_pass->updateShaders();
+  }
+}
 
 void Renderer::renderScene(Scene &scene, const CameraSpec &camera) {
+  OPTIFUSER_PROFILE_SCOPE("Renderer::renderScene");
   if (!initialized) {
     fprintf(stderr, "Renderer is not initialized\n");
     return;
   }
+  GLCounters now = glCounters;
+  frameStats.total = now - frameStart;
+  frameStats.passes.clear();
+  for (uint32_t i = 0; i < FBO_TYPE::COPY; ++i) {
+    frameStats.passes.push_back(passStats[i]);
+    passStats[i] = {PASS_NAMES[i]};
+  }
+  frameStart = now;
+  updateShaders();
+
   auto &lights = scene.getDirectionalLights();
   scene.prepareObjects();
+  scene.updateLods(camera, m_height, m_lodSettings, m_shadowLodSettings);
+  if (occlusion_culler) {
+    occlusion_culler->cull(scene, camera);
+  }
+  GpuTimer *timer = gpu_timer.get();
+  if (timer) {
+    timer->beginFrame();
+#ifdef OPTIFUSER_PROFILER
+    // last GPU times as counters so CPU zones and GPU cost line up in the trace
+    static const char *gpuCounters[] = {"gpu shadow ms",   "gpu gbuffer ms",      "gpu ao ms",
+                                        "gpu lighting ms", "gpu transparency ms", "gpu axis ms",
+                                        "gpu taa ms",      "gpu composite ms",    "gpu display ms"};
+    for (uint32_t i = 0; i < FBO_TYPE::COPY; ++i) {
+      Profiler::counter(gpuCounters[i], timer->getLastMs(i));
+    }
+#endif
+    if (dynamic_resolution) {
+      // GPU time of the passes that ran last frame; the results lag a few frames behind
+      float gpuMs = 0.f;
+      for (auto &pass : frameStats.passes) {
+        if (pass.cpuMs > 0.f) {
+          gpuMs += timer->getLastMs(&pass - frameStats.passes.data());
+        }
+      }
+      if (dynamic_resolution->update(gpuMs)) {
+        setRenderScale(dynamic_resolution->getScale());
+      }
+    }
+  }
+  // a different subpixel offset every frame, cycling through 8 positions
+  glm::vec2 jitter = {0, 0};
+  if (taaEnabled) {
+    uint32_t index = m_frameIndex++ % 8 + 1;
+    jitter = {(2.f * halton(index, 2) - 1.f) / m_renderWidth,
+              (2.f * halton(index, 3) - 1.f) / m_renderHeight};
+  }
+  gbuffer_pass->setJitter(jitter);
+  transparency_pass->setJitter(jitter);
+  if (axis_pass) {
+    axis_pass->setJitter(jitter);
+  }
+
+  // passes contributing to no required output are culled by the render graph
   if (lights.size() && shadowPassEnabled) {
+    PassScope p(timer, FBO_TYPE::SHADOW, passStats);
     shadow_pass->render(scene, camera);
   }
-  gbuffer_pass->render(scene, camera, true);
-  if (aoPassEnabled) {
+  {
+    PassScope p(timer, FBO_TYPE::GBUFFER, passStats);
+    gbuffer_pass->render(scene, camera, true);
+  }
+  if (aoPassEnabled && render_graph.isLive(FBO_TYPE::AO)) {
+    PassScope p(timer, FBO_TYPE::AO, passStats);
     ao_pass->render(camera);
   }
-  lighting_pass->render(scene, camera);
-  if (axisPassEnabled) {
+  if (render_graph.isLive(FBO_TYPE::LIGHTING)) {
+    PassScope p(timer, FBO_TYPE::LIGHTING, passStats);
+    lighting_pass->render(scene, camera);
+  }
+  if (axisPassEnabled && render_graph.isLive(FBO_TYPE::AXIS)) {
+    PassScope p(timer, FBO_TYPE::AXIS, passStats);
     axis_pass->render(scene, camera);
   }
-  transparency_pass->render(scene, camera, true);
-  composite_pass->render();
+  {
+    PassScope p(timer, FBO_TYPE::TRANSPARENCY, passStats);
+    transparency_pass->render(scene, camera, true);
+  }
+  if (taaEnabled && render_graph.isLive(FBO_TYPE::TAA)) {
+    PassScope p(timer, FBO_TYPE::TAA, passStats);
+    taa_pass->render();
+    composite_pass->setInputTexture(N_COLORTEX + 4, taa_pass->getOutputTexture());
+  }
+  if (render_graph.isLive(FBO_TYPE::COMPOSITE)) {
+    PassScope p(timer, FBO_TYPE::COMPOSITE, passStats);
+    composite_pass->render();
+  }
 
-  if (displayPassEnabled) {
+  if (displayPassEnabled && render_graph.isLive(FBO_TYPE::DISPLAY)) {
+    PassScope p(timer, FBO_TYPE::DISPLAY, passStats);
     display_pass->render();
   }
 
@@ -439,6 +987,13 @@ void Renderer::renderScene(Scene &scene, const CameraSpec &camera) {
   glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
 }
 
+PassTimings Renderer::getPassTimings() const {
+  if (!gpu_timer) {
+    return {};
+  }
+  return gpu_timer->getTimings();
+}
+
 void Renderer::displayLighting(GLuint fbo) const {
   glBindFramebuffer(GL_READ_FRAMEBUFFER, m_fbo[FBO_TYPE::COPY]);
   glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, lightingtex2,
@@ -461,8 +1016,8 @@ void Renderer::displayUserTexture(GLuint fbo) const {
   // draw to given fbo
   glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo);
 
-  glBlitFramebuffer(0, 0, m_width, m_height, 0, 0, m_width, m_height, GL_COLOR_BUFFER_BIT,
-                    GL_NEAREST);
+  glBlitFramebuffer(0, 0, m_renderWidth, m_renderHeight, 0, 0, m_width, m_height,
+                    GL_COLOR_BUFFER_BIT, GL_NEAREST);
 
   glBindTexture(GL_TEXTURE_2D, 0);
   glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
@@ -477,8 +1032,8 @@ void Renderer::displaySegmentation(GLuint fbo) const {
   // draw to given fbo
   glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo);
 
-  glBlitFramebuffer(0, 0, m_width, m_height, 0, 0, m_width, m_height, GL_COLOR_BUFFER_BIT,
-                    GL_NEAREST);
+  glBlitFramebuffer(0, 0, m_renderWidth, m_renderHeight, 0, 0, m_width, m_height,
+                    GL_COLOR_BUFFER_BIT, GL_NEAREST);
 
   glBindTexture(GL_TEXTURE_2D, 0);
   glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
@@ -502,30 +1057,49 @@ void Renderer::display(GLuint fbo) const {
 void Renderer::setObjectIdForAxis(int id) { axis_pass->setObjectId(id); }
 
 std::vector<float> Renderer::getLighting() {
+  if (!lightingtex2) {
+    std::cerr << "Lighting is not a required output of the renderer" << std::endl;
+    return {};
+  }
   return getRGBAFloat32Texture(lightingtex2, m_width, m_height);
 }
 std::vector<float> Renderer::getAlbedo() {
-  return getRGBAFloat32Texture(colortex[0], m_width, m_height);
+  return getRGBAFloat32Texture(colortex[0], m_renderWidth, m_renderHeight);
 }
 std::vector<float> Renderer::getNormal() {
-  return getRGBAFloat32Texture(colortex[2], m_width, m_height);
+  return getRGBAFloat32Texture(colortex[2], m_renderWidth, m_renderHeight);
 }
 std::vector<float> Renderer::getDepth() {
-  return getDepthFloat32Texture(depthtex, m_width, m_height);
+  return getDepthFloat32Texture(depthtex, m_renderWidth, m_renderHeight);
 }
 std::vector<int> Renderer::getSegmentation() {
-  return getInt32Texture(segtex[0], m_width, m_height);
+  return getInt32Texture(segtex[0], m_renderWidth, m_renderHeight);
 }
 std::vector<int> Renderer::getSegmentation2() {
-  return getInt32Texture(segtex[1], m_width, m_height);
+  return getInt32Texture(segtex[1], m_renderWidth, m_renderHeight);
 }
 std::vector<float> Renderer::getUserTexture() {
-  return getRGBAFloat32Texture(usertex[0], m_width, m_height);
+  return getRGBAFloat32Texture(usertex[0], m_renderWidth, m_renderHeight);
+}
+
+std::vector<float> Renderer::getMotion() {
+  if (!motiontex) {
+    std::cerr << "Motion vectors are not enabled" << std::endl;
+    return {};
+  }
+  // stored as a fraction of the view
+  auto motion = getRGFloat32Texture(motiontex, m_renderWidth, m_renderHeight);
+  for (size_t i = 0; i < motion.size(); i += 2) {
+    motion[i] *= m_renderWidth;
+    motion[i + 1] *= m_renderHeight;
+  }
+  return motion;
 }
 
 void Renderer::enablePicking() { glGenFramebuffers(1, &pickingFbo); }
 
 int Renderer::pickSegmentationId(int x, int y) {
+  OPTIFUSER_PROFILE_SCOPE("Renderer::pickSegmentationId");
   if (!pickingFbo) {
     std::cerr << "failed to pick segmentation id, you need to enable picking first." << std::endl;
     return 0;
@@ -539,13 +1113,18 @@ int Renderer::pickSegmentationId(int x, int y) {
   glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, segtex[0], 0);
   glReadBuffer(GL_COLOR_ATTACHMENT0);
 
-  // pixel position is upside down
-  glReadPixels(x, m_height - y, 1, 1, GL_RED_INTEGER, GL_INT, &value);
+  // pixel position is upside down, and in output pixels
+  x = x * m_renderWidth / m_width;
+  y = y * m_renderHeight / m_height;
+  glReadPixels(x, m_renderHeight - y, 1, 1, GL_RED_INTEGER, GL_INT, &value);
+  ++glCounters.readbacks;
+  glCounters.readbackBytes += sizeof(int);
   glBindFramebuffer(GL_FRAMEBUFFER, 0);
   return value;
 }
 
 int Renderer::pickObjectId(int x, int y) {
+  OPTIFUSER_PROFILE_SCOPE("Renderer::pickObjectId");
   if (!pickingFbo) {
     std::cerr << "failed to pick object id, you need to enable picking first." << std::endl;
     return 0;
@@ -559,8 +1138,12 @@ int Renderer::pickObjectId(int x, int y) {
   glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, segtex[1], 0);
   glReadBuffer(GL_COLOR_ATTACHMENT0);
 
-  // pixel position is upside down
-  glReadPixels(x, m_height - y, 1, 1, GL_RED_INTEGER, GL_INT, &value);
+  // pixel position is upside down, and in output pixels
+  x = x * m_renderWidth / m_width;
+  y = y * m_renderHeight / m_height;
+  glReadPixels(x, m_renderHeight - y, 1, 1, GL_RED_INTEGER, GL_INT, &value);
+  ++glCounters.readbacks;
+  glCounters.readbackBytes += sizeof(int);
   glBindFramebuffer(GL_FRAMEBUFFER, 0);
   return value;
 }
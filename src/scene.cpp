@@ -1,17 +1,359 @@
 #include "scene.h"
+#include "camera_spec.h"
+#include "profiler.h"
 #include "texture.h"
 #include <algorithm>
+#include <cfloat>
+#include <unordered_set>
+#include <utility>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 namespace Optifuser {
 
-void Scene::addObject(std::unique_ptr<Object> obj) {
-  obj->setScene(this);
+template <typename T> static void deleteList(T *node) {
+  while (node) {
+    delete std::exchange(node, node->next);
+  }
+}
+
+// newest first lists shared by a producer and a consumer thread
+template <typename T> static void pushNode(std::atomic<T *> &head, T *node) {
+  node->next = head.load(std::memory_order_relaxed);
+  while (!head.compare_exchange_weak(node->next, node, std::memory_order_release,
+                                     std::memory_order_relaxed)) {
+  }
+}
+
+template <typename T> static T *takeInPushOrder(std::atomic<T *> &head) {
+  T *node = head.exchange(nullptr, std::memory_order_acquire);
+  T *ordered = nullptr;
+  while (node) {
+    T *next = node->next;
+    node->next = ordered;
+    ordered = node;
+    node = next;
+  }
+  return ordered;
+}
+
+Scene::~Scene() {
+  deleteList(pendingChanges.exchange(nullptr));
+  delete publishedSnapshot.exchange(nullptr);
+  deleteList(freeSnapshots.exchange(nullptr));
+  delete backSnapshot;
+}
+
+void Scene::pushChange(Change *change) { pushNode(pendingChanges, change); }
+
+void Scene::applyChanges() {
+  Change *change = takeInPushOrder(pendingChanges);
+  while (change) {
+    if (change->add) {
+      insertObject(std::move(change->add));
+    } else if (change->remove) {
+      removeObject(change->remove);
+    } else {
+      removeObjectsByName(change->removeName);
+    }
+    delete std::exchange(change, change->next);
+  }
+}
+
+Scene::StateRecord &Scene::writeRecord(Object *obj, uint32_t fields) {
+  if (!backSnapshot) {
+    // a step published while the renderer was busy is written on again
+    backSnapshot = publishedSnapshot.exchange(nullptr, std::memory_order_acquire);
+  }
+  if (!backSnapshot) {
+    // only the simulation thread pops, so the head cannot be reused under us
+    Snapshot *free = freeSnapshots.load(std::memory_order_acquire);
+    while (free && !freeSnapshots.compare_exchange_weak(free, free->next,
+                                                        std::memory_order_acquire)) {
+    }
+    backSnapshot = free ? free : new Snapshot;
+    backSnapshot->next = nullptr;
+  }
+  Object *root = obj;
+  while (root->parent) {
+    root = root->parent;
+  }
+  // the object's record if it was already written in this snapshot
+  auto &records = backSnapshot->records;
+  uint32_t i = obj->snapshotRecord;
+  if (i < records.size() && records[i].object == obj && records[i].handle == root->handle) {
+    records[i].fields |= fields;
+    return records[i];
+  }
+  obj->snapshotRecord = records.size();
+  auto &record = records.emplace_back();
+  record.handle = root->handle;
+  record.object = obj;
+  record.fields = fields;
+  return record;
+}
+
+void Scene::writeTransform(Object *obj, const glm::vec3 &position, const glm::quat &rotation,
+                           const glm::vec3 &scale) {
+  auto &record = writeRecord(obj, TransformField);
+  record.position = position;
+  record.rotation = rotation;
+  record.scale = scale;
+}
+
+void Scene::writeVisibility(Object *obj, float visibility) {
+  writeRecord(obj, VisibilityField).visibility = visibility;
+}
+
+void Scene::writeMaterial(Object *obj, const glm::vec4 &kd, float ks, float roughness,
+                          float metallic) {
+  auto &record = writeRecord(obj, MaterialField);
+  record.kd = kd;
+  record.ks = ks;
+  record.roughness = roughness;
+  record.metallic = metallic;
+}
+
+void Scene::publishSnapshot() {
+  if (backSnapshot) {
+    publishedSnapshot.store(std::exchange(backSnapshot, nullptr), std::memory_order_release);
+  }
+}
+
+void Scene::applySnapshots() {
+  Snapshot *snapshot = publishedSnapshot.exchange(nullptr, std::memory_order_acquire);
+  if (!snapshot) {
+    return;
+  }
+  for (auto &record : snapshot->records) {
+    if (!getObject(record.handle)) {
+      continue; // removed after the write
+    }
+    Object *obj = record.object;
+    if (record.fields & TransformField) {
+      obj->position = record.position;
+      obj->setRotation(record.rotation);
+      obj->scale = record.scale;
+    }
+    if (record.fields & VisibilityField) {
+      obj->setVisibility(record.visibility);
+    }
+    if (record.fields & MaterialField) {
+      auto &mat = *obj->pbrMaterial;
+      mat.kd = record.kd;
+      mat.ks = record.ks;
+      mat.roughness = record.roughness;
+      mat.metallic = record.metallic;
+    }
+  }
+  snapshot->records.clear();
+  pushNode(freeSnapshots, snapshot);
+}
+
+ObjectHandle Scene::allocateHandle() {
+  if (glCommands.isGLThread() && !freeSlots.empty()) {
+    uint32_t index = freeSlots.back();
+    freeSlots.pop_back();
+    return {index, slots[index].generation};
+  }
+  // fresh slots start at generation 0, slots grows when the object is inserted
+  return {nextSlot.fetch_add(1, std::memory_order_relaxed), 0};
+}
+
+template <typename K>
+void Scene::indexHandle(HandleIndex<K> &index, const K &key, ObjectHandle handle,
+                        uint32_t ObjectSlot::*position) {
+  auto &bucket = index[key];
+  slots[handle.index].*position = bucket.size();
+  bucket.push_back(handle);
+}
+
+template <typename K>
+void Scene::unindexHandle(HandleIndex<K> &index, const K &key, ObjectHandle handle,
+                          uint32_t ObjectSlot::*position) {
+  auto it = index.find(key);
+  auto &bucket = it->second;
+  uint32_t i = slots[handle.index].*position;
+  bucket[i] = bucket.back();
+  slots[bucket[i].index].*position = i;
+  bucket.pop_back();
+  if (bucket.empty()) {
+    index.erase(it);
+  }
+}
+
+void Scene::indexIds(const Object &obj) {
+  indexHandle(segmentIdIndex, obj.segmentId, obj.handle, &ObjectSlot::segmentIdPosition);
+  indexHandle(objIdIndex, obj.objId, obj.handle, &ObjectSlot::objIdPosition);
+}
+
+void Scene::unindexIds(const Object &obj, uint32_t segmentId, uint32_t objId) {
+  unindexHandle(segmentIdIndex, segmentId, obj.handle, &ObjectSlot::segmentIdPosition);
+  unindexHandle(objIdIndex, objId, obj.handle, &ObjectSlot::objIdPosition);
+}
+
+void Scene::reindexIds(const Object &obj, uint32_t oldSegmentId, uint32_t oldObjId) {
+  // queued adds are indexed with their current ids when inserted
+  if (getObject(obj.handle) != &obj) {
+    return;
+  }
+  unindexIds(obj, oldSegmentId, oldObjId);
+  indexIds(obj);
+}
+
+template <typename K>
+static std::vector<ObjectHandle>
+findHandles(const std::unordered_map<K, std::vector<ObjectHandle>> &index, const K &key) {
+  auto it = index.find(key);
+  return it == index.end() ? std::vector<ObjectHandle>{} : it->second;
+}
+
+std::vector<ObjectHandle> Scene::findObjectsByName(const std::string &name) const {
+  return findHandles(nameIndex, name);
+}
+
+std::vector<ObjectHandle> Scene::findObjectsBySegmentId(uint32_t id) const {
+  return findHandles(segmentIdIndex, id);
+}
+
+std::vector<ObjectHandle> Scene::findObjectsByObjId(uint32_t id) const {
+  return findHandles(objIdIndex, id);
+}
+
+void Scene::insertObject(std::unique_ptr<Object> obj) {
+  uint32_t index = obj->handle.index;
+  if (index >= slots.size()) {
+    slots.resize(index + 1);
+  }
+  slots[index].object = obj.get();
+  slots[index].position = objects.size();
+  slots[index].name = obj->name;
+  indexHandle(nameIndex, obj->name, obj->handle, &ObjectSlot::namePosition);
+  indexIds(*obj);
+  if (obj->toRemove) {
+    // removed while the add was queued
+    removals.push_back(obj->handle);
+  }
+  unflattened.push_back(obj.get());
   objects.push_back(std::move(obj));
 }
 
+ObjectHandle Scene::addObject(std::unique_ptr<Object> obj) {
+  obj->setScene(this);
+  obj->handle = allocateHandle();
+  ObjectHandle handle = obj->handle;
+  if (!glCommands.isGLThread()) {
+    pushChange(new Change{std::move(obj)});
+    return handle;
+  }
+  insertObject(std::move(obj));
+  return handle;
+}
+
+Object *Scene::getObject(ObjectHandle handle) const {
+  if (handle.index >= slots.size() || slots[handle.index].generation != handle.generation) {
+    return nullptr;
+  }
+  return slots[handle.index].object;
+}
+
 void Scene::forceRemove() {
-  objects.erase(std::remove_if(objects.begin(), objects.end(),
-                               [](std::unique_ptr<Object> &o) { return o->isMarkedRemoved(); }),
-                objects.end());
+  if (retiredUnflattened) {
+    std::erase_if(unflattened, [](Object *obj) { return obj->toRemove; });
+    retiredUnflattened = false;
+  }
+  retiredObjects.clear();
+  for (ObjectHandle handle : removals) {
+    if (!getObject(handle)) {
+      continue; // removed twice, or the add is still queued
+    }
+    auto &slot = slots[handle.index];
+    uint32_t position = slot.position;
+    std::unique_ptr<Object> obj = std::move(objects[position]);
+    if (position + 1 != objects.size()) {
+      objects[position] = std::move(objects.back());
+      slots[objects[position]->handle.index].position = position;
+    }
+    objects.pop_back();
+
+    unindexHandle(nameIndex, slot.name, handle, &ObjectSlot::namePosition);
+    unindexIds(*obj, obj->segmentId, obj->objId);
+    slot.object = nullptr;
+    slot.name.clear();
+    ++slot.generation;
+    freeSlots.push_back(handle.index);
+    // the object and its children, which follow it
+    uint32_t i = obj->dataIndex;
+    if (i < data.size() && data.objects[i] == obj.get()) {
+      do {
+        data.objects[i] = nullptr;
+        data.drawClasses[i] = ObjectData::DRAW_NONE;
+        unlinkMaterial(i++);
+        ++removedEntries;
+      } while (i < data.size() && data.parents[i] >= 0);
+      drawListsChanged = true;
+    } else {
+      retiredUnflattened = true;
+    }
+    retiredObjects.push_back(std::move(obj));
+  }
+  removals.clear();
+}
+
+// same result as glm::normalize: identity for zero length
+static void normalizeQuats(float *w, float *x, float *y, float *z, size_t count) {
+  size_t i = 0;
+#ifdef __SSE2__
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.f);
+  for (; i + 4 <= count; i += 4) {
+    __m128 qw = _mm_loadu_ps(w + i), qx = _mm_loadu_ps(x + i);
+    __m128 qy = _mm_loadu_ps(y + i), qz = _mm_loadu_ps(z + i);
+    __m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(qw, qw), _mm_mul_ps(qx, qx)),
+                            _mm_add_ps(_mm_mul_ps(qy, qy), _mm_mul_ps(qz, qz)));
+    __m128 valid = _mm_cmpgt_ps(dot, zero);
+    __m128 inv = _mm_div_ps(one, _mm_sqrt_ps(dot));
+    qw = _mm_or_ps(_mm_and_ps(valid, _mm_mul_ps(qw, inv)), _mm_andnot_ps(valid, one));
+    _mm_storeu_ps(w + i, qw);
+    _mm_storeu_ps(x + i, _mm_and_ps(valid, _mm_mul_ps(qx, inv)));
+    _mm_storeu_ps(y + i, _mm_and_ps(valid, _mm_mul_ps(qy, inv)));
+    _mm_storeu_ps(z + i, _mm_and_ps(valid, _mm_mul_ps(qz, inv)));
+  }
+#endif
+  for (; i < count; ++i) {
+    glm::quat q = glm::normalize(glm::quat(w[i], x[i], y[i], z[i]));
+    w[i] = q.w;
+    x[i] = q.x;
+    y[i] = q.y;
+    z[i] = q.z;
+  }
+}
+
+void Scene::setPoses(std::span<const ObjectHandle> handles, const float *posQuat, size_t stride) {
+  OPTIFUSER_PROFILE_SCOPE("Scene::setPoses");
+  constexpr size_t BATCH = 256;
+  float w[BATCH], x[BATCH], y[BATCH], z[BATCH];
+  for (size_t begin = 0; begin < handles.size(); begin += BATCH) {
+    size_t count = std::min(BATCH, handles.size() - begin);
+    const float *pose = posQuat + begin * stride;
+    for (size_t i = 0; i < count; ++i, pose += stride) {
+      w[i] = pose[3];
+      x[i] = pose[4];
+      y[i] = pose[5];
+      z[i] = pose[6];
+    }
+    normalizeQuats(w, x, y, z, count);
+    pose = posQuat + begin * stride;
+    for (size_t i = 0; i < count; ++i, pose += stride) {
+      Object *obj = getObject(handles[begin + i]);
+      if (!obj) {
+        continue;
+      }
+      obj->position = {pose[0], pose[1], pose[2]};
+      obj->rotation = glm::quat(w[i], x[i], y[i], z[i]);
+      obj->markTransformDirty();
+    }
+  }
 }
 
 void Scene::removeObject(Object *obj) {
@@ -19,14 +361,23 @@ void Scene::removeObject(Object *obj) {
   if (s != this) {
     return;
   }
-  obj->markRemoved();
+  if (!glCommands.isGLThread()) {
+    pushChange(new Change{nullptr, obj});
+    return;
+  }
+  if (!obj->toRemove) {
+    obj->toRemove = true;
+    removals.push_back(obj->handle);
+  }
 }
 
 void Scene::removeObjectsByName(std::string name) {
-  for (auto &o : objects) {
-    if (o->name == name) {
-      o->markRemoved();
-    }
+  if (!glCommands.isGLThread()) {
+    pushChange(new Change{nullptr, nullptr, std::move(name)});
+    return;
+  }
+  for (ObjectHandle handle : findObjectsByName(name)) {
+    removeObject(getObject(handle));
   }
 }
 
@@ -51,29 +402,394 @@ void Scene::setEnvironmentMap(const std::string &front, const std::string &back,
   environmentMap = LoadCubeMapTexture(front, back, top, bottom, left, right, wrapping, filtering);
 }
 
-static void prepareObjectTree(Object *obj, const glm::mat4 &parentModelMat,
-                              std::vector<Object *> &opaque, std::vector<Object *> &transparent) {
-  obj->globalModelMatrix = parentModelMat * obj->getModelMat();
-  if (obj->getMesh() && obj->visibility > 0.f) {
-    if (obj->pbrMaterial->forceTransparency ||
-        (!obj->pbrMaterial->kd_map->getId() && obj->pbrMaterial->kd.a < 1) ||
-        obj->visibility < 1.f) {
-      transparent.push_back(obj);
-    } else {
-      opaque.push_back(obj);
+// objects already flattened keep their prepared state, new ones are prepared from scratch
+void Scene::appendObjectTree(Object *obj, int32_t parent, const ObjectData *previous) {
+  uint32_t index = data.objects.size();
+  uint32_t old = obj->dataIndex;
+  obj->dataIndex = index;
+  data.objects.push_back(obj);
+  data.parents.push_back(parent);
+  data.moved.push_back(0);
+  data.drawClasses.push_back(ObjectData::DRAW_NONE);
+  materialPositions.push_back(UINT32_MAX);
+  if (previous && old < previous->size() && previous->objects[old] == obj) {
+    data.localMatrices.push_back(previous->localMatrices[old]);
+    data.worldMatrices.push_back(previous->worldMatrices[old]);
+    data.bounds.push_back(previous->bounds[old]);
+    data.visibility.push_back(previous->visibility[old]);
+    data.segmentIds.push_back(previous->segmentIds[old]);
+    data.objIds.push_back(previous->objIds[old]);
+    data.materials.push_back(0);
+    linkMaterial(index, previous->materials[old]);
+    data.meshes.push_back(previous->meshes[old]);
+    data.lodLevels.push_back(previous->lodLevels[old]);
+    data.shadowLodLevels.push_back(previous->shadowLodLevels[old]);
+  } else {
+    uint32_t mesh = ObjectData::NO_MESH;
+    if (auto m = obj->getMesh().get()) {
+      auto [it, inserted] = meshIndices.emplace(m, data.meshTable.size());
+      if (inserted) {
+        data.meshTable.push_back(m);
+      }
+      mesh = it->second;
+    }
+    obj->transformDirty = true;
+    if (parent >= 0 && !obj->dirty) {
+      queueDirty(obj);
     }
+    data.localMatrices.emplace_back();
+    data.worldMatrices.emplace_back();
+    data.bounds.emplace_back();
+    data.visibility.push_back(0.f);
+    data.segmentIds.push_back(0);
+    data.objIds.push_back(0);
+    data.materials.push_back(0);
+    data.meshes.push_back(mesh);
+    data.lodLevels.push_back(0);
+    data.shadowLodLevels.push_back(0);
   }
   for (auto &c : obj->getChildren()) {
-    prepareObjectTree(c.get(), obj->globalModelMatrix, opaque, transparent);
+    appendObjectTree(c.get(), index, previous);
+  }
+}
+
+template <typename... T> static void clearArrays(T &...arrays) { (arrays.clear(), ...); }
+
+void Scene::flattenHierarchy() {
+  std::swap(data, previousData);
+  ObjectData &previous = previousData;
+  clearArrays(data.objects, data.parents, data.localMatrices, data.worldMatrices, data.bounds,
+              data.visibility, data.segmentIds, data.objIds, data.materials, data.meshes,
+              data.lodLevels, data.shadowLodLevels, data.moved, data.drawClasses);
+  materialPositions.clear();
+  // removed objects and replaced materials leave entries behind, start over once they dominate
+  size_t limit = 2 * previous.size() + 16;
+  if (previous.meshTable.size() <= limit && previous.materialTable.size() <= limit) {
+    std::swap(data.meshTable, previous.meshTable);
+    std::swap(data.materialTable, previous.materialTable);
+    for (auto &entries : materialEntries) {
+      entries.clear();
+    }
+  } else {
+    meshIndices.clear();
+    materialIndices.clear();
+    clearArrays(data.meshTable, data.materialTable, previous.objects, materialEntries,
+                materialOwners, materialStates);
+  }
+  for (auto &obj : objects) {
+    appendObjectTree(obj.get(), -1, &previous);
+  }
+  unflattened.clear();
+  removedEntries = 0;
+  // the entries moved, every one is sorted into the draw lists again
+  waitingEntries.clear();
+  drawListsChanged = true;
+}
+
+// what the draw class of entries using the material depends on
+static uint8_t materialState(const PBRMaterial &material) {
+  uint8_t state = material.forceTransparency ? 1 : 0;
+  if (material.kd.a < 1) {
+    Texture *kdMap = material.kd_map.get();
+    state |= 2 | (kdMap->getId() ? 4 : 0) | (kdMap->isLoading() ? 8 : 0);
+  }
+  return state;
+}
+
+uint32_t Scene::materialIndex(const std::shared_ptr<PBRMaterial> &material) {
+  auto [it, inserted] = materialIndices.emplace(material.get(), data.materialTable.size());
+  if (inserted) {
+    data.materialTable.push_back(material.get());
+    materialEntries.emplace_back();
+    materialOwners.push_back(material);
+    materialStates.push_back(materialState(*material));
   }
+  return it->second;
+}
+
+void Scene::linkMaterial(uint32_t i, uint32_t material) {
+  if (materialPositions[i] != UINT32_MAX && data.materials[i] == material) {
+    return;
+  }
+  unlinkMaterial(i);
+  data.materials[i] = material;
+  materialPositions[i] = materialEntries[material].size();
+  materialEntries[material].push_back(i);
+}
+
+void Scene::unlinkMaterial(uint32_t i) {
+  uint32_t position = std::exchange(materialPositions[i], UINT32_MAX);
+  if (position == UINT32_MAX) {
+    return;
+  }
+  auto &entries = materialEntries[data.materials[i]];
+  entries[position] = entries.back();
+  materialPositions[entries[position]] = position;
+  entries.pop_back();
+}
+
+// draw list of entry i from the arrays, waiting while it depends on GL objects still created
+void Scene::classify(uint32_t i) {
+  uint8_t cls = ObjectData::DRAW_NONE;
+  auto mesh = data.mesh(i);
+  float visibility = data.visibility[i];
+  if (mesh && visibility > 0.f) {
+    if (!mesh->isResident()) {
+      cls = ObjectData::DRAW_WAITING;
+    } else {
+      PBRMaterial *material = data.material(i);
+      Texture *kdMap = material->kd_map.get();
+      bool alpha = material->kd.a < 1 && !kdMap->getId();
+      if (material->forceTransparency || alpha || visibility < 1.f) {
+        cls = ObjectData::DRAW_TRANSPARENT;
+      } else {
+        cls = ObjectData::DRAW_OPAQUE;
+      }
+      if (alpha && kdMap->isLoading()) {
+        cls |= ObjectData::DRAW_WAITING;
+      }
+    }
+  }
+  uint8_t old = data.drawClasses[i];
+  if ((cls ^ old) & ~ObjectData::DRAW_WAITING) {
+    drawListsChanged = true;
+  }
+  if ((cls & ~old) & ObjectData::DRAW_WAITING) {
+    waitingEntries.push_back(i);
+  }
+  data.drawClasses[i] = cls;
+}
+
+// world matrices and bounds of the moved entries and everything below them
+void Scene::updateWorldMatrices() {
+  std::sort(movedEntries.begin(), movedEntries.end());
+  size_t count = movedEntries.size();
+  uint32_t end = 0;
+  for (size_t n = 0; n < count; ++n) {
+    uint32_t first = movedEntries[n];
+    if (first < end) {
+      continue; // below an entry already rebuilt
+    }
+    // descendants follow their ancestor in the arrays
+    for (uint32_t i = first; i == first || (i < data.size() && data.parents[i] >= int32_t(first));
+         ++i) {
+      if (!data.moved[i]) {
+        data.moved[i] = 1;
+        movedEntries.push_back(i);
+      }
+      int32_t parent = data.parents[i];
+      glm::mat4 &world = data.worldMatrices[i];
+      world = parent >= 0 ? data.worldMatrices[parent] * data.localMatrices[i]
+                          : data.localMatrices[i];
+      data.objects[i]->globalModelMatrix = world;
+      auto mesh = data.mesh(i);
+      if (mesh && mesh->hasBoundingBox()) {
+        float scale = glm::max(glm::length(glm::vec3(world[0])),
+                               glm::max(glm::length(glm::vec3(world[1])),
+                                        glm::length(glm::vec3(world[2]))));
+        data.bounds[i] = {glm::vec3(world * glm::vec4(mesh->getBoundingSphereCenter(), 1.f)),
+                          mesh->getBoundingSphereRadius() * scale};
+      } else {
+        data.bounds[i] = {0.f, 0.f, 0.f, -1.f};
+      }
+      end = i + 1;
+    }
+  }
+}
+
+// reads the fields of the object of entry i, true when its draw class may have changed
+bool Scene::readObject(uint32_t i) {
+  Object *obj = data.objects[i];
+  if (obj->updateLocalTransform(data.localMatrices[i])) {
+    data.moved[i] = 1;
+    movedEntries.push_back(i);
+  }
+  bool changed = false;
+  if (materialPositions[i] == UINT32_MAX || data.material(i) != obj->pbrMaterial.get()) {
+    linkMaterial(i, materialIndex(obj->pbrMaterial));
+    changed = true;
+  }
+  if (data.visibility[i] != obj->visibility) {
+    data.visibility[i] = obj->visibility;
+    changed = true;
+  }
+  data.segmentIds[i] = obj->segmentId;
+  data.objIds[i] = obj->objId;
+  return changed;
 }
 
 void Scene::prepareObjects() {
+  OPTIFUSER_PROFILE_SCOPE("Scene::prepareObjects");
+  // create the GL objects of meshes and textures built on other threads first
+  glCommands.execute();
+  applyChanges();
+  applySnapshots();
   forceRemove();
-  opaque_objects.clear();
-  transparent_objects.clear();
+  for (uint32_t i : movedEntries) {
+    data.moved[i] = 0;
+  }
+  movedEntries.clear();
+  bool flattened = hierarchyChanged.exchange(false) || removedEntries > data.size() / 4;
+  if (flattened) {
+    flattenHierarchy();
+  } else {
+    for (Object *obj : unflattened) {
+      if (!obj->toRemove) {
+        appendObjectTree(obj, -1, nullptr);
+      }
+    }
+    unflattened.clear();
+  }
+
+  // top level objects are checked for changes, children are read when marked dirty
   for (auto &obj : objects) {
-    prepareObjectTree(obj.get(), glm::mat4(1.f), opaque_objects, transparent_objects);
+    uint32_t i = obj->dataIndex;
+    if (i < data.size() && data.objects[i] == obj.get() && readObject(i) && !flattened) {
+      classify(i);
+    }
+  }
+  for (Object *obj : dirtyObjects) {
+    obj->dirty = false;
+    uint32_t i = obj->dataIndex;
+    if (i < data.size() && data.objects[i] == obj && readObject(i) && !flattened) {
+      classify(i);
+    }
+  }
+  dirtyObjects.clear();
+  updateWorldMatrices();
+
+  // materials written in place sort their entries into the draw lists again
+  for (uint32_t m = 0; m < materialEntries.size(); ++m) {
+    if (materialEntries[m].empty()) {
+      continue;
+    }
+    uint8_t state = materialState(*data.materialTable[m]);
+    if (state != materialStates[m]) {
+      materialStates[m] = state;
+      if (!flattened) {
+        for (uint32_t i : materialEntries[m]) {
+          classify(i);
+        }
+      }
+    }
+  }
+  if (flattened) {
+    for (uint32_t i = 0; i < data.size(); ++i) {
+      classify(i);
+    }
+  } else {
+    // meshes and textures that became resident
+    std::erase_if(waitingEntries, [this](uint32_t i) {
+      if (!data.objects[i] || !(data.drawClasses[i] & ObjectData::DRAW_WAITING)) {
+        return true;
+      }
+      classify(i);
+      return !(data.drawClasses[i] & ObjectData::DRAW_WAITING);
+    });
+  }
+
+  if (drawListsChanged) {
+    drawListsChanged = false;
+    opaque_objects.clear();
+    transparent_objects.clear();
+    data.opaque.clear();
+    data.transparent.clear();
+    for (uint32_t i = 0; i < data.size(); ++i) {
+      uint8_t cls = data.drawClasses[i] & ~ObjectData::DRAW_WAITING;
+      if (cls == ObjectData::DRAW_OPAQUE) {
+        data.opaque.push_back(i);
+        opaque_objects.push_back(data.objects[i]);
+      } else if (cls == ObjectData::DRAW_TRANSPARENT) {
+        data.transparent.push_back(i);
+        transparent_objects.push_back(data.objects[i]);
+      }
+    }
+  }
+  // replaced materials stay in the table until the next flatten
+  if (data.materialTable.size() > 2 * data.size() + 16) {
+    hierarchyChanged = true;
+  }
+}
+
+static void collectTextures(const Object *obj, std::unordered_set<const Texture *> &textures) {
+  auto &mat = obj->pbrMaterial;
+  for (auto &tex : {mat->kd_map, mat->ks_map, mat->height_map, mat->normal_map}) {
+    if (tex && tex->getId()) {
+      textures.insert(tex.get());
+    }
+  }
+  for (auto &child : obj->getChildren()) {
+    collectTextures(child.get(), textures);
+  }
+}
+
+TextureMemory Scene::getTextureMemory() const {
+  std::unordered_set<const Texture *> textures;
+  for (auto &obj : objects) {
+    collectTextures(obj.get(), textures);
+  }
+  TextureMemory memory;
+  for (auto tex : textures) {
+    ++memory.textures;
+    memory.bytes += tex->getByteSize();
+    memory.rgba8Bytes += tex->getRGBA8ByteSize();
+  }
+  return memory;
+}
+
+static int selectLod(const AbstractMeshBase &mesh, float radiusPx, const LodSettings &settings) {
+  if (2.f * radiusPx < settings.minScreenSize) {
+    return -1;
+  }
+  int level = 0;
+  for (uint32_t i = 1; i < mesh.getLodCount(); ++i) {
+    if (mesh.getLodError(i) * radiusPx > settings.errorThreshold) {
+      break;
+    }
+    level = i;
+  }
+  return level;
+}
+
+// streamed textures pick their resident levels from the largest request
+static void requestTextures(const PBRMaterial &mat, float screenSize) {
+  for (auto tex : {mat.kd_map.get(), mat.ks_map.get(), mat.height_map.get(),
+                   mat.normal_map.get()}) {
+    if (tex && tex->isStreamed()) {
+      tex->requestScreenSize(screenSize);
+    }
+  }
+}
+
+void Scene::updateLods(const CameraSpec &camera, int viewHeight, const LodSettings &view,
+                       const LodSettings &shadow) {
+  OPTIFUSER_PROFILE_SCOPE("Scene::updateLods");
+  glm::mat4 viewMat = camera.getViewMat();
+  glm::mat4 projMat = camera.getProjectionMat();
+  for (auto list : {&data.opaque, &data.transparent}) {
+    for (uint32_t i : *list) {
+      Object *obj = data.objects[i];
+      const glm::vec4 &sphere = data.bounds[i];
+      if (sphere.w < 0.f) {
+        obj->lodLevel = obj->shadowLodLevel = data.lodLevels[i] = data.shadowLodLevels[i] = 0;
+        requestTextures(*data.material(i), FLT_MAX);
+        continue;
+      }
+      glm::vec3 center = sphere;
+      float radius = sphere.w;
+      float radiusPx =
+          CameraSpec::getProjectedRadius(viewMat, projMat, center, radius) * viewHeight * 0.5f;
+
+      auto mesh = data.mesh(i);
+      float viewZ = (viewMat * glm::vec4(center, 1.f)).z;
+      // objects behind the camera keep full LODs for shadows, but are not drawn in the view
+      bool behindNear = viewZ - radius > -camera.near;
+      obj->lodLevel = data.lodLevels[i] = behindNear ? -1 : selectLod(*mesh, radiusPx, view);
+      obj->shadowLodLevel = data.shadowLodLevels[i] = selectLod(*mesh, radiusPx, shadow);
+      if (data.lodLevels[i] >= 0 && viewZ < radius) {
+        requestTextures(*data.material(i), 2.f * radiusPx);
+      }
+    }
   }
 }
 
@@ -1,151 +1,420 @@
 #include "shader.h"
+#include "gl_context.h"
+#include "gl_stats.h"
+#include <algorithm>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <list>
+#include <map>
+#include <mutex>
 #include <sstream>
+#include <thread>
 #include <vector>
 
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/gtx/string_cast.hpp>
+namespace fs = std::filesystem;
+
 namespace Optifuser {
-Shader::Shader(const GLchar *vertexPath, const GLchar *fragmentPath) {
-  // Create the shaders
-  GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-  GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
-
-  // Read the Vertex Shader code from the file
-  std::string VertexShaderCode;
-  std::ifstream VertexShaderStream(vertexPath, std::ios::in);
-  if (VertexShaderStream.is_open()) {
-    std::stringstream sstr;
-    sstr << VertexShaderStream.rdbuf();
-    VertexShaderCode = sstr.str();
-    VertexShaderStream.close();
-  } else {
-    printf("Impossible to open %s. Are you in the right directory ? Don't "
-           "forget to read the FAQ !\n",
-           vertexPath);
-    getchar();
+// FNV-1a, only used to name cache entries
+static uint64_t hashString(const std::string &str, uint64_t hash = 14695981039346656037ull) {
+  for (unsigned char c : str) {
+    hash = (hash ^ c) * 1099511628211ull;
+  }
+  return (hash ^ 0xff) * 1099511628211ull;
+}
+
+static bool readSource(const std::string &path, std::string &code) {
+  std::ifstream stream(path, std::ios::in);
+  if (!stream.is_open()) {
+    return false;
+  }
+  std::stringstream sstr;
+  sstr << stream.rdbuf();
+  code = sstr.str();
+  return true;
+}
+
+static std::mutex cacheMutex;
+static bool cacheDirectoryResolved = false;
+static std::string cacheDirectory;
+
+void setShaderCacheDirectory(const std::string &directory) {
+  std::lock_guard<std::mutex> lock(cacheMutex);
+  cacheDirectory = directory;
+  cacheDirectoryResolved = true;
+}
+
+std::string getShaderCacheDirectory() {
+  std::lock_guard<std::mutex> lock(cacheMutex);
+  if (!cacheDirectoryResolved) {
+    cacheDirectoryResolved = true;
+    if (const char *env = std::getenv("OPTIFUSER_SHADER_CACHE")) {
+      cacheDirectory = env;
+    } else if (const char *xdg = std::getenv("XDG_CACHE_HOME"); xdg && xdg[0]) {
+      cacheDirectory = std::string(xdg) + "/optifuser/shaders";
+    } else if (const char *home = std::getenv("HOME"); home && home[0]) {
+      cacheDirectory = std::string(home) + "/.cache/optifuser/shaders";
+    }
+  }
+  return cacheDirectory;
+}
+
+static const uint32_t PROGRAM_BINARY_MAGIC = 0x4250464f; // "OFPB"
+
+// empty when the driver cannot return program binaries or the cache is disabled
+static std::string programBinaryFile(const std::string &vertexCode,
+                                     const std::string &fragmentCode) {
+  if (!GLEW_VERSION_4_1 && !GLEW_ARB_get_program_binary) {
+    return "";
+  }
+  GLint formats = 0;
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+  std::string directory = getShaderCacheDirectory();
+  if (formats <= 0 || directory.empty()) {
+    return "";
+  }
+  // binaries are only valid for the driver that produced them
+  uint64_t hash = hashString(vertexCode);
+  hash = hashString(fragmentCode, hash);
+  for (GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION}) {
+    const char *str = reinterpret_cast<const char *>(glGetString(name));
+    hash = hashString(str ? str : "", hash);
+  }
+  char filename[32];
+  snprintf(filename, sizeof(filename), "/%016llx.bin", (unsigned long long)hash);
+  return directory + filename;
+}
+
+static bool loadProgramBinary(GLuint program, const std::string &filename) {
+  std::ifstream file(filename, std::ios::binary);
+  uint32_t header[3] = {}; // magic, format, size
+  if (!file.read(reinterpret_cast<char *>(header), sizeof(header)) ||
+      header[0] != PROGRAM_BINARY_MAGIC) {
+    return false;
+  }
+  std::vector<char> binary(header[2]);
+  if (!file.read(binary.data(), binary.size())) {
+    return false;
+  }
+  glProgramBinary(program, header[1], binary.data(), binary.size());
+  // a driver update invalidates binaries without changing the version string in some cases
+  GLint linked = GL_FALSE;
+  glGetProgramiv(program, GL_LINK_STATUS, &linked);
+  return linked == GL_TRUE;
+}
+
+static void saveProgramBinary(GLuint program, const std::string &filename) {
+  GLint size = 0;
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &size);
+  if (size <= 0) {
     return;
   }
+  std::vector<char> binary(size);
+  GLenum format = 0;
+  glGetProgramBinary(program, size, nullptr, &format, binary.data());
 
-  // Read the Fragment Shader code from the file
-  std::string FragmentShaderCode;
-  std::ifstream FragmentShaderStream(fragmentPath, std::ios::in);
-  if (FragmentShaderStream.is_open()) {
-    std::stringstream sstr;
-    sstr << FragmentShaderStream.rdbuf();
-    FragmentShaderCode = sstr.str();
-    FragmentShaderStream.close();
+  std::error_code ec;
+  fs::create_directories(fs::path(filename).parent_path(), ec);
+  // write and rename, other processes may be reading the same entry
+  std::ostringstream tmp;
+  tmp << filename << "." << std::this_thread::get_id() << ".tmp";
+  {
+    std::ofstream file(tmp.str(), std::ios::binary);
+    uint32_t header[3] = {PROGRAM_BINARY_MAGIC, format, uint32_t(size)};
+    file.write(reinterpret_cast<const char *>(header), sizeof(header));
+    file.write(binary.data(), binary.size());
+    if (!file) {
+      fs::remove(tmp.str(), ec);
+      return;
+    }
+  }
+  fs::rename(tmp.str(), filename, ec);
+  if (ec) {
+    fs::remove(tmp.str(), ec);
   }
+}
 
-  GLint Result = GL_FALSE;
-  int InfoLogLength;
+Shader::Shader(const GLchar *vertexPath, const GLchar *fragmentPath) {
+  std::string VertexShaderCode, FragmentShaderCode;
+  if (!readSource(vertexPath, VertexShaderCode)) {
+    fprintf(stderr, "Impossible to open %s. Are you in the right directory ?\n", vertexPath);
+    return;
+  }
+  if (!readSource(fragmentPath, FragmentShaderCode)) {
+    fprintf(stderr, "Impossible to open %s. Are you in the right directory ?\n", fragmentPath);
+    return;
+  }
+  build(VertexShaderCode, FragmentShaderCode, vertexPath, fragmentPath);
+}
 
-  // Compile Vertex Shader
+static void enableParallelCompile() {
+  static thread_local uint32_t enabledContext = ~0u;
+  if (enabledContext == currentGLContext.context) {
+    return;
+  }
+  enabledContext = currentGLContext.context;
+  // let the driver pick the number of compiler threads
+  if (GLEW_KHR_parallel_shader_compile) {
+    glMaxShaderCompilerThreadsKHR(0xffffffff);
+  } else if (GLEW_ARB_parallel_shader_compile) {
+    glMaxShaderCompilerThreadsARB(0xffffffff);
+  }
+}
+
+void Shader::build(const std::string &VertexShaderCode, const std::string &FragmentShaderCode,
+                   const char *vertexPath, const char *fragmentPath) {
+  label = std::string(vertexPath) + ", " + fragmentPath;
+  binaryFile = programBinaryFile(VertexShaderCode, FragmentShaderCode);
+  if (!binaryFile.empty()) {
+    GLuint ProgramID = glCreateProgram();
+    if (loadProgramBinary(ProgramID, binaryFile)) {
 #ifdef _VERBOSE
-  printf("Compiling shader : %s\n", vertexPath);
+      printf("Loaded program binary : %s\n", binaryFile.c_str());
 #endif
-  char const *VertexSourcePointer = VertexShaderCode.c_str();
-  glShaderSource(VertexShaderID, 1, &VertexSourcePointer, NULL);
-  glCompileShader(VertexShaderID);
-
-  // Check Vertex Shader
-  glGetShaderiv(VertexShaderID, GL_COMPILE_STATUS, &Result);
-  glGetShaderiv(VertexShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-  if (InfoLogLength > 0) {
-    std::vector<char> VertexShaderErrorMessage(InfoLogLength + 1);
-    glGetShaderInfoLog(VertexShaderID, InfoLogLength, NULL, &VertexShaderErrorMessage[0]);
-    printf("%s\n", &VertexShaderErrorMessage[0]);
+      Id = ProgramID;
+      linked = true;
+      return;
+    }
+    glDeleteProgram(ProgramID);
   }
+  enableParallelCompile();
 
-  // Compile Fragment Shader
+  // Issue the compiles and the link, errors are checked in finish()
 #ifdef _VERBOSE
-  printf("Compiling shader : %s\n", fragmentPath);
+  printf("Compiling program : %s\n", label.c_str());
 #endif
+  pendingVertex = glCreateShader(GL_VERTEX_SHADER);
+  char const *VertexSourcePointer = VertexShaderCode.c_str();
+  glShaderSource(pendingVertex, 1, &VertexSourcePointer, NULL);
+  glCompileShader(pendingVertex);
+
+  pendingFragment = glCreateShader(GL_FRAGMENT_SHADER);
   char const *FragmentSourcePointer = FragmentShaderCode.c_str();
-  glShaderSource(FragmentShaderID, 1, &FragmentSourcePointer, NULL);
-  glCompileShader(FragmentShaderID);
+  glShaderSource(pendingFragment, 1, &FragmentSourcePointer, NULL);
+  glCompileShader(pendingFragment);
 
-  // Check Fragment Shader
-  glGetShaderiv(FragmentShaderID, GL_COMPILE_STATUS, &Result);
-  glGetShaderiv(FragmentShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-  if (InfoLogLength > 0) {
-    std::vector<char> FragmentShaderErrorMessage(InfoLogLength + 1);
-    glGetShaderInfoLog(FragmentShaderID, InfoLogLength, NULL, &FragmentShaderErrorMessage[0]);
-    printf("%s\n", &FragmentShaderErrorMessage[0]);
+  Id = glCreateProgram();
+  if (!binaryFile.empty()) {
+    glProgramParameteri(Id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
   }
+  glAttachShader(Id, pendingVertex);
+  glAttachShader(Id, pendingFragment);
+  glLinkProgram(Id);
+  pending = true;
+}
 
-// Link the program
-#ifdef _VERBOSE
-  printf("Linking program\n");
-#endif
-  GLuint ProgramID = glCreateProgram();
-  glAttachShader(ProgramID, VertexShaderID);
-  glAttachShader(ProgramID, FragmentShaderID);
-  glLinkProgram(ProgramID);
-
-  // Check the program
-  glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
-  glGetProgramiv(ProgramID, GL_INFO_LOG_LENGTH, &InfoLogLength);
+bool Shader::isReady() const {
+  if (!pending) {
+    return true;
+  }
+  // without the extension the status query would block, report ready and let finish() wait
+  if (!GLEW_KHR_parallel_shader_compile && !GLEW_ARB_parallel_shader_compile) {
+    return true;
+  }
+  GLint done = GL_FALSE;
+  glGetProgramiv(Id, GL_COMPLETION_STATUS_KHR, &done);
+  return done == GL_TRUE;
+}
+
+static void printInfoLog(GLuint id, bool program) {
+  int InfoLogLength = 0;
+  if (program) {
+    glGetProgramiv(id, GL_INFO_LOG_LENGTH, &InfoLogLength);
+  } else {
+    glGetShaderiv(id, GL_INFO_LOG_LENGTH, &InfoLogLength);
+  }
   if (InfoLogLength > 0) {
-    std::vector<char> ProgramErrorMessage(InfoLogLength + 1);
-    glGetProgramInfoLog(ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
-    printf("%s\n", &ProgramErrorMessage[0]);
+    std::vector<char> message(InfoLogLength + 1);
+    if (program) {
+      glGetProgramInfoLog(id, InfoLogLength, NULL, &message[0]);
+    } else {
+      glGetShaderInfoLog(id, InfoLogLength, NULL, &message[0]);
+    }
+    printf("%s\n", &message[0]);
+  }
+}
+
+bool Shader::finish() const {
+  if (!pending) {
+    return linked;
+  }
+  pending = false;
+
+  printInfoLog(pendingVertex, false);
+  printInfoLog(pendingFragment, false);
+
+  GLint Result = GL_FALSE;
+  glGetProgramiv(Id, GL_LINK_STATUS, &Result);
+  printInfoLog(Id, true);
+  linked = Result == GL_TRUE;
+  if (!linked) {
+    fprintf(stderr, "Failed to link program %s\n", label.c_str());
+  }
+
+  glDetachShader(Id, pendingVertex);
+  glDetachShader(Id, pendingFragment);
+  glDeleteShader(pendingVertex);
+  glDeleteShader(pendingFragment);
+  pendingVertex = pendingFragment = 0;
+
+  if (linked && !binaryFile.empty()) {
+    saveProgramBinary(Id, binaryFile);
+  }
+  return linked;
+}
+
+// never destroyed, programs may outlive every context at exit; the passes own the
+// programs while they use them
+static auto *programs = new std::map<std::pair<uint64_t, uint32_t>, std::weak_ptr<Shader>>;
+// recently loaded programs per context, most recent first, so switching back to a shader
+// dropped by its slot reuses the program; programs replaced by a reload age out of it
+static auto *recentPrograms = new std::map<uint32_t, std::list<std::shared_ptr<Shader>>>;
+static constexpr size_t RELEASED_PROGRAMS_KEPT = 8;
+
+// holding cacheMutex, on the thread the context is current on since it may delete programs
+static void touchProgram(uint32_t context, const std::shared_ptr<Shader> &shader) {
+  auto &recent = (*recentPrograms)[context];
+  auto it = std::find(recent.begin(), recent.end(), shader);
+  if (it != recent.end()) {
+    recent.splice(recent.begin(), recent, it);
+  } else {
+    recent.push_front(shader);
+  }
+  // held only by this list, so nothing renders with it any more
+  size_t released = 0;
+  for (auto it = recent.begin(); it != recent.end();) {
+    if (it->use_count() == 1 && ++released > RELEASED_PROGRAMS_KEPT) {
+      it = recent.erase(it);
+    } else {
+      ++it;
+    }
   }
+}
 
-  glDetachShader(ProgramID, VertexShaderID);
-  glDetachShader(ProgramID, FragmentShaderID);
+std::shared_ptr<Shader> LoadShader(const std::string &vertexPath,
+                                   const std::string &fragmentPath) {
+  std::string vertexCode, fragmentCode;
+  if (!readSource(vertexPath, vertexCode) || !readSource(fragmentPath, fragmentCode)) {
+    // not cached, the constructor reports the error and leaves the program empty
+    return std::make_shared<Shader>(vertexPath.c_str(), fragmentPath.c_str());
+  }
+  // uniforms are program state, programs are not shared by contexts on different threads
+  std::pair<uint64_t, uint32_t> key = {hashString(fragmentCode, hashString(vertexCode)),
+                                       currentGLContext.context};
+  {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    auto it = programs->find(key);
+    if (it != programs->end()) {
+      if (auto shader = it->second.lock()) {
+        touchProgram(key.second, shader);
+        return shader;
+      }
+    }
+  }
+  std::shared_ptr<Shader> shader(new Shader);
+  shader->build(vertexCode, fragmentCode, vertexPath.c_str(), fragmentPath.c_str());
 
-  glDeleteShader(VertexShaderID);
-  glDeleteShader(FragmentShaderID);
+  std::lock_guard<std::mutex> lock(cacheMutex);
+  // drop the entries of deleted programs, another thread may have built this one meanwhile
+  for (auto it = programs->begin(); it != programs->end();) {
+    if (it->first != key && it->second.expired()) {
+      it = programs->erase(it);
+    } else {
+      ++it;
+    }
+  }
+  auto &entry = (*programs)[key];
+  if (auto existing = entry.lock()) {
+    shader = existing;
+  } else {
+    entry = shader;
+  }
+  touchProgram(key.second, shader);
+  return shader;
+}
 
-  Id = ProgramID;
+void releaseShaderCache(uint32_t context) {
+  std::lock_guard<std::mutex> lock(cacheMutex);
+  recentPrograms->erase(context);
+  for (auto it = programs->begin(); it != programs->end();) {
+    if (it->first.second == context) {
+      it = programs->erase(it);
+    } else {
+      ++it;
+    }
+  }
 }
 
-Shader::~Shader() { glDeleteProgram(Id); }
+Shader::~Shader() {
+  glDeleteShader(pendingVertex);
+  glDeleteShader(pendingFragment);
+  glDeleteProgram(Id);
+}
 
-void Shader::use() const { glUseProgram(Id); }
+void Shader::use() const {
+  if (pending) {
+    finish();
+  }
+  glUseProgram(Id);
+  ++glCounters.programSwitches;
+}
 
 void Shader::setBool(const std::string &name, bool value) const {
   GLint variableId = glGetUniformLocation(Id, name.c_str());
-  if (variableId != -1)
+  if (variableId != -1) {
     glUniform1i(variableId, (int)value);
+    ++glCounters.uniformUploads;
+  }
 }
 
 void Shader::setInt(const std::string &name, int value) const {
   GLint variableId = glGetUniformLocation(Id, name.c_str());
-  if (variableId != -1)
+  if (variableId != -1) {
     glUniform1i(variableId, value);
+    ++glCounters.uniformUploads;
+  }
 }
 
 void Shader::setFloat(const std::string &name, float value) const {
   GLint variableId = glGetUniformLocation(Id, name.c_str());
-  if (variableId != -1)
+  if (variableId != -1) {
     glUniform1f(variableId, value);
+    ++glCounters.uniformUploads;
+  }
 }
 
 void Shader::setMatrix(const std::string &name, const glm::mat4 &mat, bool transpose) const {
   GLint variableId = glGetUniformLocation(Id, name.c_str());
-  if (variableId != -1)
+  if (variableId != -1) {
     glUniformMatrix4fv(variableId, 1, transpose, &mat[0][0]);
+    ++glCounters.uniformUploads;
+  }
 }
 
 void Shader::setVec2(const std::string &name, const glm::vec2 &vec) const {
   GLint variableId = glGetUniformLocation(Id, name.c_str());
-  if (variableId != -1)
+  if (variableId != -1) {
     glUniform2f(variableId, vec[0], vec[1]);
+    ++glCounters.uniformUploads;
+  }
 }
 
 void Shader::setVec3(const std::string &name, const glm::vec3 &vec) const {
   GLint variableId = glGetUniformLocation(Id, name.c_str());
-  if (variableId != -1)
+  if (variableId != -1) {
     glUniform3f(variableId, vec[0], vec[1], vec[2]);
+    ++glCounters.uniformUploads;
+  }
 }
 
 void Shader::setVec4(const std::string &name, const glm::vec4 &vec) const {
   GLint variableId = glGetUniformLocation(Id, name.c_str());
-  if (variableId != -1)
+  if (variableId != -1) {
     glUniform4f(variableId, vec[0], vec[1], vec[2], vec[3]);
+    ++glCounters.uniformUploads;
+  }
 }
 
 void Shader::setUserData(const std::string &name, uint32_t size, float const *data) const {
@@ -160,6 +429,7 @@ void Shader::setUserData(const std::string &name, uint32_t size, float const *da
   }
   if (variableId != -1) {
     glUniformMatrix4fv(variableId, 1, GL_FALSE, &mat[0][0]);
+    ++glCounters.uniformUploads;
   }
 }
 
@@ -169,6 +439,8 @@ void Shader::setTexture(const std::string &name, GLuint textureId, GLint n) cons
     glUniform1i(variableId, n);
     glActiveTexture(GL_TEXTURE0 + n);
     glBindTexture(GL_TEXTURE_2D, textureId);
+    ++glCounters.uniformUploads;
+    ++glCounters.textureBinds;
   }
 }
 
@@ -178,7 +450,37 @@ void Shader::setCubemap(const std::string &name, GLuint textureId, GLint n) cons
     glUniform1i(variableId, n);
     glActiveTexture(GL_TEXTURE0 + n);
     glBindTexture(GL_TEXTURE_CUBE_MAP, textureId);
+    ++glCounters.uniformUploads;
+    ++glCounters.textureBinds;
+  }
+}
+
+ShaderSlot &ShaderSlot::operator=(std::shared_ptr<Shader> shader) {
+  if (shader == current) {
+    next.reset();
+  } else {
+    next = std::move(shader);
+  }
+  return *this;
+}
+
+void ShaderSlot::update() {
+  if (next && next->isReady()) {
+    // a replacement that failed to compile keeps the working program
+    if (next->finish() || !current) {
+      current = next;
+    }
+    next.reset();
+  }
+}
+
+Shader *ShaderSlot::get() const {
+  if (!current && next) {
+    // nothing to fall back to, wait for the first program
+    next->finish();
+    current = std::move(next);
   }
+  return current.get();
 }
 
 } // namespace Optifuser
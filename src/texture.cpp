@@ -1,5 +1,9 @@
 #include "texture.h"
 #include "debug.h"
+#include "gl_stats.h"
+#include "profiler.h"
+#include "texture_streamer.h"
+#include <algorithm>
 #include <iostream>
 #include <random>
 
@@ -14,66 +18,270 @@ namespace Optifuser {
 const Texture Texture::Empty;
 
 void Texture::load(const std::string &filename, int mipmap, int wrapping, int minFilter,
-                   int magFilter) {
-  if (id)
+                   int magFilter, TextureUsage usage) {
+  if (mCreation || id)
     destroy();
 
-  glActiveTexture(GL_TEXTURE0);
-  glGenTextures(1, &id);
-  glBindTexture(GL_TEXTURE_2D, id);
-
   int width, height, nrChannels;
-  unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrChannels, STBI_rgb_alpha);
+  // normal maps are loaded as RGB and packed to RG, stb's two channel images are grey and alpha
+  int channels = usage == TextureUsage::Height ? 1 : usage == TextureUsage::Normal ? 2 : 4;
+  std::shared_ptr<unsigned char> data(
+      stbi_load(filename.c_str(), &width, &height, &nrChannels, channels == 2 ? 3 : channels),
+      stbi_image_free);
   if (!data) {
     return;
   }
+  if (channels == 2) {
+    for (int i = 0; i < width * height; ++i) {
+      data.get()[i * 2] = data.get()[i * 3];
+      data.get()[i * 2 + 1] = data.get()[i * 3 + 1];
+    }
+  }
 
-  glTexStorage2D(GL_TEXTURE_2D, 4, GL_RGBA8, width, height);
-  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, data);
-  glGenerateMipmap(GL_TEXTURE_2D);
-
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrapping);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrapping);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minFilter);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, magFilter);
+  GLenum internalFormat = GL_RGBA8, format = GL_RGBA;
+  bool srgb = false;
+  if (usage == TextureUsage::Height) {
+    internalFormat = GL_R8;
+    format = GL_RED;
+  } else if (usage == TextureUsage::Normal) {
+    internalFormat = GL_RG8;
+    format = GL_RG;
+  } else if (textureLoading.srgbColor) {
+    internalFormat = GL_SRGB8_ALPHA8;
+    srgb = true;
+  }
 
-  stbi_image_free(data);
-  LABEL_TEXTURE(id, filename);
+  int levels = MipLevelCount(width, height);
+  std::vector<std::vector<uint8_t>> chain;
+  if (textureLoading.cpuMipmaps) {
+    chain = GenerateMipChain(data.get(), width, height, channels, srgb, textureLoading.mipFilter,
+                             textureLoading.threadCount);
+    data = nullptr;
+  }
 
   mWidth = width;
   mHeight = height;
+  for (int level = 0, w = width, h = height; level < levels; ++level) {
+    mByteSize += size_t(w) * h * channels;
+    mRGBA8ByteSize += size_t(w) * h * 4;
+    w = std::max(1, w / 2);
+    h = std::max(1, h / 2);
+  }
+
+  mCreation = glCommands.submit([=, this, chain = std::move(chain)]() mutable {
+    glActiveTexture(GL_TEXTURE0);
+    glGenTextures(1, &id);
+    glBindTexture(GL_TEXTURE_2D, id);
+
+    glTexStorage2D(GL_TEXTURE_2D, levels, internalFormat, width, height);
+    // rows of R8 and RG8 images are not 4 byte aligned
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    if (UploadQueue *uploads = currentUploadQueue()) {
+      mUpload = std::make_shared<UploadTicket>();
+      if (!chain.empty()) {
+        int w = width, h = height;
+        for (int level = 0; level < levels; ++level) {
+          uploads->queueTexture(mUpload, id, level, w, h, format, GL_UNSIGNED_BYTE,
+                                std::move(chain[level]));
+          w = std::max(1, w / 2);
+          h = std::max(1, h / 2);
+        }
+      } else {
+        uploads->queueTexture(mUpload, id, 0, width, height, format, GL_UNSIGNED_BYTE,
+                              std::vector<uint8_t>(data.get(),
+                                                   data.get() + width * height * channels));
+        mUpload->onResident = [texture = id] {
+          glBindTexture(GL_TEXTURE_2D, texture);
+          glGenerateMipmap(GL_TEXTURE_2D);
+        };
+      }
+    } else if (!chain.empty()) {
+      int w = width, h = height;
+      for (int level = 0; level < levels; ++level) {
+        glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, w, h, format, GL_UNSIGNED_BYTE,
+                        chain[level].data());
+        ++glCounters.bufferUploads;
+        glCounters.uploadBytes += chain[level].size();
+        w = std::max(1, w / 2);
+        h = std::max(1, h / 2);
+      }
+    } else {
+      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, format, GL_UNSIGNED_BYTE,
+                      data.get());
+      ++glCounters.bufferUploads;
+      glCounters.uploadBytes += width * height * channels;
+      glGenerateMipmap(GL_TEXTURE_2D);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrapping);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrapping);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minFilter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, magFilter);
+    LABEL_TEXTURE(id, filename);
+  });
 }
 
-void Texture::loadFloat(std::vector<float> const &data, int width, int height, int wrapping,
-                        int minFilter, int magFilter) {
-  if (id)
+void Texture::loadCompressed(const std::string &filename, TextureUsage usage, int wrapping,
+                             int minFilter, int magFilter) {
+  if (!textureLoading.compress) {
+    load(filename, 0, wrapping, minFilter, magFilter, usage);
+    return;
+  }
+
+  if (mCreation || id)
     destroy();
 
-  glActiveTexture(GL_TEXTURE0);
-  glGenTextures(1, &id);
-  glBindTexture(GL_TEXTURE_2D, id);
-  glTexStorage2D(GL_TEXTURE_2D, 1, GL_R32F, width, height);
-  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RED, GL_FLOAT, data.data());
+  // a cached encoding is kept as long as it is the format we would pick now, streamed
+  // textures only read their coarse levels
+  bool srgb = textureLoading.srgbColor;
+  TextureStreamer *streamer = textureLoading.streamer;
+  CompressedImage image;
+  size_t residentSize = streamer ? streamer->settings.residentSize : 0;
+  bool cached = textureLoading.readCache && ReadCompressedCache(filename, image, residentSize);
+  bool hasAlpha = image.format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT ||
+                  image.format == GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT;
+  if (!cached ||
+      image.format != ChooseCompressedFormat(usage, hasAlpha, textureLoading.preferBC7, srgb)) {
+    int width, height, nrChannels;
+    unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrChannels, STBI_rgb_alpha);
+    if (!data) {
+      return;
+    }
+    hasAlpha = false;
+    for (int i = 0; i < width * height && !hasAlpha; ++i) {
+      hasAlpha = data[i * 4 + 3] != 255;
+    }
+    GLenum format = ChooseCompressedFormat(usage, hasAlpha, textureLoading.preferBC7, srgb);
+    image = CompressImage(data, width, height, format, textureLoading.mipFilter,
+                          textureLoading.threadCount);
+    stbi_image_free(data);
+    if (textureLoading.writeCache && !WriteCompressedCache(filename, image)) {
+      std::cerr << "Failed to write " << CompressedCachePath(filename) << std::endl;
+    }
+  }
 
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrapping);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrapping);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minFilter);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, magFilter);
+  int w = image.width, h = image.height;
+  for (size_t level = 0; level < image.levels.size(); ++level) {
+    mRGBA8ByteSize += size_t(w) * h * 4;
+    if (!streamer) {
+      mByteSize += image.levels[level].size();
+    }
+    w = std::max(1, w / 2);
+    h = std::max(1, h / 2);
+  }
+  mWidth = image.width;
+  mHeight = image.height;
+  mCompressed = true;
+
+  mCreation = glCommands.submit([=, this, image = std::move(image)]() mutable {
+    glActiveTexture(GL_TEXTURE0);
+    glGenTextures(1, &id);
+    glBindTexture(GL_TEXTURE_2D, id);
+
+    if (streamer) {
+      streamer->add(this, filename, std::move(image));
+    } else {
+      glTexStorage2D(GL_TEXTURE_2D, image.levels.size(), image.format, image.width,
+                     image.height);
+      UploadQueue *uploads = currentUploadQueue();
+      if (uploads) {
+        mUpload = std::make_shared<UploadTicket>();
+      }
+      int w = image.width, h = image.height;
+      for (size_t level = 0; level < image.levels.size(); ++level) {
+        if (uploads) {
+          uploads->queueCompressedTexture(mUpload, id, level, w, h, image.format,
+                                          std::move(image.levels[level]));
+        } else {
+          glCompressedTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, w, h, image.format,
+                                    image.levels[level].size(), image.levels[level].data());
+          ++glCounters.bufferUploads;
+          glCounters.uploadBytes += image.levels[level].size();
+        }
+        w = std::max(1, w / 2);
+        h = std::max(1, h / 2);
+      }
+    }
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrapping);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrapping);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minFilter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, magFilter);
+    LABEL_TEXTURE(id, filename);
+  });
+}
+
+void Texture::loadFloat(std::vector<float> const &data, int width, int height, int wrapping,
+                        int minFilter, int magFilter) {
+  if (mCreation || id)
+    destroy();
 
   mWidth = width;
   mHeight = height;
+  mByteSize = size_t(width) * height * sizeof(float);
+  mRGBA8ByteSize = size_t(width) * height * 4;
+
+  mCreation = glCommands.submit([=, this] {
+    glActiveTexture(GL_TEXTURE0);
+    glGenTextures(1, &id);
+    glBindTexture(GL_TEXTURE_2D, id);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_R32F, width, height);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RED, GL_FLOAT, data.data());
+    ++glCounters.bufferUploads;
+    glCounters.uploadBytes += width * height * sizeof(float);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrapping);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrapping);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minFilter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, magFilter);
+  });
 }
 
 void Texture::destroy() {
-  glDeleteTextures(1, &id);
+  if (!glCommands.isGLThread()) {
+    // the GL side may not be created yet, it is released in order on the render thread
+    glCommands.synchronize([this] {
+      if (mCreation) {
+        mCreation->cancelled = true;
+      }
+      if (id) {
+        glCommands.push([texture = id, streamer = mStreamer, upload = mUpload, self = this] {
+          if (streamer) {
+            streamer->remove(self);
+          }
+          if (upload) {
+            upload->cancelled = true;
+          }
+          glDeleteTextures(1, &texture);
+        });
+      }
+    });
+  } else {
+    if (mCreation) {
+      mCreation->cancelled = true;
+    }
+    if (mStreamer) {
+      mStreamer->remove(this);
+    }
+    if (mUpload) {
+      mUpload->cancelled = true;
+    }
+    glDeleteTextures(1, &id);
+  }
+  mCreation = nullptr;
+  mStreamer = nullptr;
+  mUpload = nullptr;
   id = 0;
   mWidth = 0;
   mHeight = 0;
+  mByteSize = 0;
+  mRGBA8ByteSize = 0;
+  mCompressed = false;
 }
 
 std::shared_ptr<Texture> CreateRandomTexture(int width, int height, int seed) {
   auto tex = std::make_shared<Texture>();
-  glActiveTexture(GL_TEXTURE0);
 
   std::mt19937 mt(seed);
   std::uniform_real_distribution<float> dist(0, 1);
@@ -89,9 +297,19 @@ std::shared_ptr<Texture> CreateRandomTexture(int width, int height, int seed) {
 }
 
 std::shared_ptr<Texture> LoadTexture(const std::string &filename, int mipmap, int wrapping,
-                                     int minFilter, int maxFilter) {
+                                     int minFilter, int maxFilter, TextureUsage usage) {
+  auto tex = std::make_shared<Texture>();
+  tex->load(filename, mipmap, wrapping, minFilter, maxFilter, usage);
+  if (tex->getWidth() == 0) {
+    return nullptr;
+  }
+  return tex;
+}
+
+std::shared_ptr<Texture> LoadCompressedTexture(const std::string &filename, TextureUsage usage,
+                                               int wrapping, int minFilter, int magFilter) {
   auto tex = std::make_shared<Texture>();
-  tex->load(filename, mipmap, wrapping, minFilter, maxFilter);
+  tex->loadCompressed(filename, usage, wrapping, minFilter, magFilter);
   if (tex->getWidth() == 0) {
     return nullptr;
   }
@@ -113,50 +331,75 @@ void writeToFile(GLuint textureId, GLuint width, GLuint height, std::string file
   stbi_write_png(filename.c_str(), width, height, 4, data, width * 4);
 }
 
-void CubeMapTexture::loadCubeMapSide(GLuint texture, GLenum side, const std::string &filename,
-                                     bool texStorage) {
-  int width, height, nrChannels;
-  unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrChannels, 4);
-
-  if (this->width != 0 && (width != this->width || height != this->height)) {
-    std::cerr << "Cubemap is broken" << std::endl;
-    return;
-  }
-  this->width = width;
-  this->height = height;
-
-  if (texStorage) {
-    glTexStorage2D(GL_TEXTURE_CUBE_MAP, 1, GL_RGBA8, width, height);
-  }
-  glTexSubImage2D(side, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, data);
-
-  stbi_image_free(data);
-}
-
 void CubeMapTexture::load(const std::string &front, const std::string &back,
                           const std::string &top, const std::string &bottom,
                           const std::string &left, const std::string &right, int wrapping,
                           int filtering) {
-  if (id)
+  if (creation || id)
     destroy();
+  width = height = 0;
+
+  // decoded on the caller, in GL_TEXTURE_CUBE_MAP_POSITIVE_X + i order
+  std::vector<std::shared_ptr<unsigned char>> sides;
+  for (auto &filename : {right, left, top, bottom, back, front}) {
+    int sideWidth, sideHeight, nrChannels;
+    sides.emplace_back(stbi_load(filename.c_str(), &sideWidth, &sideHeight, &nrChannels, 4),
+                       stbi_image_free);
+    if (!sides.back()) {
+      std::cerr << "Failed to load cube map side " << filename << std::endl;
+      continue;
+    }
+    if (width != 0 && (sideWidth != width || sideHeight != height)) {
+      std::cerr << "Cubemap is broken" << std::endl;
+      sides.back() = nullptr;
+      continue;
+    }
+    width = sideWidth;
+    height = sideHeight;
+  }
+
+  creation = glCommands.submit([=, this] {
+    glGenTextures(1, &id);
+    printf("Cube map generated: %d\n", id);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, id);
+    glTexStorage2D(GL_TEXTURE_CUBE_MAP, 1, GL_RGBA8, width, height);
+    for (int i = 0; i < 6; ++i) {
+      if (!sides[i]) {
+        continue;
+      }
+      glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, 0, 0, width, height, GL_RGBA,
+                      GL_UNSIGNED_BYTE, sides[i].get());
+      ++glCounters.bufferUploads;
+      glCounters.uploadBytes += width * height * 4;
+    }
+
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, filtering);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, filtering);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, wrapping);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, wrapping);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, wrapping);
+    glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+  });
+}
 
-  glGenTextures(1, &id);
-  printf("Cube map generated: %d\n", id);
-  glBindTexture(GL_TEXTURE_CUBE_MAP, id);
-
-  loadCubeMapSide(id, GL_TEXTURE_CUBE_MAP_POSITIVE_X, right, true);
-  loadCubeMapSide(id, GL_TEXTURE_CUBE_MAP_NEGATIVE_X, left);
-  loadCubeMapSide(id, GL_TEXTURE_CUBE_MAP_POSITIVE_Y, top);
-  loadCubeMapSide(id, GL_TEXTURE_CUBE_MAP_NEGATIVE_Y, bottom);
-  loadCubeMapSide(id, GL_TEXTURE_CUBE_MAP_POSITIVE_Z, back);
-  loadCubeMapSide(id, GL_TEXTURE_CUBE_MAP_NEGATIVE_Z, front);
-
-  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, filtering);
-  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, filtering);
-  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, wrapping);
-  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, wrapping);
-  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, wrapping);
-  glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+void CubeMapTexture::destroy() {
+  if (!glCommands.isGLThread()) {
+    glCommands.synchronize([this] {
+      if (creation) {
+        creation->cancelled = true;
+      }
+      if (id) {
+        glCommands.push([texture = id] { glDeleteTextures(1, &texture); });
+      }
+    });
+  } else {
+    if (creation) {
+      creation->cancelled = true;
+    }
+    glDeleteTextures(1, &id);
+  }
+  creation = nullptr;
+  id = 0;
 }
 
 std::shared_ptr<CubeMapTexture>
@@ -209,11 +452,34 @@ void writeTextureDepthFloat32Raw(GLuint textureId, GLuint width, GLuint height,
   metafile.close();
 }
 
+// reads the bottom left width x height texels; render targets can be larger than the view, e.g.
+// when they are reused after a resize or rendered at a reduced resolution
+template <typename T>
+static void readTexture(GLuint textureId, GLenum format, GLenum type, uint32_t channels,
+                        GLuint width, GLuint height, T *data) {
+  glBindTexture(GL_TEXTURE_2D, textureId);
+  GLint textureWidth = 0, textureHeight = 0;
+  glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &textureWidth);
+  glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &textureHeight);
+  if (GLuint(textureWidth) == width && GLuint(textureHeight) == height) {
+    glGetTexImage(GL_TEXTURE_2D, 0, format, type, data);
+    return;
+  }
+  std::vector<T> full(size_t(textureWidth) * textureHeight * channels);
+  glGetTexImage(GL_TEXTURE_2D, 0, format, type, full.data());
+  for (uint32_t row = 0; row < height; ++row) {
+    std::copy_n(full.data() + size_t(row) * textureWidth * channels, width * channels,
+                data + size_t(row) * width * channels);
+  }
+}
+
 std::vector<float> getDepthFloat32Texture(GLuint textureId, GLuint width, GLuint height) {
+  OPTIFUSER_PROFILE_SCOPE("getDepthFloat32Texture");
+  ++glCounters.readbacks;
+  glCounters.readbackBytes += width * height * sizeof(float);
   std::vector<float> output(width * height);
   float *data = output.data();
-  glBindTexture(GL_TEXTURE_2D, textureId);
-  glGetTexImage(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, GL_FLOAT, data);
+  readTexture(textureId, GL_DEPTH_COMPONENT, GL_FLOAT, 1, width, height, data);
   for (uint32_t h1 = 0; h1 < height / 2; ++h1) {
     uint32_t h2 = height - 1 - h1;
     for (uint32_t i = 0; i < width; ++i) {
@@ -224,10 +490,12 @@ std::vector<float> getDepthFloat32Texture(GLuint textureId, GLuint width, GLuint
 }
 
 std::vector<float> getRGBAFloat32Texture(GLuint textureId, GLuint width, GLuint height) {
+  OPTIFUSER_PROFILE_SCOPE("getRGBAFloat32Texture");
+  ++glCounters.readbacks;
+  glCounters.readbackBytes += width * height * 4 * sizeof(float);
   std::vector<float> output(width * height * 4);
   float *data = output.data();
-  glBindTexture(GL_TEXTURE_2D, textureId);
-  glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, data);
+  readTexture(textureId, GL_RGBA, GL_FLOAT, 4, width, height, data);
   for (uint32_t h1 = 0; h1 < height / 2; ++h1) {
     uint32_t h2 = height - 1 - h1;
     for (uint32_t i = 0; i < 4 * width; ++i) {
@@ -237,11 +505,29 @@ std::vector<float> getRGBAFloat32Texture(GLuint textureId, GLuint width, GLuint
   return output;
 }
 
+std::vector<float> getRGFloat32Texture(GLuint textureId, GLuint width, GLuint height) {
+  OPTIFUSER_PROFILE_SCOPE("getRGFloat32Texture");
+  ++glCounters.readbacks;
+  glCounters.readbackBytes += width * height * 2 * sizeof(float);
+  std::vector<float> output(width * height * 2);
+  float *data = output.data();
+  readTexture(textureId, GL_RG, GL_FLOAT, 2, width, height, data);
+  for (uint32_t h1 = 0; h1 < height / 2; ++h1) {
+    uint32_t h2 = height - 1 - h1;
+    for (uint32_t i = 0; i < 2 * width; ++i) {
+      std::swap(data[h1 * width * 2 + i], data[h2 * width * 2 + i]);
+    }
+  }
+  return output;
+}
+
 std::vector<int> getInt32Texture(GLuint textureId, GLuint width, GLuint height) {
+  OPTIFUSER_PROFILE_SCOPE("getInt32Texture");
+  ++glCounters.readbacks;
+  glCounters.readbackBytes += width * height * sizeof(int);
   std::vector<int> output(width * height);
   int *data = output.data();
-  glBindTexture(GL_TEXTURE_2D, textureId);
-  glGetTexImage(GL_TEXTURE_2D, 0, GL_RED_INTEGER, GL_INT, data);
+  readTexture(textureId, GL_RED_INTEGER, GL_INT, 1, width, height, data);
   for (uint32_t h1 = 0; h1 < height / 2; ++h1) {
     uint32_t h2 = height - 1 - h1;
     for (uint32_t i = 0; i < width; ++i) {
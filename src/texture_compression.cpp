@@ -0,0 +1,481 @@
+#include "texture_compression.h"
+#include "profiler.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+namespace Optifuser {
+
+GLenum ChooseCompressedFormat(TextureUsage usage, bool hasAlpha, bool preferBC7, bool srgb) {
+  switch (usage) {
+  case TextureUsage::Normal:
+    return GL_COMPRESSED_RG_RGTC2;
+  case TextureUsage::Height:
+    return GL_COMPRESSED_RED_RGTC1;
+  case TextureUsage::Color:
+    break;
+  }
+  if (preferBC7 || !GLEW_EXT_texture_compression_s3tc) {
+    return srgb ? GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM : GL_COMPRESSED_RGBA_BPTC_UNORM;
+  }
+  if (hasAlpha) {
+    return srgb ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+  }
+  return srgb ? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+}
+
+static bool isSrgb(GLenum format) {
+  return format == GL_COMPRESSED_SRGB_S3TC_DXT1_EXT ||
+         format == GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT ||
+         format == GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM;
+}
+
+static uint32_t blockBytes(GLenum format) {
+  return format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT || format == GL_COMPRESSED_SRGB_S3TC_DXT1_EXT ||
+                 format == GL_COMPRESSED_RED_RGTC1
+             ? 8
+             : 16;
+}
+
+//============ block encoders ============//
+
+// principal axis of the block colors, the endpoints are the extreme projections
+static void fitEndpoints(const uint8_t block[16][4], int channels, float e0[4], float e1[4]) {
+  float mean[4] = {0, 0, 0, 0};
+  for (int i = 0; i < 16; ++i) {
+    for (int c = 0; c < channels; ++c) {
+      mean[c] += block[i][c] / 16.f;
+    }
+  }
+  float cov[4][4] = {};
+  for (int i = 0; i < 16; ++i) {
+    for (int a = 0; a < channels; ++a) {
+      for (int b = 0; b < channels; ++b) {
+        cov[a][b] += (block[i][a] - mean[a]) * (block[i][b] - mean[b]);
+      }
+    }
+  }
+  float axis[4] = {1, 1, 1, 1};
+  for (int iter = 0; iter < 8; ++iter) {
+    float next[4] = {0, 0, 0, 0};
+    float len = 0;
+    for (int a = 0; a < channels; ++a) {
+      for (int b = 0; b < channels; ++b) {
+        next[a] += cov[a][b] * axis[b];
+      }
+      len = std::max(len, std::abs(next[a]));
+    }
+    if (len < 1e-6f) {
+      break; // flat block
+    }
+    for (int a = 0; a < channels; ++a) {
+      axis[a] = next[a] / len;
+    }
+  }
+
+  float lo = 1e30f, hi = -1e30f;
+  for (int i = 0; i < 16; ++i) {
+    float t = 0;
+    for (int c = 0; c < channels; ++c) {
+      t += (block[i][c] - mean[c]) * axis[c];
+    }
+    lo = std::min(lo, t);
+    hi = std::max(hi, t);
+  }
+  float len2 = 0;
+  for (int c = 0; c < channels; ++c) {
+    len2 += axis[c] * axis[c];
+  }
+  for (int c = 0; c < channels; ++c) {
+    float a = len2 > 0 ? axis[c] / len2 : 0;
+    e0[c] = std::clamp(mean[c] + a * hi, 0.f, 255.f);
+    e1[c] = std::clamp(mean[c] + a * lo, 0.f, 255.f);
+  }
+}
+
+static uint16_t packRGB565(const float c[4]) {
+  int r = int(c[0] * 31.f / 255.f + 0.5f);
+  int g = int(c[1] * 63.f / 255.f + 0.5f);
+  int b = int(c[2] * 31.f / 255.f + 0.5f);
+  return uint16_t((r << 11) | (g << 5) | b);
+}
+
+static void unpackRGB565(uint16_t v, int c[3]) {
+  int r = v >> 11, g = (v >> 5) & 63, b = v & 31;
+  c[0] = (r << 3) | (r >> 2);
+  c[1] = (g << 2) | (g >> 4);
+  c[2] = (b << 3) | (b >> 2);
+}
+
+// BC1 color block in four color mode, 8 bytes
+static void encodeBC1(const uint8_t block[16][4], uint8_t *out) {
+  float e0[4], e1[4];
+  fitEndpoints(block, 3, e0, e1);
+  uint16_t c0 = packRGB565(e0);
+  uint16_t c1 = packRGB565(e1);
+  if (c0 < c1) {
+    std::swap(c0, c1);
+  }
+  uint32_t indices = 0;
+  if (c0 != c1) {
+    int palette[4][3];
+    unpackRGB565(c0, palette[0]);
+    unpackRGB565(c1, palette[1]);
+    for (int c = 0; c < 3; ++c) {
+      palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+      palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+    for (int i = 0; i < 16; ++i) {
+      int best = 0, bestError = INT32_MAX;
+      for (int p = 0; p < 4; ++p) {
+        int error = 0;
+        for (int c = 0; c < 3; ++c) {
+          int d = block[i][c] - palette[p][c];
+          error += d * d;
+        }
+        if (error < bestError) {
+          bestError = error;
+          best = p;
+        }
+      }
+      indices |= uint32_t(best) << (2 * i);
+    }
+  }
+  out[0] = c0 & 0xff;
+  out[1] = c0 >> 8;
+  out[2] = c1 & 0xff;
+  out[3] = c1 >> 8;
+  memcpy(out + 4, &indices, 4);
+}
+
+// BC4 block of one channel in eight value mode, 8 bytes
+static void encodeBC4(const uint8_t block[16][4], int channel, uint8_t *out) {
+  int lo = 255, hi = 0;
+  for (int i = 0; i < 16; ++i) {
+    lo = std::min(lo, int(block[i][channel]));
+    hi = std::max(hi, int(block[i][channel]));
+  }
+  uint64_t indices = 0;
+  if (hi != lo) {
+    float palette[8] = {float(hi), float(lo)};
+    for (int p = 2; p < 8; ++p) {
+      palette[p] = ((8 - p) * hi + (p - 1) * lo) / 7.f;
+    }
+    for (int i = 0; i < 16; ++i) {
+      int best = 0;
+      float bestError = 1e30f;
+      for (int p = 0; p < 8; ++p) {
+        float error = std::abs(block[i][channel] - palette[p]);
+        if (error < bestError) {
+          bestError = error;
+          best = p;
+        }
+      }
+      indices |= uint64_t(best) << (3 * i);
+    }
+  }
+  out[0] = uint8_t(hi);
+  out[1] = uint8_t(lo);
+  for (int b = 0; b < 6; ++b) {
+    out[2 + b] = uint8_t(indices >> (8 * b));
+  }
+}
+
+// BC7 mode 6: one subset, RGBA endpoints with 7 bits and a p-bit, 4 bit indices
+static void encodeBC7(const uint8_t block[16][4], uint8_t *out) {
+  static const int weights[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+  float e[2][4];
+  fitEndpoints(block, 4, e[0], e[1]);
+  int q[2][4], pbit[2];
+  for (int k = 0; k < 2; ++k) {
+    float bestError = 1e30f;
+    for (int p = 0; p < 2; ++p) {
+      int candidate[4];
+      float error = 0;
+      for (int c = 0; c < 4; ++c) {
+        candidate[c] = std::clamp(int(std::lround((e[k][c] - p) / 2.f)), 0, 127);
+        float d = (candidate[c] << 1 | p) - e[k][c];
+        error += d * d;
+      }
+      if (error < bestError) {
+        bestError = error;
+        pbit[k] = p;
+        std::copy(candidate, candidate + 4, q[k]);
+      }
+    }
+  }
+
+  int index[16];
+  auto assign = [&]() {
+    int palette[16][4];
+    for (int w = 0; w < 16; ++w) {
+      for (int c = 0; c < 4; ++c) {
+        int a = q[0][c] << 1 | pbit[0], b = q[1][c] << 1 | pbit[1];
+        palette[w][c] = ((64 - weights[w]) * a + weights[w] * b + 32) >> 6;
+      }
+    }
+    for (int i = 0; i < 16; ++i) {
+      int best = 0, bestError = INT32_MAX;
+      for (int w = 0; w < 16; ++w) {
+        int error = 0;
+        for (int c = 0; c < 4; ++c) {
+          int d = block[i][c] - palette[w][c];
+          error += d * d;
+        }
+        if (error < bestError) {
+          bestError = error;
+          best = w;
+        }
+      }
+      index[i] = best;
+    }
+  };
+  assign();
+  // the anchor index is stored without its top bit
+  if (index[0] >= 8) {
+    std::swap(q[0], q[1]);
+    std::swap(pbit[0], pbit[1]);
+    for (int i = 0; i < 16; ++i) {
+      index[i] = 15 - index[i];
+    }
+  }
+
+  uint64_t bits[2] = {0, 0};
+  int pos = 0;
+  auto put = [&](uint64_t value, int count) {
+    for (int b = 0; b < count; ++b, ++pos) {
+      bits[pos / 64] |= ((value >> b) & 1) << (pos % 64);
+    }
+  };
+  put(1 << 6, 7);
+  for (int c = 0; c < 4; ++c) {
+    put(q[0][c], 7);
+    put(q[1][c], 7);
+  }
+  put(pbit[0], 1);
+  put(pbit[1], 1);
+  put(index[0], 3);
+  for (int i = 1; i < 16; ++i) {
+    put(index[i], 4);
+  }
+  memcpy(out, bits, 16);
+}
+
+static void encodeBlock(const uint8_t block[16][4], GLenum format, uint8_t *out) {
+  switch (format) {
+  case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+  case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT:
+    encodeBC1(block, out);
+    break;
+  case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+  case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT:
+    encodeBC4(block, 3, out);
+    encodeBC1(block, out + 8);
+    break;
+  case GL_COMPRESSED_RED_RGTC1:
+    encodeBC4(block, 0, out);
+    break;
+  case GL_COMPRESSED_RG_RGTC2:
+    encodeBC4(block, 0, out);
+    encodeBC4(block, 1, out + 8);
+    break;
+  default:
+    encodeBC7(block, out);
+    break;
+  }
+}
+
+//============ images ============//
+
+static void encodeRows(const uint8_t *rgba, int width, int height, GLenum format, int rowBegin,
+                       int rowEnd, uint8_t *out) {
+  int blocksX = (width + 3) / 4;
+  uint32_t size = blockBytes(format);
+  uint8_t block[16][4];
+  for (int by = rowBegin; by < rowEnd; ++by) {
+    for (int bx = 0; bx < blocksX; ++bx) {
+      // edge blocks repeat the last row and column
+      for (int i = 0; i < 16; ++i) {
+        int x = std::min(bx * 4 + i % 4, width - 1);
+        int y = std::min(by * 4 + i / 4, height - 1);
+        memcpy(block[i], rgba + (y * width + x) * 4, 4);
+      }
+      encodeBlock(block, format, out + (by * blocksX + bx) * size);
+    }
+  }
+}
+
+CompressedImage CompressImage(const uint8_t *rgba, int width, int height, GLenum format,
+                              MipFilter filter, uint32_t threadCount) {
+  OPTIFUSER_PROFILE_SCOPE("CompressImage");
+  if (threadCount == 0) {
+    threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+
+  CompressedImage image;
+  image.format = format;
+  image.width = width;
+  image.height = height;
+
+  auto chain = GenerateMipChain(rgba, width, height, 4, isSrgb(format), filter, threadCount);
+  int w = width, h = height;
+  for (auto &level : chain) {
+    int blocksY = (h + 3) / 4;
+    std::vector<uint8_t> encoded(CompressedLevelSize(format, w, h));
+
+    int bands = std::min<int>(threadCount, blocksY);
+    std::vector<std::thread> workers;
+    for (int t = 1; t < bands; ++t) {
+      workers.emplace_back(encodeRows, level.data(), w, h, format, blocksY * t / bands,
+                           blocksY * (t + 1) / bands, encoded.data());
+    }
+    encodeRows(level.data(), w, h, format, 0, blocksY / bands, encoded.data());
+    for (auto &worker : workers) {
+      worker.join();
+    }
+    image.levels.push_back(std::move(encoded));
+    w = std::max(1, w / 2);
+    h = std::max(1, h / 2);
+  }
+  return image;
+}
+
+//============ cache ============//
+
+static const uint32_t COMPRESSED_CACHE_MAGIC = 0x5842464f; // "OFBX"
+static const uint32_t COMPRESSED_CACHE_VERSION = 1;
+
+// mirrors the KTX2 header fields we need, followed by a level index and the levels
+struct CompressedCacheHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t format;
+  uint32_t width;
+  uint32_t height;
+  uint32_t levelCount;
+  uint64_t sourceSize;
+  int64_t sourceTime;
+};
+
+std::string CompressedCachePath(const std::string &filename) { return filename + ".bctex"; }
+
+static bool sourceStamp(const std::string &filename, uint64_t &size, int64_t &time) {
+  std::error_code ec;
+  size = fs::file_size(filename, ec);
+  if (ec) {
+    return false;
+  }
+  time = fs::last_write_time(filename, ec).time_since_epoch().count();
+  return !ec;
+}
+
+size_t CompressedLevelSize(GLenum format, int width, int height) {
+  return size_t((width + 3) / 4) * ((height + 3) / 4) * blockBytes(format);
+}
+
+uint64_t CompressedCacheLevelOffset(const CompressedImage &image, uint32_t level) {
+  uint64_t offset = sizeof(CompressedCacheHeader) + image.levels.size() * sizeof(uint64_t);
+  int w = image.width, h = image.height;
+  for (uint32_t i = 0; i < level; ++i) {
+    offset += CompressedLevelSize(image.format, w, h);
+    w = std::max(1, w / 2);
+    h = std::max(1, h / 2);
+  }
+  return offset;
+}
+
+bool ReadCompressedCache(const std::string &filename, CompressedImage &image, int maxSize) {
+  uint64_t sourceSize;
+  int64_t sourceTime;
+  if (!sourceStamp(filename, sourceSize, sourceTime)) {
+    return false;
+  }
+  std::ifstream file(CompressedCachePath(filename), std::ios::binary);
+  if (!file) {
+    return false;
+  }
+  CompressedCacheHeader header;
+  if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+      header.magic != COMPRESSED_CACHE_MAGIC || header.version != COMPRESSED_CACHE_VERSION ||
+      header.sourceSize != sourceSize || header.sourceTime != sourceTime ||
+      header.levelCount == 0 || header.levelCount > 32) {
+    return false;
+  }
+  std::vector<uint64_t> sizes(header.levelCount);
+  if (!file.read(reinterpret_cast<char *>(sizes.data()), sizes.size() * sizeof(uint64_t))) {
+    return false;
+  }
+
+  image.format = header.format;
+  image.width = header.width;
+  image.height = header.height;
+  image.levels.assign(header.levelCount, {});
+  int w = image.width, h = image.height;
+  for (uint32_t i = 0; i < header.levelCount; ++i) {
+    if (sizes[i] != CompressedLevelSize(image.format, w, h)) {
+      return false;
+    }
+    if (maxSize > 0 && std::max(w, h) > maxSize) {
+      file.seekg(sizes[i], std::ios::cur);
+    } else {
+      image.levels[i].resize(sizes[i]);
+      if (!file.read(reinterpret_cast<char *>(image.levels[i].data()), sizes[i])) {
+        return false;
+      }
+    }
+    w = std::max(1, w / 2);
+    h = std::max(1, h / 2);
+  }
+  return true;
+}
+
+bool WriteCompressedCache(const std::string &filename, const CompressedImage &image) {
+  CompressedCacheHeader header = {COMPRESSED_CACHE_MAGIC,
+                                  COMPRESSED_CACHE_VERSION,
+                                  image.format,
+                                  uint32_t(image.width),
+                                  uint32_t(image.height),
+                                  uint32_t(image.levels.size()),
+                                  0,
+                                  0};
+  if (!sourceStamp(filename, header.sourceSize, header.sourceTime)) {
+    return false;
+  }
+  std::vector<uint64_t> sizes;
+  for (auto &level : image.levels) {
+    sizes.push_back(level.size());
+  }
+
+  // write and rename, another loader may be reading the same entry
+  std::string path = CompressedCachePath(filename);
+  std::ostringstream tmp;
+  tmp << path << "." << std::this_thread::get_id() << ".tmp";
+  std::error_code ec;
+  {
+    std::ofstream file(tmp.str(), std::ios::binary);
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(sizes.data()), sizes.size() * sizeof(uint64_t));
+    for (auto &level : image.levels) {
+      file.write(reinterpret_cast<const char *>(level.data()), level.size());
+    }
+    if (!file) {
+      fs::remove(tmp.str(), ec);
+      return false;
+    }
+  }
+  fs::rename(tmp.str(), path, ec);
+  if (ec) {
+    fs::remove(tmp.str(), ec);
+    return false;
+  }
+  return true;
+}
+
+} // namespace Optifuser
@@ -0,0 +1,261 @@
+#include "texture_streamer.h"
+#include "gl_stats.h"
+#include "profiler.h"
+#include "texture.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+namespace fs = std::filesystem;
+
+namespace Optifuser {
+
+TextureStreamer::TextureStreamer() { worker = std::thread(&TextureStreamer::workerLoop, this); }
+
+TextureStreamer::~TextureStreamer() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    quit = true;
+  }
+  wake.notify_all();
+  worker.join();
+  // textures outliving the streamer keep their resident levels
+  for (auto &[texture, entry] : entries) {
+    texture->mStreamer = nullptr;
+  }
+}
+
+void TextureStreamer::workerLoop() {
+  OPTIFUSER_PROFILE_THREAD("texture streamer");
+  while (true) {
+    Read read;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [this] { return quit || !reads.empty(); });
+      if (quit) {
+        return;
+      }
+      read = std::move(reads.front());
+      reads.pop_front();
+    }
+    {
+      OPTIFUSER_PROFILE_SCOPE("TextureStreamer read");
+      std::ifstream file(read.cacheFile, std::ios::binary);
+      if (!file.seekg(read.offset) ||
+          !file.read(reinterpret_cast<char *>(read.data.data()), read.data.size())) {
+        read.data.clear();
+      }
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    done.push_back(std::move(read));
+  }
+}
+
+size_t TextureStreamer::levelSize(const Entry &entry, int level) const {
+  return CompressedLevelSize(entry.image.format, std::max(1, entry.image.width >> level),
+                             std::max(1, entry.image.height >> level));
+}
+
+void TextureStreamer::add(Texture *texture, const std::string &filename, CompressedImage image) {
+  Entry &entry = entries[texture];
+  entry.generation = nextGeneration++;
+  int levels = image.levels.size();
+  entry.floorLevel = levels - 1;
+  while (entry.floorLevel > 0 &&
+         std::max(image.width >> (entry.floorLevel - 1), image.height >> (entry.floorLevel - 1)) <=
+             settings.residentSize) {
+    --entry.floorLevel;
+  }
+  entry.residentLevel = entry.wantedLevel = levels;
+
+  // the fine levels are read back from the cache when it was written
+  std::string cacheFile = CompressedCachePath(filename);
+  std::error_code ec;
+  if (fs::exists(cacheFile, ec)) {
+    entry.cacheFile = cacheFile;
+  }
+  entry.image = std::move(image);
+  texture->mStreamer = this;
+  texture->mByteSize = 0;
+
+  // mutable storage, so dropped levels can be released
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+  for (int level = levels - 1; level >= entry.floorLevel; --level) {
+    uploadLevel(texture, entry, level, entry.image.levels[level]);
+  }
+  if (!entry.cacheFile.empty()) {
+    for (int level = 0; level < entry.floorLevel; ++level) {
+      entry.image.levels[level] = {};
+    }
+  }
+}
+
+void TextureStreamer::remove(Texture *texture) {
+  auto it = entries.find(texture);
+  if (it == entries.end()) {
+    return;
+  }
+  residentBytes -= it->second.residentBytes;
+  if (it->second.pendingLevel >= 0) {
+    inflightBytes -= levelSize(it->second, it->second.pendingLevel);
+  }
+  entries.erase(it);
+}
+
+void TextureStreamer::uploadLevel(Texture *texture, Entry &entry, int level,
+                                  const std::vector<uint8_t> &data) {
+  const auto &image = entry.image;
+  glBindTexture(GL_TEXTURE_2D, texture->getId());
+  glCompressedTexImage2D(GL_TEXTURE_2D, level, image.format, std::max(1, image.width >> level),
+                         std::max(1, image.height >> level), 0, data.size(), data.data());
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+  ++glCounters.bufferUploads;
+  glCounters.uploadBytes += data.size();
+
+  entry.residentLevel = level;
+  entry.residentBytes += data.size();
+  residentBytes += data.size();
+  texture->mByteSize = entry.residentBytes;
+}
+
+// drop the finest level of the texture resident furthest beyond what it needs
+bool TextureStreamer::evictSurplus() {
+  Texture *victim = nullptr;
+  int surplus = 0;
+  for (auto &[texture, entry] : entries) {
+    int s = entry.wantedLevel - entry.residentLevel;
+    if (s > surplus) {
+      surplus = s;
+      victim = texture;
+    }
+  }
+  if (!victim) {
+    return false;
+  }
+
+  Entry &entry = entries[victim];
+  int level = entry.residentLevel;
+  glBindTexture(GL_TEXTURE_2D, victim->getId());
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level + 1);
+  // a zero sized level releases its memory, it is outside the sampled range
+  glCompressedTexImage2D(GL_TEXTURE_2D, level, entry.image.format, 0, 0, 0, 0, nullptr);
+
+  size_t size = levelSize(entry, level);
+  entry.residentLevel = level + 1;
+  entry.residentBytes -= size;
+  residentBytes -= size;
+  victim->mByteSize = entry.residentBytes;
+  ++stats.evictions;
+  return true;
+}
+
+void TextureStreamer::update() {
+  OPTIFUSER_PROFILE_SCOPE("TextureStreamer::update");
+  stats.uploads = 0;
+  stats.evictions = 0;
+
+  for (auto &[texture, entry] : entries) {
+    float size = texture->mRequestedSize * settings.texelsPerPixel;
+    texture->mRequestedSize = 0.f;
+    int top = std::max(entry.image.width, entry.image.height);
+    entry.wantedLevel = entry.floorLevel;
+    if (size > 0.f) {
+      int level = int(std::floor(std::log2(top / size)));
+      entry.wantedLevel = std::clamp(level, 0, entry.floorLevel);
+    }
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  size_t uploaded = 0;
+  auto uploadBudgetLeft = [&](size_t size) {
+    float ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start)
+                   .count();
+    // one level always goes through, or large levels would never fit
+    return uploaded == 0 ||
+           (uploaded + size <= settings.uploadBytesPerFrame && ms < settings.uploadMsPerFrame);
+  };
+
+  // upload the levels the worker has read
+  while (true) {
+    Read read;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (done.empty() || !uploadBudgetLeft(done.front().data.size())) {
+        break;
+      }
+      read = std::move(done.front());
+      done.pop_front();
+    }
+    auto it = entries.find(read.texture);
+    if (it == entries.end() || it->second.generation != read.generation) {
+      continue; // removed while it was read
+    }
+    Entry &entry = it->second;
+    inflightBytes -= levelSize(entry, entry.pendingLevel);
+    entry.pendingLevel = -1;
+    if (read.data.empty()) {
+      std::cerr << "Failed to read texture level from " << read.cacheFile << std::endl;
+      entry.failed = true;
+      continue;
+    }
+    if (read.level != entry.residentLevel - 1) {
+      continue; // the coarser level was evicted meanwhile
+    }
+    uploadLevel(read.texture, entry, read.level, read.data);
+    uploaded += read.data.size();
+    ++stats.uploads;
+  }
+
+  // request the next level of the textures furthest below their wanted level
+  std::vector<std::pair<int, Texture *>> starving;
+  for (auto &[texture, entry] : entries) {
+    if (entry.pendingLevel < 0 && !entry.failed && entry.residentLevel > entry.wantedLevel) {
+      starving.push_back({entry.residentLevel - entry.wantedLevel, texture});
+    }
+  }
+  std::sort(starving.begin(), starving.end(),
+            [](auto &a, auto &b) { return a.first > b.first; });
+  for (auto &[deficit, texture] : starving) {
+    Entry &entry = entries[texture];
+    int level = entry.residentLevel - 1;
+    size_t size = levelSize(entry, level);
+    while (residentBytes + inflightBytes + size > settings.budgetBytes && evictSurplus()) {
+    }
+    if (residentBytes + inflightBytes + size > settings.budgetBytes) {
+      continue;
+    }
+
+    if (entry.cacheFile.empty()) {
+      if (!uploadBudgetLeft(size)) {
+        continue;
+      }
+      uploadLevel(texture, entry, level, entry.image.levels[level]);
+      uploaded += size;
+      ++stats.uploads;
+    } else {
+      entry.pendingLevel = level;
+      inflightBytes += size;
+      std::lock_guard<std::mutex> lock(mutex);
+      reads.push_back({texture, entry.generation, level, entry.cacheFile,
+                       CompressedCacheLevelOffset(entry.image, level),
+                       std::vector<uint8_t>(size)});
+    }
+  }
+  wake.notify_one();
+
+  stats.textures = entries.size();
+  stats.residentBytes = residentBytes;
+  stats.totalBytes = 0;
+  stats.pendingLevels = 0;
+  for (auto &[texture, entry] : entries) {
+    for (size_t level = 0; level < entry.image.levels.size(); ++level) {
+      stats.totalBytes += levelSize(entry, level);
+    }
+    stats.pendingLevels += entry.pendingLevel >= 0;
+  }
+}
+
+} // namespace Optifuser
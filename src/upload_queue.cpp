@@ -0,0 +1,204 @@
+#include "upload_queue.h"
+#include "gl_stats.h"
+#include "profiler.h"
+#include <chrono>
+#include <cstring>
+
+namespace Optifuser {
+
+static const size_t NOT_STAGED = SIZE_MAX;
+
+UploadQueue::~UploadQueue() {
+  // the GL context must still be current
+  for (auto &f : fences) {
+    glDeleteSync(f.sync);
+  }
+  if (staging) {
+    glBindBuffer(GL_COPY_READ_BUFFER, staging);
+    glUnmapBuffer(GL_COPY_READ_BUFFER);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glDeleteBuffers(1, &staging);
+  }
+}
+
+void UploadQueue::queue(Upload upload) {
+  std::lock_guard<std::mutex> lock(mutex);
+  ++upload.ticket->pending;
+  queuedBytes += upload.data.size();
+  uploads.push_back(std::move(upload));
+}
+
+void UploadQueue::queueTexture(std::shared_ptr<UploadTicket> ticket, GLuint texture, int level,
+                               int width, int height, GLenum format, GLenum type,
+                               std::vector<uint8_t> data) {
+  queue({std::move(ticket), Kind::Texture, texture, level, width, height, format, type, 0,
+         std::move(data)});
+}
+
+void UploadQueue::queueCompressedTexture(std::shared_ptr<UploadTicket> ticket, GLuint texture,
+                                         int level, int width, int height, GLenum format,
+                                         std::vector<uint8_t> data) {
+  queue({std::move(ticket), Kind::CompressedTexture, texture, level, width, height, format, 0, 0,
+         std::move(data)});
+}
+
+void UploadQueue::queueBuffer(std::shared_ptr<UploadTicket> ticket, GLuint buffer, size_t offset,
+                              std::vector<uint8_t> data) {
+  queue({std::move(ticket), Kind::Buffer, buffer, 0, 0, 0, 0, 0, offset, std::move(data)});
+}
+
+void UploadQueue::createStaging() {
+  capacity = settings.stagingBytes;
+  GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+  glGenBuffers(1, &staging);
+  glBindBuffer(GL_COPY_READ_BUFFER, staging);
+  glBufferStorage(GL_COPY_READ_BUFFER, capacity, nullptr, flags);
+  mapped = static_cast<uint8_t *>(glMapBufferRange(GL_COPY_READ_BUFFER, 0, capacity, flags));
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+}
+
+void UploadQueue::retire(bool wait) {
+  while (!fences.empty()) {
+    GLenum status = glClientWaitSync(fences.front().sync, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0,
+                                     wait ? 1000000000 : 0);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+      return;
+    }
+    used -= fences.front().bytes;
+    glDeleteSync(fences.front().sync);
+    fences.pop_front();
+    wait = false;
+  }
+}
+
+void UploadQueue::fence() {
+  if (unfenced) {
+    fences.push_back({glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), unfenced});
+    unfenced = 0;
+  }
+}
+
+// offset of size bytes in the ring, NOT_STAGED while the GPU still reads the space
+size_t UploadQueue::allocate(size_t size) {
+  size = (size + 255) & ~size_t(255);
+  if (used == 0) {
+    head = 0;
+  }
+  size_t start = head, waste = 0;
+  if (start + size > capacity) {
+    waste = capacity - start;
+    start = 0;
+  }
+  if (used + waste + size > capacity) {
+    return NOT_STAGED;
+  }
+  head = start + size;
+  used += waste + size;
+  unfenced += waste + size;
+  return start;
+}
+
+void UploadQueue::submit(Upload &upload, size_t stagingOffset) {
+  bool staged = stagingOffset != NOT_STAGED;
+  const void *source =
+      staged ? reinterpret_cast<const void *>(stagingOffset) : upload.data.data();
+  size_t size = upload.data.size();
+
+  if (upload.kind == Kind::Buffer) {
+    glBindBuffer(GL_COPY_WRITE_BUFFER, upload.target);
+    if (staged) {
+      glBindBuffer(GL_COPY_READ_BUFFER, staging);
+      glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, stagingOffset, upload.offset,
+                          size);
+      glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    } else {
+      glBufferSubData(GL_COPY_WRITE_BUFFER, upload.offset, size, source);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  } else {
+    // everything else passes client pointers, the unpack buffer must not stay bound
+    if (staged) {
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, staging);
+    }
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, upload.target);
+    if (upload.kind == Kind::CompressedTexture) {
+      glCompressedTexSubImage2D(GL_TEXTURE_2D, upload.level, 0, 0, upload.width, upload.height,
+                                upload.format, size, source);
+    } else {
+      glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+      glTexSubImage2D(GL_TEXTURE_2D, upload.level, 0, 0, upload.width, upload.height,
+                      upload.format, upload.type, source);
+      glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    }
+    if (staged) {
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+  }
+  ++glCounters.bufferUploads;
+  glCounters.uploadBytes += size;
+}
+
+void UploadQueue::update() {
+  OPTIFUSER_PROFILE_SCOPE("UploadQueue::update");
+  process(true);
+}
+
+void UploadQueue::finish() {
+  OPTIFUSER_PROFILE_SCOPE("UploadQueue::finish");
+  process(false);
+}
+
+void UploadQueue::process(bool budgeted) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (!staging && settings.stagingBytes && GLEW_ARB_buffer_storage) {
+    createStaging();
+  }
+  retire(false);
+  stats.uploads = 0;
+  stats.uploadedBytes = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  while (!uploads.empty()) {
+    Upload &upload = uploads.front();
+    size_t size = upload.data.size();
+    if (!upload.ticket->cancelled) {
+      float ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start)
+                     .count();
+      // one upload always goes through, or large ones would never fit
+      if (budgeted && stats.uploads > 0 &&
+          (stats.uploadedBytes + size > settings.bytesPerFrame || ms >= settings.msPerFrame)) {
+        break;
+      }
+      size_t offset = NOT_STAGED;
+      if (mapped && size <= capacity) {
+        offset = allocate(size);
+        if (offset == NOT_STAGED) {
+          if (budgeted) {
+            break; // the ring is full until the GPU catches up
+          }
+          fence();
+          retire(true);
+          continue;
+        }
+        memcpy(mapped + offset, upload.data.data(), size);
+      }
+      submit(upload, offset);
+      ++stats.uploads;
+      stats.uploadedBytes += size;
+    }
+
+    auto ticket = std::move(upload.ticket);
+    queuedBytes -= size;
+    uploads.pop_front();
+    if (--ticket->pending == 0 && !ticket->cancelled && ticket->onResident) {
+      ticket->onResident();
+    }
+  }
+  fence();
+
+  stats.queuedUploads = uploads.size();
+  stats.queuedBytes = queuedBytes;
+}
+
+} // namespace Optifuser